@@ -4,15 +4,22 @@
  ==================================================================== */
 
 #include "compress.h"
+#include "gf2m.h"
 #include "params.h"
 
 #include <string.h>
 
-static int bn_trace(const BIGNUM *bn, const BIGNUM *p, BN_CTX *ctx)
+/* Helpers below use native field arithmetic if f is not NULL and bn is reduced, BN_GF2m otherwise */
+
+static int bn_trace(const BIGNUM *bn, const BIGNUM *p, const DSTU_GF2M_FIELD *f, BN_CTX *ctx)
 {
     BIGNUM *r = NULL;
+    gf2m_elem e;
     int res = -1, i;
 
+    if (f && gf2m_from_bn(f, e, bn))
+        return gf2m_trace(f, e);
+
     BN_CTX_start(ctx);
 
     r = BN_CTX_get(ctx);
@@ -38,12 +45,36 @@ static int bn_trace(const BIGNUM *bn, const BIGNUM *p, BN_CTX *ctx)
     return res;
 }
 
+static int bn_inv(BIGNUM *r, const BIGNUM *bn, const BIGNUM *p, const DSTU_GF2M_FIELD *f, BN_CTX *ctx)
+{
+    gf2m_elem e;
+
+    if (!f || BN_is_zero(bn) || !gf2m_from_bn(f, e, bn))
+        return BN_GF2m_mod_inv(r, bn, p, ctx);
+
+    gf2m_inv(f, e, e);
+    return gf2m_to_bn(f, r, e);
+}
+
+static int bn_solve_quad(BIGNUM *r, const BIGNUM *bn, const BIGNUM *p, const DSTU_GF2M_FIELD *f, BN_CTX *ctx)
+{
+    gf2m_elem e;
+
+    if (!f || !gf2m_from_bn(f, e, bn))
+        return BN_GF2m_mod_solve_quad(r, bn, p, ctx);
+
+    if (!gf2m_solve_quad(f, e, e))
+        return 0;
+    return gf2m_to_bn(f, r, e);
+}
+
 int dstu_point_compress(const EC_GROUP *group, const EC_POINT *point,
                         unsigned char *compressed, int compressed_length)
 {
     int field_size, res = 0, trace;
     BN_CTX *ctx;
     BIGNUM *p, *x_inv, *x, *y;
+    const DSTU_GF2M_FIELD *f;
 
     field_size = (EC_GROUP_get_degree(group) + 7) / 8;
     if (compressed_length < field_size)
@@ -64,6 +95,7 @@ int dstu_point_compress(const EC_GROUP *group, const EC_POINT *point,
 
     if (!EC_GROUP_get_curve_GF2m(group, p, NULL, NULL, ctx))
         goto err;
+    f = gf2m_field(p);
 
     if (!EC_POINT_get_affine_coordinates_GF2m(group, point, x, y, ctx))
         goto err;
@@ -75,13 +107,13 @@ int dstu_point_compress(const EC_GROUP *group, const EC_POINT *point,
         goto err;
     }
 
-    if (!BN_GF2m_mod_inv(x_inv, x, p, ctx))
+    if (!bn_inv(x_inv, x, p, f, ctx))
         goto err;
 
     if (!BN_GF2m_mod_mul(y, y, x_inv, p, ctx))
         goto err;
 
-    trace = bn_trace(y, p, ctx);
+    trace = bn_trace(y, p, f, ctx);
     if (-1 == trace)
         goto err;
 
@@ -115,6 +147,7 @@ int dstu_point_expand(const unsigned char *compressed, int compressed_length,
     int field_size, res = 0, trace, k;
     BN_CTX *ctx;
     BIGNUM *p, *a, *b, *x2, *x, *y;
+    const DSTU_GF2M_FIELD *f;
 
     field_size = (EC_GROUP_get_degree(group) + 7) / 8;
     if (compressed_length < field_size)
@@ -137,6 +170,7 @@ int dstu_point_expand(const unsigned char *compressed, int compressed_length,
 
     if (!EC_GROUP_get_curve_GF2m(group, p, a, b, ctx))
         goto err;
+    f = gf2m_field(p);
 
     if (!BN_bin2bn(compressed, compressed_length, x))
         goto err;
@@ -157,7 +191,7 @@ int dstu_point_expand(const unsigned char *compressed, int compressed_length,
     if (!BN_clear_bit(x, 0))
         goto err;
 
-    trace = bn_trace(x, p, ctx);
+    trace = bn_trace(x, p, f, ctx);
     if (-1 == trace)
         goto err;
 
@@ -182,16 +216,16 @@ int dstu_point_expand(const unsigned char *compressed, int compressed_length,
     if (!BN_GF2m_add(y, y, b))
         goto err;
 
-    if (!BN_GF2m_mod_inv(x2, x2, p, ctx))
+    if (!bn_inv(x2, x2, p, f, ctx))
         goto err;
 
     if (!BN_GF2m_mod_mul(y, y, x2, p, ctx))
         goto err;
 
-    if (!BN_GF2m_mod_solve_quad(y, y, p, ctx))
+    if (!bn_solve_quad(y, y, p, f, ctx))
         goto err;
 
-    trace = bn_trace(y, p, ctx);
+    trace = bn_trace(y, p, f, ctx);
 
     if ((k && !trace) || (!k && trace))
     {
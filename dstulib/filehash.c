@@ -0,0 +1,197 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+#include "filehash.h"
+#include "parallel.h" // dstu_parallel_*
+#include "params.h" // default_sbox
+#include "sbox.h" // dstu_sbox_*
+
+#include "gost/gosthash.h" // gost_hash_ctx
+
+#include <openssl/crypto.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#define read _read
+#define close _close
+#define open _open
+#else
+#include <unistd.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#if defined(POSIX_FADV_SEQUENTIAL) && defined(POSIX_FADV_WILLNEED)
+#define DSTU_FILE_HASH_FADVISE
+#endif
+
+/* Read buffer size */
+#define FILE_HASH_BUFFER (64 * 1024)
+/* Regular files are read ahead by windows of that size, the next one is asked for while one is hashed */
+#define FILE_HASH_WINDOW (4 * 1024 * 1024)
+
+/*
+ * Plain read, not mmap: a file truncated while being hashed gives a short read here,
+ * but SIGBUS in a mapping of it
+ */
+static int hash_read(int fd, gost_hash_ctx *ctx)
+{
+    unsigned char buf[FILE_HASH_BUFFER];
+    long got;
+#ifdef DSTU_FILE_HASH_FADVISE
+    struct stat st;
+    off_t pos = -1, ahead = 0;
+
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode))
+        pos = lseek(fd, 0, SEEK_CUR);
+    if (pos >= 0)
+    {
+        posix_fadvise(fd, pos, 0, POSIX_FADV_SEQUENTIAL);
+        ahead = pos;
+    }
+#endif
+
+    for (;;)
+    {
+#ifdef DSTU_FILE_HASH_FADVISE
+        if ((pos >= 0) && (ahead - pos < FILE_HASH_WINDOW))
+        {
+            posix_fadvise(fd, ahead, FILE_HASH_WINDOW, POSIX_FADV_WILLNEED);
+            ahead += FILE_HASH_WINDOW;
+        }
+#endif
+        got = read(fd, buf, sizeof(buf));
+        if (got == 0)
+            return 1;
+        if (got < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+#ifdef DSTU_FILE_HASH_FADVISE
+        if (pos >= 0)
+            pos += got;
+#endif
+        hash_block(ctx, buf, (size_t) got);
+    }
+}
+
+int dstu_hash_fd(int fd, const gost_kbox *kbox, unsigned char *md)
+{
+    gost_hash_ctx ctx;
+    gost_ctx cctx;
+
+    /* default_sbox tables are built in, no reference needs to be kept */
+    if (!kbox)
+        kbox = dstu_sbox_get(default_sbox);
+    if (!kbox)
+    {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    gost_init(&cctx, kbox);
+    ctx.cipher_ctx = &cctx;
+
+    if (!hash_read(fd, &ctx))
+        return 0;
+
+    finish_hash(&ctx, md);
+    return 1;
+}
+
+int dstu_hash_file(const char *path, const gost_kbox *kbox, unsigned char *md)
+{
+    int fd, ret, saved;
+
+    fd = open(path, O_RDONLY | O_BINARY);
+    if (fd < 0)
+        return 0;
+
+    ret = dstu_hash_fd(fd, kbox, md);
+    saved = errno;
+    close(fd);
+    errno = saved;
+    return ret;
+}
+
+struct file_hash_job
+{
+    const char * const *paths;
+    size_t n;
+    size_t next;
+    const gost_kbox *kbox;
+    unsigned char *md;
+    int *error;
+    CRYPTO_RWLOCK *lock;
+};
+
+static int take_file(struct file_hash_job *job, size_t *index)
+{
+    int ret = 0;
+
+    if (!job->lock || !CRYPTO_THREAD_write_lock(job->lock))
+        return 0;
+    if (job->next < job->n)
+    {
+        *index = job->next++;
+        ret = 1;
+    }
+    CRYPTO_THREAD_unlock(job->lock);
+    return ret;
+}
+
+static void file_hash_worker(void *arg, int index)
+{
+    struct file_hash_job *job = arg;
+    size_t i;
+
+    (void) index;
+    while (take_file(job, &i))
+    {
+        if (dstu_hash_file(job->paths[i], job->kbox, job->md + i * DSTU_FILE_HASH_SIZE))
+            job->error[i] = 0;
+        else
+            job->error[i] = errno ? errno : EIO;
+    }
+}
+
+void dstu_hash_files(const char * const *paths, size_t n, const gost_kbox *kbox,
+                     unsigned char *md, int *error)
+{
+    struct file_hash_job job;
+    int threads = dstu_parallel_threads();
+    size_t i;
+
+    if (!n)
+        return;
+
+    job.paths = paths;
+    job.n = n;
+    job.next = 0;
+    job.kbox = kbox;
+    job.md = md;
+    job.error = error;
+    job.lock = CRYPTO_THREAD_lock_new();
+    /* Files nobody got to are failed */
+    for (i = 0; i < n; i++)
+        error[i] = job.lock ? EIO : ENOMEM;
+    if (!job.lock)
+        return;
+
+    if ((size_t) threads > n)
+        threads = (int) n;
+    dstu_parallel_run(threads, file_hash_worker, &job);
+
+    CRYPTO_THREAD_lock_free(job.lock);
+}
@@ -0,0 +1,28 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+#ifndef DSTU_FILEHASH_H_
+#define DSTU_FILEHASH_H_
+
+#include "gost/gost89.h"
+
+#include <stddef.h>
+
+#define DSTU_FILE_HASH_SIZE 32
+
+/* DSTU 34311 digest of everything read from fd, md gets DSTU_FILE_HASH_SIZE bytes.
+ * Regular files are read ahead while hashing. Truncating a file meanwhile gives a wrong digest, not a signal.
+ * kbox NULL means default_sbox. Returns 1 on success, 0 with errno set on failure.
+ */
+int dstu_hash_fd(int fd, const gost_kbox *kbox, unsigned char *md);
+/* Same for a file opened by path */
+int dstu_hash_file(const char *path, const gost_kbox *kbox, unsigned char *md);
+
+/* Hashes paths[0] ... paths[n - 1] using up to dstu_parallel_threads() threads, one file per thread at a time.
+ * md gets DSTU_FILE_HASH_SIZE bytes per file, error[i] is 0 for hashed files and errno value for failed ones.
+ */
+void dstu_hash_files(const char * const *paths, size_t n, const gost_kbox *kbox,
+                     unsigned char *md, int *error);
+
+#endif /* DSTU_FILEHASH_H_ */
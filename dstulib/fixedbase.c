@@ -0,0 +1,522 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+#include "fixedbase.h"
+#include "gf2m.h"
+#include "ladder.h" // dstu_point_mul, dstu_scalar_pad
+#include "params.h" // curve_nid_from_group, dstu_curves
+
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <openssl/obj_mac.h>
+
+#include <string.h>
+
+/* Scalars are split into windows of that many bits, each window gives one table lookup */
+#define WINDOW_BITS 4
+#define WINDOW_POINTS ((1 << WINDOW_BITS) - 1)
+
+/* Custom curves get a table after that many multiplications, no more than that many are tracked */
+#define CUSTOM_MIN_USES 4
+#define CUSTOM_MAX 8
+
+/* Multiples j * 2^(WINDOW_BITS * i) * G for j = 1..WINDOW_POINTS, affine x and y */
+typedef struct
+{
+    const DSTU_GF2M_FIELD *field;
+    /* Curve coefficient a, 0 or 1 */
+    int a;
+    int windows;
+    gf2m_word *points;
+} DSTU_FIXEDBASE_TABLE;
+
+typedef struct dstu_fixedbase_custom_st
+{
+    EC_GROUP *group;
+    /* Curve of group, compared before the generator */
+    BIGNUM *p, *a, *b;
+    int uses;
+    DSTU_FIXEDBASE_TABLE *table;
+    struct dstu_fixedbase_custom_st *next;
+} DSTU_FIXEDBASE_CUSTOM;
+
+static DSTU_FIXEDBASE_TABLE *named_tables[DSTU_CURVE_COUNT];
+static DSTU_FIXEDBASE_CUSTOM *custom = NULL;
+static int custom_count = 0;
+static CRYPTO_RWLOCK *tables_lock = NULL;
+static CRYPTO_ONCE tables_init = CRYPTO_ONCE_STATIC_INIT;
+
+static void do_tables_init(void)
+{
+    tables_lock = CRYPTO_THREAD_lock_new();
+}
+
+static gf2m_word *table_point(const DSTU_FIXEDBASE_TABLE *table, int window, int j)
+{
+    return table->points + ((size_t) window * WINDOW_POINTS + (j - 1)) * 2 * GF2M_MAX_WORDS;
+}
+
+static void table_free(DSTU_FIXEDBASE_TABLE *table)
+{
+    if (!table)
+        return;
+    OPENSSL_free(table->points);
+    OPENSSL_free(table);
+}
+
+/* One more window than the order has, see dstu_generator_mul. Only curves over DSTU fields with a = 0 or 1 */
+static DSTU_FIXEDBASE_TABLE *table_build(const EC_GROUP *group)
+{
+    DSTU_FIXEDBASE_TABLE *table = NULL, *ret = NULL;
+    const EC_POINT *G = EC_GROUP_get0_generator(group);
+    const BIGNUM *order = EC_GROUP_get0_order(group);
+    EC_POINT *base = NULL, *P = NULL;
+    BIGNUM *p, *a, *x, *y;
+    BN_CTX *ctx = NULL;
+    int i, j;
+
+    if (!G || !order || BN_is_zero(order))
+        return NULL;
+
+    ctx = BN_CTX_new();
+    if (!ctx)
+        return NULL;
+
+    BN_CTX_start(ctx);
+    p = BN_CTX_get(ctx);
+    a = BN_CTX_get(ctx);
+    x = BN_CTX_get(ctx);
+    y = BN_CTX_get(ctx);
+    if (!y)
+        goto err;
+
+    table = OPENSSL_zalloc(sizeof(DSTU_FIXEDBASE_TABLE));
+    base = EC_POINT_dup(G, group);
+    P = EC_POINT_new(group);
+    if (!table || !base || !P)
+        goto err;
+
+    if (!EC_GROUP_get_curve_GF2m(group, p, a, NULL, ctx))
+        goto err;
+
+    table->field = gf2m_field(p);
+    if (!table->field || (!BN_is_zero(a) && !BN_is_one(a)))
+        goto err;
+
+    table->a = BN_is_one(a);
+    table->windows = (BN_num_bits(order) + 1 + WINDOW_BITS - 1) / WINDOW_BITS;
+    table->points = OPENSSL_malloc((size_t) table->windows * WINDOW_POINTS * 2 * sizeof(gf2m_elem));
+    if (!table->points)
+        goto err;
+
+    for (i = 0; i < table->windows; i++)
+    {
+        if (!EC_POINT_copy(P, base))
+            goto err;
+
+        for (j = 1; j <= WINDOW_POINTS; j++)
+        {
+            /* Order is prime, so no multiple here is infinity */
+            if (EC_POINT_is_at_infinity(group, P))
+                goto err;
+
+            if (!EC_POINT_get_affine_coordinates_GF2m(group, P, x, y, ctx))
+                goto err;
+
+            if (!gf2m_from_bn(table->field, table_point(table, i, j), x)
+                    || !gf2m_from_bn(table->field, table_point(table, i, j) + GF2M_MAX_WORDS, y))
+                goto err;
+
+            if (!EC_POINT_add(group, P, P, base, ctx))
+                goto err;
+        }
+
+        /* P is (WINDOW_POINTS + 1) * base now */
+        if (!EC_POINT_copy(base, P))
+            goto err;
+    }
+
+    ret = table;
+    table = NULL;
+
+    err:
+
+    table_free(table);
+
+    if (P)
+        EC_POINT_free(P);
+    if (base)
+        EC_POINT_free(base);
+
+    BN_CTX_end(ctx);
+    BN_CTX_free(ctx);
+
+    return ret;
+}
+
+/* Installs table into *slot unless another thread did it first, tables_lock is not held */
+static DSTU_FIXEDBASE_TABLE *table_install(DSTU_FIXEDBASE_TABLE **slot, DSTU_FIXEDBASE_TABLE *table)
+{
+    DSTU_FIXEDBASE_TABLE *ret;
+
+    if (!CRYPTO_THREAD_write_lock(tables_lock))
+    {
+        table_free(table);
+        return NULL;
+    }
+
+    if (!(*slot))
+        *slot = table;
+    else
+        table_free(table);
+    ret = *slot;
+
+    CRYPTO_THREAD_unlock(tables_lock);
+
+    return ret;
+}
+
+static DSTU_FIXEDBASE_TABLE *named_table(int curve_num, const EC_GROUP *group)
+{
+    DSTU_FIXEDBASE_TABLE *table;
+
+    if (!CRYPTO_THREAD_read_lock(tables_lock))
+        return NULL;
+    table = named_tables[curve_num];
+    CRYPTO_THREAD_unlock(tables_lock);
+
+    if (table)
+        return table;
+
+    /* Built outside the lock, if several threads do it at once the first table installed is kept */
+    table = table_build(group);
+    if (!table)
+        return NULL;
+
+    return table_install(&(named_tables[curve_num]), table);
+}
+
+/* Same as !EC_GROUP_cmp(group, entry->group) for the curve p, a, b of group, but compares the cheapest parts first */
+static int custom_matches(const EC_GROUP *group, const BIGNUM *p, const BIGNUM *a, const BIGNUM *b,
+                          const DSTU_FIXEDBASE_CUSTOM *entry, BN_CTX *ctx)
+{
+    return (EC_GROUP_method_of(group) == EC_GROUP_method_of(entry->group))
+        && !BN_cmp(EC_GROUP_get0_order(group), EC_GROUP_get0_order(entry->group))
+        && !BN_cmp(p, entry->p) && !BN_cmp(a, entry->a) && !BN_cmp(b, entry->b)
+        && !EC_POINT_cmp(entry->group, EC_GROUP_get0_generator(group), EC_GROUP_get0_generator(entry->group), ctx);
+}
+
+/* tables_lock is held */
+static DSTU_FIXEDBASE_CUSTOM *custom_find(const EC_GROUP *group, const BIGNUM *p, const BIGNUM *a, const BIGNUM *b,
+                                          BN_CTX *ctx)
+{
+    DSTU_FIXEDBASE_CUSTOM *entry;
+
+    for (entry = custom; entry; entry = entry->next)
+    {
+        if (custom_matches(group, p, a, b, entry, ctx))
+            break;
+    }
+
+    return entry;
+}
+
+static DSTU_FIXEDBASE_CUSTOM *custom_new(const EC_GROUP *group, const BIGNUM *p, const BIGNUM *a, const BIGNUM *b)
+{
+    DSTU_FIXEDBASE_CUSTOM *entry = OPENSSL_zalloc(sizeof(DSTU_FIXEDBASE_CUSTOM));
+
+    if (!entry)
+        return NULL;
+
+    entry->group = EC_GROUP_dup(group);
+    entry->p = BN_dup(p);
+    entry->a = BN_dup(a);
+    entry->b = BN_dup(b);
+    if (entry->group && entry->p && entry->a && entry->b)
+        return entry;
+
+    if (entry->group)
+        EC_GROUP_free(entry->group);
+    BN_free(entry->p);
+    BN_free(entry->a);
+    BN_free(entry->b);
+    OPENSSL_free(entry);
+
+    return NULL;
+}
+
+static DSTU_FIXEDBASE_TABLE *custom_table(const EC_GROUP *group, BN_CTX *ctx)
+{
+    DSTU_FIXEDBASE_CUSTOM *entry;
+    DSTU_FIXEDBASE_TABLE *table = NULL;
+    const BIGNUM *order = EC_GROUP_get0_order(group);
+    BIGNUM *p, *a, *b;
+    int full, build = 0;
+
+    if (!order || !EC_GROUP_get0_generator(group))
+        return NULL;
+
+    BN_CTX_start(ctx);
+    p = BN_CTX_get(ctx);
+    a = BN_CTX_get(ctx);
+    b = BN_CTX_get(ctx);
+
+    /* Curves table_build does not take never get an entry */
+    if (!b || !EC_GROUP_get_curve_GF2m(group, p, a, b, ctx) || !gf2m_field(p) || (!BN_is_zero(a) && !BN_is_one(a)))
+        goto err;
+
+    /* Once the table is there, the read lock is enough */
+    if (!CRYPTO_THREAD_read_lock(tables_lock))
+        goto err;
+    entry = custom_find(group, p, a, b, ctx);
+    if (entry)
+        table = entry->table;
+    full = (custom_count >= CUSTOM_MAX);
+    CRYPTO_THREAD_unlock(tables_lock);
+
+    if (table || (!entry && full))
+        goto err;
+
+    /* Prime orders are checked once, as the curve takes a slot then, composite ones fail fast */
+    if (!entry && (BN_is_prime_ex(order, BN_prime_checks, ctx, NULL) != 1))
+        goto err;
+
+    if (!CRYPTO_THREAD_write_lock(tables_lock))
+        goto err;
+
+    /* Another thread may have added it or taken the last slot meanwhile */
+    entry = custom_find(group, p, a, b, ctx);
+    if (!entry && (custom_count < CUSTOM_MAX))
+    {
+        entry = custom_new(group, p, a, b);
+        if (entry)
+        {
+            entry->next = custom;
+            custom = entry;
+            custom_count++;
+        }
+    }
+
+    if (entry)
+    {
+        table = entry->table;
+        /* Exactly one thread sees the count reach the threshold and builds the table */
+        if (!table && (++(entry->uses) == CUSTOM_MIN_USES))
+            build = 1;
+    }
+
+    CRYPTO_THREAD_unlock(tables_lock);
+
+    if (build)
+    {
+        table = table_build(group);
+        /* Entries are never removed, so entry is still valid here */
+        if (table)
+            table = table_install(&(entry->table), table);
+    }
+
+    err:
+
+    BN_CTX_end(ctx);
+
+    return table;
+}
+
+static DSTU_FIXEDBASE_TABLE *table_for_group(const EC_GROUP *group, BN_CTX *ctx)
+{
+    int nid, i;
+
+    if (!CRYPTO_THREAD_run_once(&tables_init, do_tables_init) || !tables_lock)
+        return NULL;
+
+    nid = curve_nid_from_group(group);
+    if (NID_undef == nid)
+        return custom_table(group, ctx);
+
+    for (i = 0; i < DSTU_CURVE_COUNT; i++)
+    {
+        if (nid == dstu_curves[i].nid)
+            return named_table(i, group);
+    }
+
+    return NULL;
+}
+
+/* Copies entry j of a window into x and y reading all of them, j = 0 gives zeros */
+static void table_select(const DSTU_FIXEDBASE_TABLE *table, int window, unsigned int j, gf2m_elem x, gf2m_elem y)
+{
+    const gf2m_word *point;
+    gf2m_word mask;
+    unsigned int e;
+    int w;
+
+    gf2m_zero(x);
+    gf2m_zero(y);
+    for (e = 1; e <= WINDOW_POINTS; e++)
+    {
+        point = table_point(table, window, e);
+        /* All ones for e == j only */
+        mask = 0 - (gf2m_word) (((e ^ j) - 1) >> (sizeof(unsigned int) * 8 - 1));
+        for (w = 0; w < GF2M_MAX_WORDS; w++)
+        {
+            x[w] |= point[w] & mask;
+            y[w] |= point[GF2M_MAX_WORDS + w] & mask;
+        }
+    }
+}
+
+/*
+ * (X3, Y3, Z3) = Q + (x2, y2) for Q = (X1, Y1, Z1) in Lopez-Dahab projective coordinates
+ * (x = X / Z, y = Y / Z^2) and affine point (x2, y2), see "Guide to Elliptic Curve Cryptography",
+ * algorithm 3.25. Q must not be infinity or +-(x2, y2), Z3 is zero then
+ */
+static void ld_add_affine(const DSTU_FIXEDBASE_TABLE *table, gf2m_elem X3, gf2m_elem Y3, gf2m_elem Z3,
+                          const gf2m_elem X1, const gf2m_elem Y1, const gf2m_elem Z1,
+                          const gf2m_elem x2, const gf2m_elem y2)
+{
+    const DSTU_GF2M_FIELD *f = table->field;
+    gf2m_elem A, B, C, D, E;
+
+    /* A = y2 * Z1^2 + Y1, B = x2 * Z1 + X1, C = Z1 * B */
+    gf2m_sqr(f, D, Z1);
+    gf2m_mul(f, A, y2, D);
+    gf2m_add(f, A, A, Y1);
+    gf2m_mul(f, B, x2, Z1);
+    gf2m_add(f, B, B, X1);
+    gf2m_mul(f, C, Z1, B);
+
+    /* D = B^2 * (C + a * Z1^2), a is 0 or 1 for DSTU curves */
+    if (table->a)
+        gf2m_add(f, D, D, C);
+    else
+        gf2m_copy(D, C);
+    gf2m_sqr(f, B, B);
+    gf2m_mul(f, D, D, B);
+
+    /* Z3 = C^2, E = A * C, X3 = A^2 + D + E */
+    gf2m_sqr(f, Z3, C);
+    gf2m_mul(f, E, A, C);
+    gf2m_sqr(f, X3, A);
+    gf2m_add(f, X3, X3, D);
+    gf2m_add(f, X3, X3, E);
+
+    /* Y3 = (E + Z3) * (X3 + x2 * Z3) + (x2 + y2) * Z3^2 */
+    gf2m_mul(f, A, x2, Z3);
+    gf2m_add(f, A, A, X3);
+    gf2m_add(f, E, E, Z3);
+    gf2m_mul(f, Y3, E, A);
+    gf2m_add(f, B, x2, y2);
+    gf2m_sqr(f, C, Z3);
+    gf2m_mul(f, B, B, C);
+    gf2m_add(f, Y3, Y3, B);
+}
+
+static int table_mul(const EC_GROUP *group, const DSTU_FIXEDBASE_TABLE *table, EC_POINT *r, const BIGNUM *k,
+                     BN_CTX *ctx)
+{
+    const DSTU_GF2M_FIELD *f = table->field;
+    const BIGNUM *order = EC_GROUP_get0_order(group);
+    BIGNUM *kk, *x, *y;
+    gf2m_elem X, Y, Z, X3, Y3, Z3, x2, y2;
+    unsigned int digit, exceptional = 0;
+    int i, b, ret = 0;
+
+    BN_CTX_start(ctx);
+    kk = BN_CTX_get(ctx);
+    x = BN_CTX_get(ctx);
+    y = BN_CTX_get(ctx);
+    if (!y)
+        goto err;
+
+    /* Padded to one bit more than n, so the top window is never zero */
+    if (!dstu_scalar_pad(kk, k, order, ctx))
+        goto err;
+
+    for (i = table->windows - 1; i >= 0; i--)
+    {
+        digit = 0;
+        for (b = WINDOW_BITS - 1; b >= 0; b--)
+            digit = (digit << 1) | (unsigned int) BN_is_bit_set(kk, i * WINDOW_BITS + b);
+
+        table_select(table, i, digit, x2, y2);
+
+        if (i == table->windows - 1)
+        {
+            gf2m_copy(X, x2);
+            gf2m_copy(Y, y2);
+            gf2m_one(Z);
+            continue;
+        }
+
+        ld_add_affine(table, X3, Y3, Z3, X, Y, Z, x2, y2);
+
+        /* Zero digits keep the sum, without branching on them */
+        digit = (digit | (0 - digit)) >> (sizeof(unsigned int) * 8 - 1);
+        exceptional |= digit & (unsigned int) gf2m_is_zero(f, Z3);
+        gf2m_cswap(f, digit, X, X3);
+        gf2m_cswap(f, digit, Y, Y3);
+        gf2m_cswap(f, digit, Z, Z3);
+    }
+
+    /* Sum met a table point itself or its inverse, which a valid scalar gives with negligible probability */
+    if (exceptional)
+    {
+        ret = EC_POINT_mul(group, r, k, NULL, NULL, ctx);
+        goto err;
+    }
+
+    /* x = X / Z, y = Y / Z^2 */
+    gf2m_inv(f, Z3, Z);
+    gf2m_mul(f, X, X, Z3);
+    gf2m_sqr(f, Z3, Z3);
+    gf2m_mul(f, Y, Y, Z3);
+
+    if (!gf2m_to_bn(f, x, X) || !gf2m_to_bn(f, y, Y))
+        goto err;
+
+    ret = EC_POINT_set_affine_coordinates_GF2m(group, r, x, y, ctx);
+
+    err:
+
+    OPENSSL_cleanse(X, sizeof(X));
+    OPENSSL_cleanse(Y, sizeof(Y));
+    OPENSSL_cleanse(Z, sizeof(Z));
+    OPENSSL_cleanse(X3, sizeof(X3));
+    OPENSSL_cleanse(Y3, sizeof(Y3));
+    OPENSSL_cleanse(Z3, sizeof(Z3));
+    OPENSSL_cleanse(x2, sizeof(x2));
+    OPENSSL_cleanse(y2, sizeof(y2));
+    BN_clear(kk);
+    BN_CTX_end(ctx);
+    return ret;
+}
+
+int dstu_generator_mul(const EC_GROUP *group, EC_POINT *r, const BIGNUM *k, BN_CTX *ctx)
+{
+    const DSTU_FIXEDBASE_TABLE *table;
+    const BIGNUM *order = EC_GROUP_get0_order(group);
+    BN_CTX *new_ctx = NULL;
+    int ret;
+
+    /* Only DSTU binary curves, 0 < k < n */
+    if (!order || BN_is_zero(k) || BN_is_negative(k) || (BN_cmp(k, order) >= 0)
+            || (NID_X9_62_characteristic_two_field != EC_METHOD_get_field_type(EC_GROUP_method_of(group))))
+        return EC_POINT_mul(group, r, k, NULL, NULL, ctx);
+
+    if (!ctx)
+    {
+        ctx = new_ctx = BN_CTX_new();
+        if (!ctx)
+            return 0;
+    }
+
+    table = table_for_group(group, ctx);
+    if (table)
+        ret = table_mul(group, table, r, k, ctx);
+    else
+        ret = dstu_point_mul(group, r, EC_GROUP_get0_generator(group), k, ctx);
+
+    BN_CTX_free(new_ctx);
+    return ret;
+}
@@ -0,0 +1,21 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+#ifndef DSTU_FIXEDBASE_H_
+#define DSTU_FIXEDBASE_H_
+
+#include <openssl/ec.h>
+
+/* Fixed-base multiplication of curve generators.
+ * Tables of multiples of the generator (every 4-bit window of a scalar, every digit) are built
+ * lazily, once per curve, and shared by all threads. Named curves get one on first use, custom
+ * ones after they have been used several times, if they are over a DSTU field with a = 0 or 1.
+ * Each table lookup reads every entry of the window, so that memory accesses do not depend on
+ * the scalar.
+ */
+
+/* r = k * G. Falls back to dstu_point_mul for curves without a table. ctx may be NULL */
+int dstu_generator_mul(const EC_GROUP *group, EC_POINT *r, const BIGNUM *k, BN_CTX *ctx);
+
+#endif /* DSTU_FIXEDBASE_H_ */
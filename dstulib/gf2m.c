@@ -0,0 +1,500 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+#include "gf2m.h"
+
+#include <openssl/crypto.h>
+
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define GF2M_X86_CLMUL
+#include <immintrin.h>
+#define TARGET_CLMUL __attribute__((target("pclmul,sse2")))
+#endif
+
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+struct dstu_gf2m_field_st
+{
+    int m;
+    int words;
+    /* Same as BN_GF2m_poly2arr gives */
+    int poly[6];
+    /* Products and squares of words elements, reduced */
+    void (*mul_comb)(gf2m_word *r, const gf2m_word *a, const gf2m_word *b);
+    void (*mul_clmul)(gf2m_word *r, const gf2m_word *a, const gf2m_word *b);
+    void (*sqr)(gf2m_word *r, const gf2m_word *a);
+    /* Tr(a) is the parity of a & trace */
+    gf2m_word trace[GF2M_MAX_WORDS];
+};
+
+/*
+ * Reduces z of 2 * n words modulo x^m + x^k[0] + ... + x^k[t - 1], k[t - 1] = 0.
+ * Inlined with constant arguments into every field, so shifts and offsets are constants
+ */
+static ALWAYS_INLINE void reduce_words(gf2m_word *z, int n, int m, const int *k, int t)
+{
+    const int top = m / 64, top_bits = m % 64;
+    gf2m_word w;
+    int i, j, s;
+
+    /* Bit m + e is x^e times the lower terms, whole words above the top one first */
+    for (j = 2 * n - 1; j > top; j--)
+    {
+        w = z[j];
+        z[j] = 0;
+        for (i = 0; i < t; i++)
+        {
+            s = m - k[i];
+            z[j - s / 64] ^= w >> (s % 64);
+            if (s % 64)
+                z[j - s / 64 - 1] ^= w << (64 - s % 64);
+        }
+    }
+
+    /* Lower terms are well below m, so this does not make more bits to reduce */
+    w = z[top] >> top_bits;
+    z[top] &= ((gf2m_word) 1 << top_bits) - 1;
+    for (i = 0; i < t; i++)
+    {
+        z[k[i] / 64] ^= w << (k[i] % 64);
+        if (k[i] % 64)
+            z[k[i] / 64 + 1] ^= w >> (64 - k[i] % 64);
+    }
+}
+
+/*
+ * Left-to-right comb with 4-bit windows, "Guide to Elliptic Curve Cryptography", algorithm 2.36.
+ * Window products are b * x^0..3 summed under masks of the window bits, not a table of all 16
+ * indexed by them, so memory access does not depend on a
+ */
+static ALWAYS_INLINE void mul_comb(gf2m_word *z, const gf2m_word *a, const gf2m_word *b, int n)
+{
+    gf2m_word T[4][GF2M_MAX_WORDS + 1], mask[4];
+    int i, j, k, d;
+
+    for (j = 0; j < n; j++)
+        T[0][j] = b[j];
+    T[0][n] = 0;
+    for (k = 1; k < 4; k++)
+    {
+        T[k][0] = T[k - 1][0] << 1;
+        for (j = 1; j <= n; j++)
+            T[k][j] = (T[k - 1][j] << 1) | (T[k - 1][j - 1] >> 63);
+    }
+
+    memset(z, 0, 2 * n * sizeof(gf2m_word));
+    for (d = 60; d >= 0; d -= 4)
+    {
+        for (i = 0; i < n; i++)
+        {
+            for (k = 0; k < 4; k++)
+                mask[k] = 0 - ((a[i] >> (d + k)) & 1);
+            for (j = 0; j <= n && i + j < 2 * n; j++)
+                z[i + j] ^= (T[0][j] & mask[0]) ^ (T[1][j] & mask[1]) ^ (T[2][j] & mask[2]) ^ (T[3][j] & mask[3]);
+        }
+        if (d)
+        {
+            for (j = 2 * n - 1; j > 0; j--)
+                z[j] = (z[j] << 4) | (z[j - 1] >> 60);
+            z[0] <<= 4;
+        }
+    }
+}
+
+#ifdef GF2M_X86_CLMUL
+/* Schoolbook, products of words going to the same place are summed up first */
+static TARGET_CLMUL ALWAYS_INLINE void mul_clmul(gf2m_word *z, const gf2m_word *a, const gf2m_word *b, int n)
+{
+    __m128i A[GF2M_MAX_WORDS], B[GF2M_MAX_WORDS], D[2 * GF2M_MAX_WORDS];
+    int i, j;
+
+    for (i = 0; i < n; i++)
+    {
+        A[i] = _mm_loadl_epi64((const __m128i *) (a + i));
+        B[i] = _mm_loadl_epi64((const __m128i *) (b + i));
+    }
+    for (i = 0; i < 2 * n; i++)
+        D[i] = _mm_setzero_si128();
+    for (i = 0; i < n; i++)
+    {
+        for (j = 0; j < n; j++)
+            D[i + j] = _mm_xor_si128(D[i + j], _mm_clmulepi64_si128(A[i], B[j], 0x00));
+    }
+
+    /* D[i] covers words i and i + 1 */
+    _mm_storel_epi64((__m128i *) z, D[0]);
+    for (i = 1; i < 2 * n; i++)
+        _mm_storel_epi64((__m128i *) (z + i), _mm_xor_si128(D[i], _mm_srli_si128(D[i - 1], 8)));
+}
+
+#define GF2M_MUL_CLMUL(M, N) \
+    static TARGET_CLMUL void mul_clmul_##M(gf2m_word *r, const gf2m_word *a, const gf2m_word *b) \
+    { \
+        gf2m_word z[2 * N]; \
+        mul_clmul(z, a, b, N); \
+        reduce_##M(z); \
+        memcpy(r, z, N * sizeof(gf2m_word)); \
+    }
+#define GF2M_MUL_CLMUL_FN(M) mul_clmul_##M
+#else
+#define GF2M_MUL_CLMUL(M, N)
+#define GF2M_MUL_CLMUL_FN(M) mul_comb_##M
+#endif
+
+/* Inserts a zero bit after every bit of the lower half of x */
+static ALWAYS_INLINE gf2m_word spread32(gf2m_word x)
+{
+    x &= 0xFFFFFFFFULL;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFULL;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x << 2)) & 0x3333333333333333ULL;
+    x = (x | (x << 1)) & 0x5555555555555555ULL;
+    return x;
+}
+
+/* Fields of DSTU named curves: degree, words, lower terms of the polynomial (0 for none) */
+#define GF2M_FIELD(M, N, K1, K2, K3) \
+    static void reduce_##M(gf2m_word *z) \
+    { \
+        static const int k[4] = {K1, K2, K3, 0}; \
+        reduce_words(z, N, M, k, (K2) ? 4 : 2); \
+    } \
+    static void mul_comb_##M(gf2m_word *r, const gf2m_word *a, const gf2m_word *b) \
+    { \
+        gf2m_word z[2 * N]; \
+        mul_comb(z, a, b, N); \
+        reduce_##M(z); \
+        memcpy(r, z, N * sizeof(gf2m_word)); \
+    } \
+    GF2M_MUL_CLMUL(M, N) \
+    static void sqr_##M(gf2m_word *r, const gf2m_word *a) \
+    { \
+        gf2m_word z[2 * N]; \
+        int i; \
+        for (i = 0; i < N; i++) \
+        { \
+            z[2 * i] = spread32(a[i]); \
+            z[2 * i + 1] = spread32(a[i] >> 32); \
+        } \
+        reduce_##M(z); \
+        memcpy(r, z, N * sizeof(gf2m_word)); \
+    }
+
+GF2M_FIELD(163, 3, 7, 6, 3)
+GF2M_FIELD(167, 3, 6, 0, 0)
+GF2M_FIELD(173, 3, 10, 2, 1)
+GF2M_FIELD(179, 3, 4, 2, 1)
+GF2M_FIELD(191, 3, 9, 0, 0)
+GF2M_FIELD(233, 4, 9, 4, 1)
+GF2M_FIELD(257, 5, 12, 0, 0)
+GF2M_FIELD(307, 5, 8, 4, 2)
+GF2M_FIELD(367, 6, 21, 0, 0)
+GF2M_FIELD(431, 7, 5, 3, 1)
+
+#define GF2M_FIELD_ENTRY(M, N, ...) \
+    {M, N, {__VA_ARGS__}, mul_comb_##M, GF2M_MUL_CLMUL_FN(M), sqr_##M, {0}}
+
+/* Same polynomials as dstu_curves */
+static DSTU_GF2M_FIELD fields[] =
+{
+    GF2M_FIELD_ENTRY(163, 3, 163, 7, 6, 3, 0, -1),
+    GF2M_FIELD_ENTRY(167, 3, 167, 6, 0, -1),
+    GF2M_FIELD_ENTRY(173, 3, 173, 10, 2, 1, 0, -1),
+    GF2M_FIELD_ENTRY(179, 3, 179, 4, 2, 1, 0, -1),
+    GF2M_FIELD_ENTRY(191, 3, 191, 9, 0, -1),
+    GF2M_FIELD_ENTRY(233, 4, 233, 9, 4, 1, 0, -1),
+    GF2M_FIELD_ENTRY(257, 5, 257, 12, 0, -1),
+    GF2M_FIELD_ENTRY(307, 5, 307, 8, 4, 2, 0, -1),
+    GF2M_FIELD_ENTRY(367, 6, 367, 21, 0, -1),
+    GF2M_FIELD_ENTRY(431, 7, 431, 5, 3, 1, 0, -1)
+};
+
+#define FIELD_COUNT ((int) (sizeof(fields) / sizeof(fields[0])))
+
+static int use_clmul = 0;
+static int have_clmul = 0;
+static CRYPTO_ONCE fields_init = CRYPTO_ONCE_STATIC_INIT;
+
+/*
+ * Tr(x^i) are power sums of the polynomial roots, which Newton's identities give from its
+ * coefficients: s_i = i * c_i + sum c_j * s_(i - j), c_j being the coefficient of x^(m - j)
+ */
+static void trace_init(DSTU_GF2M_FIELD *f)
+{
+    unsigned char s[GF2M_MAX_WORDS * 64];
+    int J[4], count = 0, i, t;
+
+    for (i = 1; f->poly[i] > 0; i++)
+        J[count++] = f->m - f->poly[i];
+
+    memset(f->trace, 0, sizeof(f->trace));
+    s[0] = f->m & 1;
+    for (i = 0; i < f->m; i++)
+    {
+        if (i)
+        {
+            s[i] = 0;
+            for (t = 0; t < count; t++)
+            {
+                if (J[t] == i)
+                    s[i] ^= i & 1;
+                else if (J[t] < i)
+                    s[i] ^= s[i - J[t]];
+            }
+        }
+        f->trace[i / 64] |= (gf2m_word) s[i] << (i % 64);
+    }
+}
+
+static void do_fields_init(void)
+{
+    int i;
+
+#ifdef GF2M_X86_CLMUL
+    __builtin_cpu_init();
+    have_clmul = __builtin_cpu_supports("pclmul");
+#endif
+    use_clmul = have_clmul;
+
+    for (i = 0; i < FIELD_COUNT; i++)
+        trace_init(&fields[i]);
+}
+
+int gf2m_use_clmul(int enable)
+{
+    if (!CRYPTO_THREAD_run_once(&fields_init, do_fields_init))
+        return 0;
+    if (enable && !have_clmul)
+        return 0;
+    use_clmul = enable;
+    return 1;
+}
+
+const DSTU_GF2M_FIELD *gf2m_field(const BIGNUM *p)
+{
+    int poly[6], count, i, j;
+
+    if (!CRYPTO_THREAD_run_once(&fields_init, do_fields_init))
+        return NULL;
+
+    /* DSTU polynomials have five terms at most, terminated by -1 */
+    for (j = 0; j < 6; j++)
+        poly[j] = -1;
+    count = BN_GF2m_poly2arr(p, poly, 6);
+    if (!count || count > 6)
+        return NULL;
+
+    /* Same terms up to the terminator, so that neither may be a prefix of the other */
+    for (i = 0; i < FIELD_COUNT; i++)
+    {
+        for (j = 0; fields[i].poly[j] == poly[j]; j++)
+        {
+            if (-1 == poly[j])
+                return &fields[i];
+        }
+    }
+
+    return NULL;
+}
+
+int gf2m_degree(const DSTU_GF2M_FIELD *f)
+{
+    return f->m;
+}
+
+int gf2m_from_bn(const DSTU_GF2M_FIELD *f, gf2m_elem r, const BIGNUM *a)
+{
+    unsigned char buf[GF2M_MAX_WORDS * 8];
+    int i, j;
+
+    if (BN_is_negative(a) || BN_num_bits(a) > f->m)
+        return 0;
+    if (BN_bn2lebinpad(a, buf, sizeof(buf)) < 0)
+        return 0;
+
+    for (i = 0; i < GF2M_MAX_WORDS; i++)
+    {
+        r[i] = 0;
+        for (j = 7; j >= 0; j--)
+            r[i] = (r[i] << 8) | buf[8 * i + j];
+    }
+
+    OPENSSL_cleanse(buf, sizeof(buf));
+    return 1;
+}
+
+int gf2m_to_bn(const DSTU_GF2M_FIELD *f, BIGNUM *r, const gf2m_elem a)
+{
+    unsigned char buf[GF2M_MAX_WORDS * 8];
+    int i, j, ret;
+
+    for (i = 0; i < GF2M_MAX_WORDS; i++)
+    {
+        for (j = 0; j < 8; j++)
+            buf[8 * i + j] = (unsigned char) (a[i] >> (8 * j));
+    }
+
+    ret = BN_lebin2bn(buf, f->words * 8, r) != NULL;
+    OPENSSL_cleanse(buf, sizeof(buf));
+    return ret;
+}
+
+void gf2m_zero(gf2m_elem r)
+{
+    memset(r, 0, sizeof(gf2m_elem));
+}
+
+void gf2m_one(gf2m_elem r)
+{
+    memset(r, 0, sizeof(gf2m_elem));
+    r[0] = 1;
+}
+
+void gf2m_copy(gf2m_elem r, const gf2m_elem a)
+{
+    memmove(r, a, sizeof(gf2m_elem));
+}
+
+int gf2m_is_zero(const DSTU_GF2M_FIELD *f, const gf2m_elem a)
+{
+    gf2m_word acc = 0;
+    int i;
+
+    for (i = 0; i < f->words; i++)
+        acc |= a[i];
+    return acc == 0;
+}
+
+int gf2m_is_one(const DSTU_GF2M_FIELD *f, const gf2m_elem a)
+{
+    gf2m_word acc = a[0] ^ 1;
+    int i;
+
+    for (i = 1; i < f->words; i++)
+        acc |= a[i];
+    return acc == 0;
+}
+
+void gf2m_cswap(const DSTU_GF2M_FIELD *f, gf2m_word swap, gf2m_elem a, gf2m_elem b)
+{
+    gf2m_word mask = 0 - swap, t;
+    int i;
+
+    for (i = 0; i < f->words; i++)
+    {
+        t = (a[i] ^ b[i]) & mask;
+        a[i] ^= t;
+        b[i] ^= t;
+    }
+}
+
+void gf2m_add(const DSTU_GF2M_FIELD *f, gf2m_elem r, const gf2m_elem a, const gf2m_elem b)
+{
+    int i;
+
+    for (i = 0; i < f->words; i++)
+        r[i] = a[i] ^ b[i];
+}
+
+void gf2m_mul(const DSTU_GF2M_FIELD *f, gf2m_elem r, const gf2m_elem a, const gf2m_elem b)
+{
+    if (use_clmul)
+        f->mul_clmul(r, a, b);
+    else
+        f->mul_comb(r, a, b);
+}
+
+void gf2m_sqr(const DSTU_GF2M_FIELD *f, gf2m_elem r, const gf2m_elem a)
+{
+    f->sqr(r, a);
+}
+
+/* r = a^(2^n) */
+static void sqr_n(const DSTU_GF2M_FIELD *f, gf2m_elem r, const gf2m_elem a, int n)
+{
+    int i;
+
+    gf2m_copy(r, a);
+    for (i = 0; i < n; i++)
+        f->sqr(r, r);
+}
+
+/*
+ * Itoh-Tsujii: a^-1 = (a^(2^(m - 1) - 1))^2. b = a^(2^k - 1) goes to a^(2^2k - 1) as b^(2^k) * b
+ * and to a^(2^(k + 1) - 1) as b^2 * a, along the bits of m - 1
+ */
+void gf2m_inv(const DSTU_GF2M_FIELD *f, gf2m_elem r, const gf2m_elem a)
+{
+    gf2m_elem b, t;
+    int e = f->m - 1, bit, k = 1;
+
+    for (bit = 0; (e >> (bit + 1)) != 0; bit++)
+        ;
+
+    gf2m_copy(b, a);
+    for (bit--; bit >= 0; bit--)
+    {
+        sqr_n(f, t, b, k);
+        gf2m_mul(f, b, t, b);
+        k *= 2;
+        if ((e >> bit) & 1)
+        {
+            f->sqr(b, b);
+            gf2m_mul(f, b, b, a);
+            k++;
+        }
+    }
+    f->sqr(r, b);
+
+    OPENSSL_cleanse(b, sizeof(b));
+    OPENSSL_cleanse(t, sizeof(t));
+}
+
+/* sqrt(a) = a^(2^(m - 1)) */
+void gf2m_sqrt(const DSTU_GF2M_FIELD *f, gf2m_elem r, const gf2m_elem a)
+{
+    sqr_n(f, r, a, f->m - 1);
+}
+
+int gf2m_trace(const DSTU_GF2M_FIELD *f, const gf2m_elem a)
+{
+    gf2m_word acc = 0;
+    int i;
+
+    for (i = 0; i < f->words; i++)
+        acc ^= a[i] & f->trace[i];
+    acc ^= acc >> 32;
+    acc ^= acc >> 16;
+    acc ^= acc >> 8;
+    acc ^= acc >> 4;
+    acc ^= acc >> 2;
+    acc ^= acc >> 1;
+    return (int) (acc & 1);
+}
+
+/* All DSTU fields have odd degree, so half-trace sum a^(4^i), i = 0 .. (m - 1) / 2, is a root */
+int gf2m_solve_quad(const DSTU_GF2M_FIELD *f, gf2m_elem r, const gf2m_elem a)
+{
+    gf2m_elem z, t;
+    int i;
+
+    gf2m_copy(z, a);
+    gf2m_copy(t, a);
+    for (i = 0; i < (f->m - 1) / 2; i++)
+    {
+        f->sqr(t, t);
+        f->sqr(t, t);
+        gf2m_add(f, z, z, t);
+    }
+    gf2m_copy(r, z);
+
+    return !gf2m_trace(f, a);
+}
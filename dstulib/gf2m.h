@@ -0,0 +1,57 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+#ifndef DSTU_GF2M_H_
+#define DSTU_GF2M_H_
+
+#include <openssl/bn.h>
+
+#include <stdint.h>
+
+/* Native arithmetic in the binary fields of DSTU named curves (m = 163 .. 431).
+ * Elements are little-endian arrays of 64-bit words, GF2M_MAX_WORDS long whatever the field,
+ * words above the field size are zero. Every field has its own reduction, made at compile time
+ * from its polynomial. Multiplication uses PCLMULQDQ when the CPU has it, or else a comb with
+ * 4-bit windows selected by masks. Nothing here branches on or indexes memory with element values.
+ */
+
+#define GF2M_MAX_WORDS 7
+
+typedef uint64_t gf2m_word;
+typedef gf2m_word gf2m_elem[GF2M_MAX_WORDS];
+
+typedef struct dstu_gf2m_field_st DSTU_GF2M_FIELD;
+
+/* Field with reduction polynomial p, NULL if it is not one of the DSTU fields */
+const DSTU_GF2M_FIELD *gf2m_field(const BIGNUM *p);
+/* Degree of the field */
+int gf2m_degree(const DSTU_GF2M_FIELD *f);
+
+/* Conversions, a must be reduced (less than 2^m) */
+int gf2m_from_bn(const DSTU_GF2M_FIELD *f, gf2m_elem r, const BIGNUM *a);
+int gf2m_to_bn(const DSTU_GF2M_FIELD *f, BIGNUM *r, const gf2m_elem a);
+
+void gf2m_zero(gf2m_elem r);
+void gf2m_one(gf2m_elem r);
+void gf2m_copy(gf2m_elem r, const gf2m_elem a);
+int gf2m_is_zero(const DSTU_GF2M_FIELD *f, const gf2m_elem a);
+int gf2m_is_one(const DSTU_GF2M_FIELD *f, const gf2m_elem a);
+/* Swaps a and b if swap is 1, leaves them if it is 0 */
+void gf2m_cswap(const DSTU_GF2M_FIELD *f, gf2m_word swap, gf2m_elem a, gf2m_elem b);
+
+/* r may be the same as any argument everywhere */
+void gf2m_add(const DSTU_GF2M_FIELD *f, gf2m_elem r, const gf2m_elem a, const gf2m_elem b);
+void gf2m_mul(const DSTU_GF2M_FIELD *f, gf2m_elem r, const gf2m_elem a, const gf2m_elem b);
+void gf2m_sqr(const DSTU_GF2M_FIELD *f, gf2m_elem r, const gf2m_elem a);
+/* r = a^-1, 0 for a = 0 */
+void gf2m_inv(const DSTU_GF2M_FIELD *f, gf2m_elem r, const gf2m_elem a);
+void gf2m_sqrt(const DSTU_GF2M_FIELD *f, gf2m_elem r, const gf2m_elem a);
+int gf2m_trace(const DSTU_GF2M_FIELD *f, const gf2m_elem a);
+/* One of the roots of z^2 + z = a, returns 0 if there are none */
+int gf2m_solve_quad(const DSTU_GF2M_FIELD *f, gf2m_elem r, const gf2m_elem a);
+
+/* Turns PCLMULQDQ multiplication on or off, returns 0 if the CPU does not have it */
+int gf2m_use_clmul(int enable);
+
+#endif /* DSTU_GF2M_H_ */
@@ -10,7 +10,14 @@
 #include <string.h>
 #include <openssl/crypto.h>
 #include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+# include <openssl/evp.h>
+#else
+# include <openssl/rand_drbg.h>
+#endif
 #include "gost89.h"
+#include "gost89_simd.h"
+#include "parallel.h"
 /*-
    Substitution blocks from RFC 4357
 
@@ -251,31 +258,64 @@ const byte ACPKM_D_const[] = {
     0x98, 0x99, 0x9A, 0x9B, 0x9C, 0x9D, 0x9E, 0x9F,
 };
 
-/* Initialization of gost_ctx subst blocks*/
-void kboxinit(gost_ctx * c, const gost_subst_block * b)
+/* Initialization of preprocessed subst blocks*/
+void kboxinit(gost_kbox * k, const gost_subst_block * b)
 {
-    int i;
+    const byte *sbox[8] = {
+        b->k1, b->k2, b->k3, b->k4, b->k5, b->k6, b->k7, b->k8
+    };
+    byte truth[16];
+    int i, q, o, v;
 
     for (i = 0; i < 256; i++) {
-        c->k87[i] = (word32) (b->k8[i >> 4] << 4 | b->k7[i & 15]) << 24;
-        c->k65[i] = (b->k6[i >> 4] << 4 | b->k5[i & 15]) << 16;
-        c->k43[i] = (b->k4[i >> 4] << 4 | b->k3[i & 15]) << 8;
-        c->k21[i] = b->k2[i >> 4] << 4 | b->k1[i & 15];
-
+        k->k87[i] = (word32) (b->k8[i >> 4] << 4 | b->k7[i & 15]) << 24;
+        k->k65[i] = (b->k6[i >> 4] << 4 | b->k5[i & 15]) << 16;
+        k->k43[i] = (b->k4[i >> 4] << 4 | b->k3[i & 15]) << 8;
+        k->k21[i] = b->k2[i >> 4] << 4 | b->k1[i & 15];
+        k->r87[i] = k->k87[i] << 11 | k->k87[i] >> (32 - 11);
+        k->r65[i] = k->k65[i] << 11 | k->k65[i] >> (32 - 11);
+        k->r43[i] = k->k43[i] << 11 | k->k43[i] >> (32 - 11);
+        k->r21[i] = k->k21[i] << 11 | k->k21[i] >> (32 - 11);
+    }
+    for (i = 0; i < 16; i++) {
+        k->lo[i] = b->k1[i];
+        k->lo[16 + i] = b->k3[i];
+        k->lo[32 + i] = b->k5[i];
+        k->lo[48 + i] = b->k7[i];
+        k->hi[i] = b->k2[i] << 4;
+        k->hi[16 + i] = b->k4[i] << 4;
+        k->hi[32 + i] = b->k6[i] << 4;
+        k->hi[48 + i] = b->k8[i] << 4;
+    }
+    /* Moebius transform of every output bit's truth table */
+    for (q = 0; q < 8; q++) {
+        for (o = 0; o < 4; o++) {
+            for (v = 0; v < 16; v++)
+                truth[v] = (sbox[q][v] >> o) & 1;
+            for (i = 1; i < 16; i <<= 1)
+                for (v = 0; v < 16; v++)
+                    if (v & i)
+                        truth[v] ^= truth[v ^ i];
+            k->anf[4 * q + o] = 0;
+            for (v = 0; v < 16; v++)
+                k->anf[4 * q + o] |= truth[v] << v;
+        }
     }
 }
 
 /* Part of GOST 28147 algorithm moved into separate function */
-static word32 f(gost_ctx * c, word32 x)
+static word32 fk(const gost_kbox * k, word32 x)
 {
-    x = c->k87[x >> 24 & 255] | c->k65[x >> 16 & 255] |
-        c->k43[x >> 8 & 255] | c->k21[x & 255];
+    x = k->k87[x >> 24 & 255] | k->k65[x >> 16 & 255] |
+        k->k43[x >> 8 & 255] | k->k21[x & 255];
     /* Rotate left 11 bits */
     return x << 11 | x >> (32 - 11);
 }
 
+#define f(c, x) fk((c)->kbox, (x))
+
 /* Low-level encryption routine - encrypts one 64 bit block*/
-void gostcrypt(gost_ctx * c, const byte * in, byte * out)
+static void gostcrypt_scalar(gost_ctx * c, const byte * in, byte * out)
 {
     register word32 n1, n2;     /* As named in the GOST */
     n1 = in[0] | (in[1] << 8) | (in[2] << 16) | ((word32) in[3] << 24);
@@ -329,7 +369,7 @@ void gostcrypt(gost_ctx * c, const byte * in, byte * out)
 }
 
 /* Low-level decryption routine. Decrypts one 64-bit block */
-void gostdecrypt(gost_ctx * c, const byte * in, byte * out)
+static void gostdecrypt_scalar(gost_ctx * c, const byte * in, byte * out)
 {
     register word32 n1, n2;     /* As named in the GOST */
     n1 = in[0] | (in[1] << 8) | (in[2] << 16) | ((word32) in[3] << 24);
@@ -382,26 +422,348 @@ void gostdecrypt(gost_ctx * c, const byte * in, byte * out)
 }
 
 
-/* Encrypts several blocks in ECB mode */
-void gost_enc(gost_ctx * c, const byte * clear, byte * cipher, int blocks)
+const int gost_enc_order[32] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7,
+    0, 1, 2, 3, 4, 5, 6, 7, 7, 6, 5, 4, 3, 2, 1, 0
+};
+
+const int gost_dec_order[32] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 7, 6, 5, 4, 3, 2, 1, 0,
+    7, 6, 5, 4, 3, 2, 1, 0, 7, 6, 5, 4, 3, 2, 1, 0
+};
+
+#define LOAD_HALF(p) \
+    ((p)[0] | ((p)[1] << 8) | ((p)[2] << 16) | ((word32) (p)[3] << 24))
+
+#define STORE_HALF(p, n) \
+    do { \
+        (p)[0] = (byte) ((n) & 0xff); \
+        (p)[1] = (byte) (((n) >> 8) & 0xff); \
+        (p)[2] = (byte) (((n) >> 16) & 0xff); \
+        (p)[3] = (byte) ((n) >> 24); \
+    } while (0)
+
+/*
+ * Scalar code for 4 independent blocks at a time. Rounds of different
+ * blocks are interleaved, so their table lookups overlap instead of
+ * waiting for each other.
+ */
+static int gost_blocks_x4(gost_ctx * c, const byte * in, byte * out,
+                          int blocks, int decrypt)
+{
+    const int *order = decrypt ? gost_dec_order : gost_enc_order;
+    register word32 a1, a2, b1, b2, c1, c2, d1, d2, k;
+    int i, done;
+    for (done = 0; done + 4 <= blocks; done += 4, in += 32, out += 32) {
+        a1 = LOAD_HALF(in);
+        a2 = LOAD_HALF(in + 4);
+        b1 = LOAD_HALF(in + 8);
+        b2 = LOAD_HALF(in + 12);
+        c1 = LOAD_HALF(in + 16);
+        c2 = LOAD_HALF(in + 20);
+        d1 = LOAD_HALF(in + 24);
+        d2 = LOAD_HALF(in + 28);
+        /* Instead of swapping halves, swap names each round */
+        for (i = 0; i < 32; i += 2) {
+            k = c->key[order[i]] + c->mask[order[i]];
+            a2 ^= f(c, a1 + k);
+            b2 ^= f(c, b1 + k);
+            c2 ^= f(c, c1 + k);
+            d2 ^= f(c, d1 + k);
+            k = c->key[order[i + 1]] + c->mask[order[i + 1]];
+            a1 ^= f(c, a2 + k);
+            b1 ^= f(c, b2 + k);
+            c1 ^= f(c, c2 + k);
+            d1 ^= f(c, d2 + k);
+        }
+        STORE_HALF(out, a2);
+        STORE_HALF(out + 4, a1);
+        STORE_HALF(out + 8, b2);
+        STORE_HALF(out + 12, b1);
+        STORE_HALF(out + 16, c2);
+        STORE_HALF(out + 20, c1);
+        STORE_HALF(out + 24, d2);
+        STORE_HALF(out + 28, d1);
+    }
+    return done;
+}
+
+/* Same as fk, but with rotated tables */
+static word32 fr(const gost_kbox * k, word32 x)
+{
+    return k->r87[x >> 24 & 255] | k->r65[x >> 16 & 255] |
+        k->r43[x >> 8 & 255] | k->r21[x & 255];
+}
+
+/*
+ * Same as gost_blocks_x4, but every block has its own key: the lane
+ * kernel for scalar code, see gost89_simd.h for the layout.
+ */
+static void gost_lanes_x4(const gost_kbox * k, const u4 * key,
+                          const u4 * mask, const byte * in, byte * out)
 {
+    register word32 a1, a2, b1, b2, c1, c2, d1, d2;
+    const u4 *ki, *mi;
     int i;
-    for (i = 0; i < blocks; i++) {
-        gostcrypt(c, clear, cipher);
-        clear += 8;
-        cipher += 8;
+    a1 = LOAD_HALF(in);
+    a2 = LOAD_HALF(in + 4);
+    b1 = LOAD_HALF(in + 8);
+    b2 = LOAD_HALF(in + 12);
+    c1 = LOAD_HALF(in + 16);
+    c2 = LOAD_HALF(in + 20);
+    d1 = LOAD_HALF(in + 24);
+    d2 = LOAD_HALF(in + 28);
+    for (i = 0; i < 32; i += 2) {
+        ki = key + 4 * gost_enc_order[i];
+        mi = mask + 4 * gost_enc_order[i];
+        a2 ^= fr(k, a1 + ki[0] + mi[0]);
+        b2 ^= fr(k, b1 + ki[1] + mi[1]);
+        c2 ^= fr(k, c1 + ki[2] + mi[2]);
+        d2 ^= fr(k, d1 + ki[3] + mi[3]);
+        ki = key + 4 * gost_enc_order[i + 1];
+        mi = mask + 4 * gost_enc_order[i + 1];
+        a1 ^= fr(k, a2 + ki[0] + mi[0]);
+        b1 ^= fr(k, b2 + ki[1] + mi[1]);
+        c1 ^= fr(k, c2 + ki[2] + mi[2]);
+        d1 ^= fr(k, d2 + ki[3] + mi[3]);
     }
+    STORE_HALF(out, a2);
+    STORE_HALF(out + 4, a1);
+    STORE_HALF(out + 8, b2);
+    STORE_HALF(out + 12, b1);
+    STORE_HALF(out + 16, c2);
+    STORE_HALF(out + 20, c1);
+    STORE_HALF(out + 24, d2);
+    STORE_HALF(out + 28, d1);
 }
 
-/* Decrypts several blocks in ECB mode */
-void gost_dec(gost_ctx * c, const byte * cipher, byte * clear, int blocks)
+/* Single block with rotated tables, rounds taking keys in given order */
+static inline void crypt_table(gost_ctx * c, const int *order,
+                               int rounds, const byte * in, byte * out)
+{
+    const gost_kbox *k = c->kbox;
+    register word32 n1, n2;
+    int i;
+    n1 = LOAD_HALF(in);
+    n2 = LOAD_HALF(in + 4);
+    for (i = 0; i < rounds; i += 2) {
+        n2 ^= fr(k, n1 + c->key[order[i]] + c->mask[order[i]]);
+        n1 ^= fr(k, n2 + c->key[order[i + 1]] + c->mask[order[i + 1]]);
+    }
+    if (rounds == 32) {
+        STORE_HALF(out, n2);
+        STORE_HALF(out + 4, n1);
+    } else {
+        /* MAC has no final swap */
+        STORE_HALF(out, n1);
+        STORE_HALF(out + 4, n2);
+    }
+}
+
+static void gostcrypt_table(gost_ctx * c, const byte * in, byte * out)
+{
+    crypt_table(c, gost_enc_order, 32, in, out);
+}
+
+static void gostdecrypt_table(gost_ctx * c, const byte * in, byte * out)
+{
+    crypt_table(c, gost_dec_order, 32, in, out);
+}
+
+static void mac_block_table(gost_ctx * c, byte * buffer, const byte * block)
 {
     int i;
-    for (i = 0; i < blocks; i++) {
-        gostdecrypt(c, cipher, clear);
-        clear += 8;
-        cipher += 8;
+    for (i = 0; i < 8; i++)
+        buffer[i] ^= block[i];
+    crypt_table(c, gost_enc_order, 16, buffer, buffer);
+}
+
+typedef int (*gost_blocks_fn) (gost_ctx *, const byte *, byte *, int, int);
+typedef void (*gost_block_fn) (gost_ctx *, const byte *, byte *);
+typedef void (*gost_mac_fn) (gost_ctx *, byte *, const byte *);
+
+static void mac_block_scalar(gost_ctx * c, byte * buffer,
+                             const byte * block);
+
+/* Kernels of an implementation */
+typedef struct {
+    int impl;
+    /* Multi-block kernel for independent blocks, NULL for scalar code */
+    gost_blocks_fn blocks;
+    gost_block_fn crypt;
+    gost_block_fn decrypt;
+    gost_mac_fn mac;
+} gost_kernels;
+
+/* Kernels of every implementation, indexed by GOST_IMPL_*, AUTO has none */
+static const gost_kernels all_kernels[] = {
+    {GOST_IMPL_AUTO, NULL, NULL, NULL, NULL},
+    {GOST_IMPL_SCALAR, NULL, gostcrypt_scalar, gostdecrypt_scalar,
+     mac_block_scalar},
+    {GOST_IMPL_AVX2, gost_blocks_avx2, gostcrypt_table, gostdecrypt_table,
+     mac_block_table},
+    {GOST_IMPL_AVX512, gost_blocks_avx512, gostcrypt_table,
+     gostdecrypt_table, mac_block_table},
+    {GOST_IMPL_BITSLICE, gost_blocks_bitslice, gostcrypt_table,
+     gostdecrypt_table, mac_block_table},
+    {GOST_IMPL_SSSE3, gost_blocks_ssse3, gostcrypt_table, gostdecrypt_table,
+     mac_block_table},
+    {GOST_IMPL_TABLE, NULL, gostcrypt_table, gostdecrypt_table,
+     mac_block_table}
+};
+
+/*
+ * Kernels in use. Scalar ones until the first gost_init or gost_set_impl,
+ * which are the only writers. Readers in other threads load the pointer
+ * once per call, so they use either the old kernels or the new ones whole.
+ */
+#if defined(__GNUC__) && defined(__ATOMIC_ACQUIRE)
+static const gost_kernels *kernels = &all_kernels[GOST_IMPL_SCALAR];
+# define KERNELS_LOAD() __atomic_load_n(&kernels, __ATOMIC_ACQUIRE)
+# define KERNELS_STORE(k) __atomic_store_n(&kernels, (k), __ATOMIC_RELEASE)
+#else
+/*
+ * Aligned pointers are read and written at once, volatile accesses are
+ * acquire and release with MSVC
+ */
+static const gost_kernels *volatile kernels = &all_kernels[GOST_IMPL_SCALAR];
+# define KERNELS_LOAD() (kernels)
+# define KERNELS_STORE(k) (kernels = (k))
+#endif
+static CRYPTO_ONCE kernels_once = CRYPTO_ONCE_STATIC_INIT;
+
+/* Kernels of impl, NULL if CPU does not support it */
+static const gost_kernels *impl_kernels(int impl)
+{
+    int supported = 1;
+    if (impl == GOST_IMPL_AUTO) {
+        if (gost_cpu_avx512())
+            impl = GOST_IMPL_AVX512;
+        else if (gost_cpu_avx2())
+            impl = GOST_IMPL_AVX2;
+        else if (gost_cpu_ssse3())
+            impl = GOST_IMPL_SSSE3;
+        else
+            impl = GOST_IMPL_TABLE;
     }
+    switch (impl) {
+    case GOST_IMPL_SCALAR:
+    case GOST_IMPL_TABLE:
+    case GOST_IMPL_BITSLICE:
+        break;
+    case GOST_IMPL_SSSE3:
+        supported = gost_cpu_ssse3();
+        break;
+    case GOST_IMPL_AVX2:
+        supported = gost_cpu_avx2();
+        break;
+    case GOST_IMPL_AVX512:
+        supported = gost_cpu_avx512();
+        break;
+    default:
+        return NULL;
+    }
+    return supported ? &all_kernels[impl] : NULL;
+}
+
+static void kernels_init(void)
+{
+    const gost_kernels *k = impl_kernels(GOST_IMPL_AUTO);
+    if (k)
+        KERNELS_STORE(k);
+}
+
+int gost_set_impl(int impl)
+{
+    const gost_kernels *k;
+    if (!CRYPTO_THREAD_run_once(&kernels_once, kernels_init))
+        return 0;
+    k = impl_kernels(impl);
+    if (!k)
+        return 0;
+    KERNELS_STORE(k);
+    return 1;
+}
+
+int gost_get_impl(void)
+{
+    if (!CRYPTO_THREAD_run_once(&kernels_once, kernels_init))
+        return GOST_IMPL_SCALAR;
+    return KERNELS_LOAD()->impl;
+}
+
+static const char *const impl_names[] = {
+    "auto", "scalar", "avx2", "avx512", "bitslice", "ssse3", "table"
+};
+
+int gost_impl_by_name(const char *name)
+{
+    int i;
+    for (i = 0; i < (int)(sizeof(impl_names) / sizeof(impl_names[0])); i++)
+        if (name && !strcmp(name, impl_names[i]))
+            return i;
+    return -1;
+}
+
+const char *gost_impl_name(int impl)
+{
+    if (impl < 0 || impl >= (int)(sizeof(impl_names) / sizeof(impl_names[0])))
+        return NULL;
+    return impl_names[impl];
+}
+
+/* Encrypt one block with the selected kernel */
+void gostcrypt(gost_ctx * c, const byte * in, byte * out)
+{
+    KERNELS_LOAD()->crypt(c, in, out);
+}
+
+/* Decrypt one block with the selected kernel */
+void gostdecrypt(gost_ctx * c, const byte * in, byte * out)
+{
+    KERNELS_LOAD()->decrypt(c, in, out);
+}
+
+/* One step of MAC with the selected kernel */
+void mac_block(gost_ctx * c, byte * buffer, const byte * block)
+{
+    KERNELS_LOAD()->mac(c, buffer, block);
+}
+
+/*
+ * Encrypts or decrypts independent blocks in ECB mode, several at a time
+ * if possible. in and out may be the same buffer.
+ */
+static void gost_blocks(gost_ctx * c, const byte * in, byte * out,
+                        int blocks, int decrypt)
+{
+    gost_blocks_fn kernel = NULL;
+    int done = 0;
+    if (CRYPTO_THREAD_run_once(&kernels_once, kernels_init))
+        kernel = KERNELS_LOAD()->blocks;
+    if (kernel)
+        done = kernel(c, in, out, blocks, decrypt);
+    done += gost_blocks_x4(c, in + 8 * done, out + 8 * done, blocks - done,
+                           decrypt);
+    for (in += 8 * done, out += 8 * done; done < blocks;
+         done++, in += 8, out += 8) {
+        if (decrypt)
+            gostdecrypt(c, in, out);
+        else
+            gostcrypt(c, in, out);
+    }
+}
+
+/* Encrypts several blocks in ECB mode */
+void gost_enc(gost_ctx * c, const byte * clear, byte * cipher, int blocks)
+{
+    gost_blocks(c, clear, cipher, blocks, 0);
+}
+
+/* Decrypts several blocks in ECB mode */
+void gost_dec(gost_ctx * c, const byte * cipher, byte * clear, int blocks)
+{
+    gost_blocks(c, cipher, clear, blocks, 1);
 }
 
 /* Encrypts several full blocks in CFB mode using 8byte IV */
@@ -422,22 +784,350 @@ void gost_enc_cfb(gost_ctx * ctx, const byte * iv, const byte * clear,
     }
 }
 
-/* Decrypts several full blocks in CFB mode using 8byte IV */
-void gost_dec_cfb(gost_ctx * ctx, const byte * iv, const byte * cipher,
-                  byte * clear, int blocks)
+typedef void (*gost_lanes_fn) (const gost_kbox *, const u4 *, const u4 *,
+                               const byte *, byte *);
+
+/* Widest lane kernel */
+#define MAX_LANES 16
+
+/* Lane kernel matching the selected implementation, returns its width */
+static int lanes_kernel(gost_lanes_fn * kernel)
+{
+    switch (gost_get_impl()) {
+    case GOST_IMPL_AVX512:
+        *kernel = gost_lanes_avx512;
+        return 16;
+    case GOST_IMPL_AVX2:
+        *kernel = gost_lanes_avx2;
+        return 8;
+    case GOST_IMPL_SSSE3:
+        *kernel = gost_lanes_ssse3;
+        return 4;
+    default:
+        *kernel = gost_lanes_x4;
+        return 4;
+    }
+}
+
+/* Unmasked keys of hash steps */
+static const u4 no_mask[8 * MAX_LANES];
+
+static void lanes4(const gost_kbox * k, const u4 * key, const byte * in,
+                   byte * out)
+{
+    switch (gost_get_impl()) {
+    case GOST_IMPL_AVX512:
+    case GOST_IMPL_AVX2:
+    case GOST_IMPL_SSSE3:
+        /* Every CPU passing the AVX checks has SSSE3 */
+        gost_lanes_ssse3(k, key, no_mask, in, out);
+        break;
+    default:
+        gost_lanes_x4(k, key, no_mask, in, out);
+    }
+}
+
+void gost_enc_with_keys4(const gost_kbox * k, const u4 * key,
+                         const byte * in, byte * out)
+{
+    lanes4(k, key, in, out);
+}
+
+void gost_enc_with_keys(const gost_kbox * k, int width, const u4 * key,
+                        const byte * in, byte * out)
+{
+    gost_lanes_fn kernel;
+    u4 group[8 * MAX_LANES];
+    int i, j, kernel_width = lanes_kernel(&kernel);
+    if (kernel_width == width) {
+        kernel(k, key, no_mask, in, out);
+        return;
+    }
+    /* Narrower kernel: split into groups it does at once, or of 4 lanes */
+    if (kernel_width > width || width % kernel_width)
+        kernel_width = 4;
+    for (j = 0; j < width; j += kernel_width) {
+        for (i = 0; i < 8; i++)
+            memcpy(group + kernel_width * i, key + width * i + j,
+                   kernel_width * sizeof(u4));
+        if (kernel_width == 4)
+            lanes4(k, group, in + 8 * j, out + 8 * j);
+        else
+            kernel(k, group, no_mask, in + 8 * j, out + 8 * j);
+    }
+}
+
+int gost_keys_width(void)
+{
+    gost_lanes_fn kernel;
+    return lanes_kernel(&kernel);
+}
+
+/*
+ * Encrypts streams lane[0..n-1] in lockstep, all of them sharing one
+ * kbox. Unused lanes repeat the first stream, their output is dropped.
+ */
+static void gost_enc_cfb_lanes(gost_lanes_fn kernel, int width,
+                               gost_ctx * const *ctx,
+                               const byte * const *iv,
+                               const byte * const *clear,
+                               byte * const *cipher, const int *blocks,
+                               const int *lane, int n)
+{
+    u4 key[8 * MAX_LANES], mask[8 * MAX_LANES];
+    byte cur_iv[8 * MAX_LANES], gamma[8 * MAX_LANES];
+    int i, j, b, s, longest = 0;
+    for (j = 0; j < width; j++) {
+        s = lane[j < n ? j : 0];
+        for (i = 0; i < 8; i++) {
+            key[width * i + j] = ctx[s]->key[i];
+            mask[width * i + j] = ctx[s]->mask[i];
+        }
+        memcpy(cur_iv + 8 * j, iv[s], 8);
+        if (blocks[s] > longest)
+            longest = blocks[s];
+    }
+    for (b = 0; b < longest; b++) {
+        kernel(ctx[lane[0]]->kbox, key, mask, cur_iv, gamma);
+        for (j = 0; j < n; j++) {
+            s = lane[j];
+            if (b >= blocks[s])
+                continue;
+            for (i = 0; i < 8; i++)
+                cur_iv[8 * j + i] = cipher[s][8 * b + i] =
+                    clear[s][8 * b + i] ^ gamma[8 * j + i];
+        }
+    }
+    OPENSSL_cleanse(key, sizeof(key));
+    OPENSSL_cleanse(mask, sizeof(mask));
+    OPENSSL_cleanse(gamma, sizeof(gamma));
+}
+
+/*
+ * Encrypts n independent streams in CFB mode: stream i is blocks[i] full
+ * blocks from clear[i] to cipher[i] with key ctx[i] and IV iv[i], exactly
+ * as gost_enc_cfb would. CFB encryption of one stream cannot be split, so
+ * streams with the same s-boxes are encrypted side by side instead, one
+ * stream per kernel lane.
+ */
+void gost_enc_cfb_multi(gost_ctx * const *ctx, const byte * const *iv,
+                        const byte * const *clear, byte * const *cipher,
+                        const int *blocks, int n)
+{
+    gost_lanes_fn kernel;
+    int lane[MAX_LANES];
+    int width, used, i, j;
+    char *done;
+
+    width = lanes_kernel(&kernel);
+    done = n > 0 ? OPENSSL_zalloc(n) : NULL;
+    if (!done || gost_get_impl() == GOST_IMPL_BITSLICE) {
+        /* Bitsliced implementation has no lanes with different keys */
+        for (i = 0; i < n; i++)
+            gost_enc_cfb(ctx[i], iv[i], clear[i], cipher[i], blocks[i]);
+        OPENSSL_free(done);
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (done[i] || blocks[i] <= 0)
+            continue;
+        /* Gather up to width streams with the same s-boxes */
+        for (used = 0, j = i; j < n && used < width; j++) {
+            if (!done[j] && blocks[j] > 0 && ctx[j]->kbox == ctx[i]->kbox) {
+                lane[used++] = j;
+                done[j] = 1;
+            }
+        }
+        if (used == 1)
+            gost_enc_cfb(ctx[i], iv[i], clear[i], cipher[i], blocks[i]);
+        else
+            gost_enc_cfb_lanes(kernel, width, ctx, iv, clear, cipher,
+                               blocks, lane, used);
+    }
+    OPENSSL_free(done);
+}
+
+/* Number of blocks whose gamma is computed in one batch */
+#define GAMMA_BATCH 256
+
+/*
+ * Unlike encryption, CFB decryption gamma depends only on ciphertext, so
+ * it is computed for a batch of blocks at once with the multi-block kernel.
+ */
+static void gost_dec_cfb_serial(gost_ctx * ctx, const byte * iv,
+                                const byte * cipher, byte * clear,
+                                int blocks)
 {
+    byte gamma[GAMMA_BATCH * 8];
     byte cur_iv[8];
-    byte gamma[8];
-    int i, j;
-    const byte *in;
-    byte *out;
+    int i, n;
     memcpy(cur_iv, iv, 8);
-    for (i = 0, in = cipher, out = clear; i < blocks; i++, in += 8, out += 8) {
-        gostcrypt(ctx, cur_iv, gamma);
-        for (j = 0; j < 8; j++) {
-            out[j] = (cur_iv[j] = in[j]) ^ gamma[j];
+    while (blocks > 0) {
+        n = blocks < GAMMA_BATCH ? blocks : GAMMA_BATCH;
+        /* Gamma input is previous ciphertext block, copied before clear
+         * may overwrite it */
+        memcpy(gamma, cur_iv, 8);
+        memcpy(gamma + 8, cipher, 8 * (n - 1));
+        memcpy(cur_iv, cipher + 8 * (n - 1), 8);
+        gost_blocks(ctx, gamma, gamma, n, 0);
+        for (i = 0; i < 8 * n; i++)
+            clear[i] = cipher[i] ^ gamma[i];
+        cipher += 8 * n;
+        clear += 8 * n;
+        blocks -= n;
+    }
+    OPENSSL_cleanse(gamma, sizeof(gamma));
+}
+
+/* Part of CFB decryption done by one thread */
+typedef struct {
+    gost_ctx *ctx;
+    const byte *cipher;
+    byte *clear;
+    /* 8-byte IV of every part */
+    byte *ivs;
+    int blocks;
+    int parts;
+} cfb_dec_job;
+
+static int cfb_part_start(const cfb_dec_job * job, int index)
+{
+    return (int)((long long)job->blocks * index / job->parts);
+}
+
+static void cfb_dec_part(void *arg, int index)
+{
+    cfb_dec_job *job = arg;
+    int start = cfb_part_start(job, index);
+    int end = cfb_part_start(job, index + 1);
+    gost_dec_cfb_serial(job->ctx, job->ivs + 8 * index,
+                        job->cipher + 8 * start, job->clear + 8 * start,
+                        end - start);
+}
+
+/*
+ * Decrypts several full blocks in CFB mode using 8byte IV. Large inputs
+ * are split between threads, each part starting with the ciphertext
+ * block preceding it as IV.
+ */
+void gost_dec_cfb(gost_ctx * ctx, const byte * iv, const byte * cipher,
+                  byte * clear, int blocks)
+{
+    cfb_dec_job job;
+    int i;
+    job.parts = blocks > 0 ? dstu_parallel_threads_for((size_t)blocks * 8) : 1;
+    job.ivs = job.parts > 1 ? OPENSSL_malloc(8 * job.parts) : NULL;
+    if (!job.ivs) {
+        gost_dec_cfb_serial(ctx, iv, cipher, clear, blocks);
+        return;
+    }
+    job.ctx = ctx;
+    job.cipher = cipher;
+    job.clear = clear;
+    job.blocks = blocks;
+    /* Taken before any part may overwrite ciphertext in place */
+    memcpy(job.ivs, iv, 8);
+    for (i = 1; i < job.parts; i++)
+        memcpy(job.ivs + 8 * i, cipher + 8 * (cfb_part_start(&job, i) - 1), 8);
+    dstu_parallel_run(job.parts, cfb_dec_part, &job);
+    OPENSSL_free(job.ivs);
+}
+
+/* Counter increments of gamma mode, N4 is added modulo 2^32 - 1 */
+#define CNT_C2 0x01010101
+#define CNT_C1 0x01010104
+#define CNT_MOD 0xffffffffULL
+
+/*
+ * Counter for keystream block index, that is start (N3, N4) advanced
+ * index + 1 times. N4 sums are kept in 1..2^32-1, as step by step
+ * addition with end-around carry does.
+ */
+static void gost_cnt_counter(const byte * start, unsigned long long index,
+                             word32 * n3, word32 * n4)
+{
+    unsigned long long steps = index + 1, r;
+    *n3 = LOAD_HALF(start) + (word32) steps * CNT_C2;
+    r = (LOAD_HALF(start + 4) % CNT_MOD +
+         steps % CNT_MOD * CNT_C1 % CNT_MOD) % CNT_MOD;
+    *n4 = r ? (word32) r : (word32) CNT_MOD;
+}
+
+static void gost_cnt_serial(gost_ctx * ctx, const byte * start,
+                            unsigned long long index, const byte * in,
+                            byte * out, size_t blocks)
+{
+    byte gamma[GAMMA_BATCH * 8];
+    word32 n3, n4;
+    size_t i, n;
+    gost_cnt_counter(start, index, &n3, &n4);
+    while (blocks > 0) {
+        n = blocks < GAMMA_BATCH ? blocks : GAMMA_BATCH;
+        for (i = 0; i < n; i++) {
+            STORE_HALF(gamma + 8 * i, n3);
+            STORE_HALF(gamma + 8 * i + 4, n4);
+            n3 += CNT_C2;
+            n4 += CNT_C1;
+            if (n4 < CNT_C1)
+                n4++;
         }
+        gost_blocks(ctx, gamma, gamma, (int)n, 0);
+        for (i = 0; i < 8 * n; i++)
+            out[i] = in[i] ^ gamma[i];
+        in += 8 * n;
+        out += 8 * n;
+        blocks -= n;
     }
+    OPENSSL_cleanse(gamma, sizeof(gamma));
+}
+
+/* Part of gamma mode encryption done by one thread */
+typedef struct {
+    gost_ctx *ctx;
+    const byte *start;
+    unsigned long long index;
+    const byte *in;
+    byte *out;
+    size_t blocks;
+    int parts;
+} cnt_job;
+
+static size_t cnt_part_start(const cnt_job * job, int index)
+{
+    return (size_t)((unsigned long long)job->blocks * index / job->parts);
+}
+
+static void cnt_part(void *arg, int index)
+{
+    cnt_job *job = arg;
+    size_t start = cnt_part_start(job, index);
+    size_t end = cnt_part_start(job, index + 1);
+    gost_cnt_serial(job->ctx, job->start, job->index + start,
+                    job->in + 8 * start, job->out + 8 * start, end - start);
+}
+
+/*
+ * Encrypts (or decrypts, which is the same) full blocks in gamma mode
+ * starting from keystream block index. Keystream blocks do not depend on
+ * each other, so large inputs are split between threads.
+ */
+void gost_cnt_crypt(gost_ctx * ctx, const byte * start,
+                    unsigned long long index, const byte * in, byte * out,
+                    size_t blocks)
+{
+    cnt_job job;
+    job.ctx = ctx;
+    job.start = start;
+    job.index = index;
+    job.in = in;
+    job.out = out;
+    job.blocks = blocks;
+    job.parts = blocks > 0 ? dstu_parallel_threads_for(blocks * 8) : 1;
+    if (job.parts > 1)
+        dstu_parallel_run(job.parts, cnt_part, &job);
+    else
+        gost_cnt_serial(ctx, start, index, in, out, blocks);
 }
 
 /* Encrypts one block using specified key */
@@ -458,10 +1148,62 @@ static void gost_key_impl(gost_ctx * c, const byte * k)
     }
 }
 
+static int mask_source = GOST_MASK_DRBG;
+
+int gost_set_mask_source(int source)
+{
+    if (source != GOST_MASK_DRBG && source != GOST_MASK_RAND)
+        return 0;
+    mask_source = source;
+    return 1;
+}
+
+int gost_get_mask_source(void)
+{
+    return mask_source;
+}
+
+static const char *const mask_source_names[] = { "drbg", "rand" };
+
+int gost_mask_source_by_name(const char *name)
+{
+    int i;
+    for (i = 0;
+         i < (int)(sizeof(mask_source_names) / sizeof(mask_source_names[0]));
+         i++)
+        if (name && !strcmp(name, mask_source_names[i]))
+            return i;
+    return -1;
+}
+
+/*
+ * Bytes of OpenSSL's private DRBG, the one RAND_priv_bytes uses unless the
+ * default RAND method is replaced
+ */
+static int private_drbg_bytes(unsigned char *buf, size_t num)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    EVP_RAND_CTX *drbg = RAND_get0_private(NULL);
+    return drbg != NULL && EVP_RAND_generate(drbg, buf, num, 0, 0, NULL, 0) > 0;
+#else
+    RAND_DRBG *drbg = RAND_DRBG_get0_private();
+    return drbg != NULL && RAND_DRBG_bytes(drbg, buf, num) > 0;
+#endif
+}
+
+/* Fills key mask from the selected source */
+static void gost_mask(gost_ctx * c)
+{
+    if (mask_source == GOST_MASK_DRBG
+        && private_drbg_bytes((unsigned char *)c->mask, sizeof(c->mask)))
+        return;
+    RAND_priv_bytes((unsigned char *)c->mask, sizeof(c->mask));
+}
+
 /* Set 256 bit gost89 key into context */
 void gost_key(gost_ctx * c, const byte * k)
 {
-    RAND_priv_bytes((unsigned char *)c->mask, sizeof(c->mask));
+    gost_mask(c);
     gost_key_impl(c, k);
 }
 
@@ -476,7 +1218,7 @@ void gost_key_nomask(gost_ctx * c, const byte * k)
 void magma_key(gost_ctx * c, const byte * k)
 {
     int i, j;
-    RAND_priv_bytes((unsigned char *)c->mask, sizeof(c->mask));
+    gost_mask(c);
     for (i = 0, j = 0; i < 8; ++i, j += 4) {
         c->key[i] =
             (k[j + 3] | (k[j + 2] << 8) | (k[j + 1] << 16) | ((word32) k[j] <<
@@ -508,13 +1250,15 @@ void magma_get_key(gost_ctx * c, byte * k)
     }
 }
 
-/* Initalize context. Provides default value for subst_block */
-void gost_init(gost_ctx * c, const gost_subst_block * b)
+/*
+ * Initalize context with preprocessed subst blocks. Tables are referenced,
+ * not copied, so they must outlive the context.
+ */
+void gost_init(gost_ctx * c, const gost_kbox * k)
 {
-    if (!b) {
-        b = &GostR3411_94_TestParamSet;
-    }
-    kboxinit(c, b);
+    /* Kernels are selected before the first context may use them */
+    CRYPTO_THREAD_run_once(&kernels_once, kernels_init);
+    c->kbox = k;
 }
 
 /* Cleans up key from context */
@@ -529,7 +1273,8 @@ void gost_destroy(gost_ctx * c)
  * with substitution blocks and key buffer - 8-byte mac state buffer block
  * 8-byte block to process.
  */
-void mac_block(gost_ctx * c, byte * buffer, const byte * block)
+static void mac_block_scalar(gost_ctx * c, byte * buffer,
+                             const byte * block)
 {
     register word32 n1, n2;     /* As named in the GOST */
     int i;
@@ -575,7 +1320,7 @@ void get_mac(byte * buffer, int nbits, byte * out)
 {
     int nbytes = nbits >> 3;
     int rembits = nbits & 7;
-    int mask = rembits ? ((1 < rembits) - 1) : 0;
+    int mask = rembits ? ((1 << rembits) - 1) : 0;
     int i;
     for (i = 0; i < nbytes; i++)
         out[i] = buffer[i];
@@ -634,6 +1379,109 @@ int gost_mac_iv(gost_ctx * ctx, int mac_len, const unsigned char *iv,
     return 1;
 }
 
+/* Prepares streaming MAC state for a new message, keeping the key */
+void gost_mac_start(gost_mac_ctx * m, gost_ctx * c)
+{
+    m->cipher_ctx = c;
+    memset(m->buffer, 0, sizeof(m->buffer));
+    memset(m->partial, 0, sizeof(m->partial));
+    m->partial_len = 0;
+    m->blocks = 0;
+}
+
+/* Processes next part of message, any length */
+void gost_mac_update(gost_mac_ctx * m, const byte * data, size_t len)
+{
+    size_t n;
+    if (m->partial_len) {
+        n = 8 - m->partial_len;
+        if (n > len)
+            n = len;
+        memcpy(m->partial + m->partial_len, data, n);
+        m->partial_len += n;
+        data += n;
+        len -= n;
+        if (m->partial_len < 8)
+            return;
+        mac_block(m->cipher_ctx, m->buffer, m->partial);
+        m->partial_len = 0;
+        m->blocks++;
+    }
+    for (; len >= 8; data += 8, len -= 8) {
+        mac_block(m->cipher_ctx, m->buffer, data);
+        m->blocks++;
+    }
+    memcpy(m->partial, data, len);
+    m->partial_len = len;
+    /* Only whether there was more than one block matters */
+    if (m->blocks > 2)
+        m->blocks = 2;
+}
+
+/*
+ * Pads the message as gost_mac does and extracts MAC of mac_len bits.
+ * The state has to be started again before next message.
+ */
+void gost_mac_finish(gost_mac_ctx * m, int mac_len, byte * mac)
+{
+    if (m->partial_len) {
+        memset(m->partial + m->partial_len, 0, 8 - m->partial_len);
+        mac_block(m->cipher_ctx, m->buffer, m->partial);
+        m->blocks++;
+    }
+    if (m->blocks == 1) {
+        memset(m->partial, 0, sizeof(m->partial));
+        mac_block(m->cipher_ctx, m->buffer, m->partial);
+    }
+    get_mac(m->buffer, mac_len, mac);
+    OPENSSL_cleanse(m->buffer, sizeof(m->buffer));
+    OPENSSL_cleanse(m->partial, sizeof(m->partial));
+    m->partial_len = 0;
+}
+
+/*
+ * CFB encryption with MAC of the ciphertext. Both are done chunk by chunk,
+ * so every chunk is MACed while it is still in cache.
+ */
+void gost_enc_cfb_mac(gost_ctx * ctx, const byte * iv, const byte * clear,
+                      byte * cipher, int blocks, gost_mac_ctx * m)
+{
+    byte cur_iv[8];
+    int n;
+    memcpy(cur_iv, iv, 8);
+    while (blocks > 0) {
+        n = blocks < GAMMA_BATCH ? blocks : GAMMA_BATCH;
+        gost_enc_cfb(ctx, cur_iv, clear, cipher, n);
+        gost_mac_update(m, cipher, 8 * n);
+        memcpy(cur_iv, cipher + 8 * (n - 1), 8);
+        clear += 8 * n;
+        cipher += 8 * n;
+        blocks -= n;
+    }
+}
+
+/*
+ * CFB decryption with MAC of the ciphertext, chunk by chunk as above.
+ * Ciphertext is MACed before it may be overwritten in place.
+ */
+void gost_dec_cfb_mac(gost_ctx * ctx, const byte * iv, const byte * cipher,
+                      byte * clear, int blocks, gost_mac_ctx * m)
+{
+    byte cur_iv[8], next_iv[8];
+    int n;
+    memcpy(cur_iv, iv, 8);
+    while (blocks > 0) {
+        n = blocks < GAMMA_BATCH ? blocks : GAMMA_BATCH;
+        gost_mac_update(m, cipher, 8 * n);
+        memcpy(next_iv, cipher + 8 * (n - 1), 8);
+        gost_dec_cfb_serial(ctx, cur_iv, cipher, clear, n);
+        memcpy(cur_iv, next_iv, 8);
+        cipher += 8 * n;
+        clear += 8 * n;
+        blocks -= n;
+    }
+}
+
 /* Implements key meshing algorithm by modifing ctx and IV in place */
 void cryptopro_key_meshing(gost_ctx * ctx, unsigned char *iv)
 {
@@ -9,6 +9,7 @@
  **********************************************************************/
 #ifndef GOST89_H
 # define GOST89_H
+# include <stddef.h>
 
 /* Typedef for unsigned 32-bit integer */
 # if __LONG_MAX__ > 2147483647L
@@ -31,12 +32,37 @@ typedef struct {
     byte k1[16];
 } gost_subst_block;
 
-/* Cipher context includes key and preprocessed  substitution block */
+/* Preprocessed substitution block -- set up in kboxinit() */
+typedef struct {
+    u4 k87[256], k65[256], k43[256], k21[256];
+    /*
+     * The same s-boxes as 16-entry nibble tables for vector kernels:
+     * lo holds k1, k3, k5, k7, hi holds k2, k4, k6, k8 shifted left by 4
+     */
+    byte lo[64], hi[64];
+    /*
+     * Algebraic normal form of s-boxes for the bitsliced kernel: bit m of
+     * anf[4 * q + o] is set if output bit o of s-box q (k1 being s-box 0)
+     * contains the product of input bits set in m
+     */
+    unsigned short anf[32];
+    /*
+     * k87 .. k21 rotated left by 11 bits, so serial code saves the
+     * rotation on its critical path
+     */
+    u4 r87[256], r65[256], r43[256], r21[256];
+} gost_kbox;
+
+/*
+ * Cipher context includes key and a pointer to preprocessed substitution
+ * block. Tables are not owned by the context and may be shared between
+ * any number of contexts.
+ */
 typedef struct {
     u4 key[8];
     u4 mask[8];
     /* Constant s-boxes -- set up in gost_init(). */
-    u4 k87[256], k65[256], k43[256], k21[256];
+    const gost_kbox *kbox;
 } gost_ctx;
 /*
  * Note: encrypt and decrypt expect full blocks--padding blocks is caller's
@@ -53,6 +79,67 @@ void gost_enc_cfb(gost_ctx * ctx, const byte * iv, const byte * clear,
 /* Decrypts several full blocks in CFB mode using 8byte IV */
 void gost_dec_cfb(gost_ctx * ctx, const byte * iv, const byte * cipher,
                   byte * clear, int blocks);
+/*
+ * Gamma (counter) mode, encryption and decryption are the same. start is
+ * the encrypted IV (gostcrypt of it), index is the number of the first
+ * keystream block, so any part of a stream can be processed on its own.
+ */
+void gost_cnt_crypt(gost_ctx * ctx, const byte * start,
+                    unsigned long long index, const byte * in, byte * out,
+                    size_t blocks);
+/*
+ * Encrypts n independent streams in CFB mode at once, stream i being
+ * gost_enc_cfb(ctx[i], iv[i], clear[i], cipher[i], blocks[i])
+ */
+void gost_enc_cfb_multi(gost_ctx * const *ctx, const byte * const *iv,
+                        const byte * const *clear, byte * const *cipher,
+                        const int *blocks, int n);
+
+/*
+ * Implementations of GOST kernels: single blocks (gostcrypt, gostdecrypt,
+ * mac_block and so hash_step) and multi-block operations (ECB, CFB
+ * decryption, gamma mode, multi-stream CFB). AUTO picks the fastest one
+ * supported by the CPU and is the default. SCALAR is the original table
+ * code everywhere, TABLE uses rotated tables for single blocks, vector
+ * ones use them as well. BITSLICE is the only one with no key or data
+ * dependent memory accesses in multi-block operations.
+ */
+# define GOST_IMPL_AUTO      0
+# define GOST_IMPL_SCALAR    1
+# define GOST_IMPL_AVX2      2
+# define GOST_IMPL_AVX512    3
+# define GOST_IMPL_BITSLICE  4
+# define GOST_IMPL_SSSE3     5
+# define GOST_IMPL_TABLE     6
+/*
+ * Select process-wide implementation. Returns 0 if CPU does not support it.
+ * Contexts may be in use meanwhile, calls already running finish with the
+ * previous kernels, all implementations give the same results.
+ */
+int gost_set_impl(int impl);
+/* Get implementation in use, never returns GOST_IMPL_AUTO */
+int gost_get_impl(void);
+/*
+ * Implementation by name ("auto", "scalar", "table", "ssse3", "avx2",
+ * "avx512", "bitslice"), -1 if there is no such name
+ */
+int gost_impl_by_name(const char *name);
+/* Name of implementation, NULL for unknown */
+const char *gost_impl_name(int impl);
+
+/*
+ * Source of the random masks gost_key and magma_key hide keys with. DRBG
+ * is OpenSSL's own private generator, whatever the default RAND method is,
+ * and is the default. RAND is RAND_priv_bytes, so masks come
+ * from an engine RAND when it is the default one, at its speed
+ */
+# define GOST_MASK_DRBG      0
+# define GOST_MASK_RAND      1
+/* Select process-wide mask source, returns 0 for unknown one */
+int gost_set_mask_source(int source);
+int gost_get_mask_source(void);
+/* Source by name ("drbg", "rand"), -1 if there is no such name */
+int gost_mask_source_by_name(const char *name);
 
 /* Encrypt one  block */
 void gostcrypt(gost_ctx * c, const byte * in, byte * out);
@@ -66,13 +153,26 @@ void gost_key_nomask(gost_ctx * c, const byte * k);
 void magma_key(gost_ctx * c, const byte * k);
 /* Get key from context */
 void gost_get_key(gost_ctx * c, byte * k);
-/* Set S-blocks into context */
-void gost_init(gost_ctx * c, const gost_subst_block * b);
+/* Set preprocessed S-blocks into context */
+void gost_init(gost_ctx * c, const gost_kbox * k);
 /* Clean up context */
 void gost_destroy(gost_ctx * c);
 /* Intermediate function used for calculate hash */
 void gost_enc_with_key(gost_ctx *, byte * key, byte * inblock,
                        byte * outblock);
+/*
+ * Encrypts 4 blocks of in at once, block j with its own unmasked key:
+ * word i of key j is key[4 * i + j]. Used for hashing
+ */
+void gost_enc_with_keys4(const gost_kbox * k, const u4 * key,
+                         const byte * in, byte * out);
+/*
+ * Same for width (4, 8 or 16) blocks: word i of key j is key[width * i + j].
+ * gost_keys_width tells the width the selected kernels do in one pass
+ */
+void gost_enc_with_keys(const gost_kbox * k, int width, const u4 * key,
+                        const byte * in, byte * out);
+int gost_keys_width(void);
 /* Compute MAC of given length in bits from data */
 int gost_mac(gost_ctx * ctx, int mac_len, const unsigned char *data,
              unsigned int data_len, unsigned char *mac);
@@ -83,6 +183,28 @@ int gost_mac(gost_ctx * ctx, int mac_len, const unsigned char *data,
 int gost_mac_iv(gost_ctx * ctx, int mac_len, const unsigned char *iv,
                 const unsigned char *data, unsigned int data_len,
                 unsigned char *mac);
+/* MAC of a message given in parts */
+typedef struct {
+    gost_ctx *cipher_ctx;
+    byte buffer[8];
+    byte partial[8];
+    unsigned int partial_len;
+    unsigned int blocks;
+} gost_mac_ctx;
+/* Starts new message, ctx should be initialized with key and subst blocks */
+void gost_mac_start(gost_mac_ctx * m, gost_ctx * c);
+/* Adds data to the message */
+void gost_mac_update(gost_mac_ctx * m, const byte * data, size_t len);
+/* Computes MAC of given length in bits, same as gost_mac of whole message */
+void gost_mac_finish(gost_mac_ctx * m, int mac_len, byte * mac);
+/*
+ * CFB encryption (decryption) of full blocks in one pass with adding the
+ * ciphertext to MAC state m, which may use another key
+ */
+void gost_enc_cfb_mac(gost_ctx * ctx, const byte * iv, const byte * clear,
+                      byte * cipher, int blocks, gost_mac_ctx * m);
+void gost_dec_cfb_mac(gost_ctx * ctx, const byte * iv, const byte * cipher,
+                      byte * clear, int blocks, gost_mac_ctx * m);
 /* Perform one step of MAC calculation like gostcrypt */
 void mac_block(gost_ctx * c, byte * buffer, const byte * block);
 /* Extracts MAC value from mac state buffer */
@@ -100,8 +222,8 @@ extern gost_subst_block Gost28147_CryptoProParamSetD;
 extern gost_subst_block Gost28147_TC26ParamSetZ;
 extern const byte CryptoProKeyMeshingKey[];
 typedef unsigned int word32;
-/* For tests. */
-void kboxinit(gost_ctx * c, const gost_subst_block * b);
+/* Preprocess S-blocks */
+void kboxinit(gost_kbox * k, const gost_subst_block * b);
 void magma_get_key(gost_ctx * c, byte * k);
 void acpkm_magma_key_meshing(gost_ctx * ctx);
 #endif
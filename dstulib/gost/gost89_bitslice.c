@@ -0,0 +1,209 @@
+/**********************************************************************
+ *                        gost89_bitslice.c                           *
+ *     This file is distributed under the same license as OpenSSL     *
+ *                                                                    *
+ *        Bitsliced GOST 28147-89 kernel for 64-block batches         *
+ *                                                                    *
+ *   Bit i of every word belongs to block i, so one word operation    *
+ *   processes 64 blocks. S-boxes are evaluated from their algebraic  *
+ *   normal form (anf of gost_kbox), key addition is a ripple-carry   *
+ *   adder. Memory access pattern and control flow depend on nothing  *
+ *   but the (public) s-box, never on key or data.                    *
+ **********************************************************************/
+#include <stdint.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include "gost89_simd.h"
+
+#ifdef __GNUC__
+/* Four 64-bit words processed as one, 256 blocks per batch */
+typedef uint64_t bs_word __attribute__((vector_size(32)));
+# define BS_LANES 4
+#else
+typedef uint64_t bs_word;
+# define BS_LANES 1
+#endif
+#define BS_BLOCKS (64 * BS_LANES)
+
+/*
+ * Rounds are compiled once more for every vector extension worth it, so
+ * they must be inlined into each variant
+ */
+#ifdef __GNUC__
+# define BS_INLINE inline __attribute__((always_inline))
+#else
+# define BS_INLINE
+#endif
+
+/*
+ * Transposes 64x64 bit matrix in place: bit j of a[i] becomes bit i of
+ * a[j]. Turns 64 blocks into 64 bit slices and back.
+ */
+static void transpose64(uint64_t * a)
+{
+    uint64_t m = 0x00000000FFFFFFFFULL, t;
+    int j, k;
+    for (j = 32; j != 0; j >>= 1, m ^= m << j) {
+        for (k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+            t = ((a[k] >> j) ^ a[k | j]) & m;
+            a[k] ^= t << j;
+            a[k | j] ^= t;
+        }
+    }
+}
+
+/* x = n + k mod 2^32 on bit slices, k is the same for all blocks */
+static BS_INLINE void add_key(bs_word * x, const bs_word * n, u4 k)
+{
+    bs_word carry = { 0 }, zero = { 0 }, key, a, half;
+    int i;
+    for (i = 0; i < 32; i++) {
+        key = zero - (uint64_t) ((k >> i) & 1);
+        a = n[i];
+        half = a ^ key;
+        x[i] = half ^ carry;
+        carry = (a & key) | (carry & half);
+    }
+}
+
+/*
+ * Monomials of every s-box output bit, made from the algebraic normal form
+ * once per batch. They depend on the s-box only, which is public.
+ */
+typedef struct {
+    byte count[32];
+    byte mono[32][16];
+} anf_terms;
+
+static void anf_terms_init(anf_terms * t, const gost_kbox * kbox)
+{
+    int i, m;
+    for (i = 0; i < 32; i++) {
+        t->count[i] = 0;
+        for (m = 0; m < 16; m++)
+            if (kbox->anf[i] >> m & 1)
+                t->mono[i][t->count[i]++] = (byte) m;
+    }
+}
+
+/* n ^= f(x), f being s-box substitution and rotation by 11 bits */
+static BS_INLINE void subst_rotate(const anf_terms * t, bs_word * n, const bs_word * x)
+{
+    bs_word mono[16], y, zero = { 0 };
+    int q, o, i, s;
+    for (q = 0; q < 8; q++) {
+        /* All products of the nibble's input bits */
+        mono[0] = ~zero;
+        mono[1] = x[4 * q];
+        mono[2] = x[4 * q + 1];
+        mono[4] = x[4 * q + 2];
+        mono[8] = x[4 * q + 3];
+        for (s = 3; s < 16; s++) {
+            if (s & (s - 1))
+                mono[s] = mono[s & (s - 1)] & mono[s & -s];
+        }
+        for (o = 4 * q; o < 4 * q + 4; o++) {
+            y = zero;
+            for (i = 0; i < t->count[o]; i++)
+                y ^= mono[t->mono[o][i]];
+            /* Rotate left 11 bits */
+            n[(o + 11) & 31] ^= y;
+        }
+    }
+}
+
+/* All 32 rounds on bit slices s, n1 followed by n2 */
+static BS_INLINE void rounds(gost_ctx * c, const int *order,
+                             const anf_terms * t, bs_word * s)
+{
+    bs_word x[32], *n1 = s, *n2 = s + 32;
+    int i;
+    /* Instead of swapping halves, swap names each round */
+    for (i = 0; i < 32; i += 2) {
+        add_key(x, n1, c->key[order[i]] + c->mask[order[i]]);
+        subst_rotate(t, n2, x);
+        add_key(x, n2, c->key[order[i + 1]] + c->mask[order[i + 1]]);
+        subst_rotate(t, n1, x);
+    }
+    OPENSSL_cleanse(x, sizeof(x));
+}
+
+static void rounds_generic(gost_ctx * c, const int *order,
+                           const anf_terms * t, bs_word * s)
+{
+    rounds(c, order, t, s);
+}
+
+#ifdef GOST_X86_SIMD
+static __attribute__((target("avx2")))
+void rounds_avx2(gost_ctx * c, const int *order, const anf_terms * t,
+                 bs_word * s)
+{
+    rounds(c, order, t, s);
+}
+
+static __attribute__((target("avx512f,avx512vl")))
+void rounds_avx512(gost_ctx * c, const int *order, const anf_terms * t,
+                   bs_word * s)
+{
+    rounds(c, order, t, s);
+}
+#endif
+
+int gost_blocks_bitslice(gost_ctx * c, const byte * in, byte * out,
+                         int blocks, int decrypt)
+{
+    const int *order = decrypt ? gost_dec_order : gost_enc_order;
+    void (*batch) (gost_ctx *, const int *, const anf_terms *, bs_word *) =
+        rounds_generic;
+    bs_word s[64];
+    uint64_t a[64];
+    anf_terms terms;
+    int i, j, l, done;
+
+    if (blocks < BS_BLOCKS)
+        return 0;
+
+#ifdef GOST_X86_SIMD
+    if (gost_cpu_avx512())
+        batch = rounds_avx512;
+    else if (gost_cpu_avx2())
+        batch = rounds_avx2;
+#endif
+    anf_terms_init(&terms, c->kbox);
+
+    for (done = 0; done + BS_BLOCKS <= blocks;
+         done += BS_BLOCKS, in += 8 * BS_BLOCKS, out += 8 * BS_BLOCKS) {
+        /*
+         * Every lane takes 64 little-endian blocks: n1 is bits 0-31,
+         * n2 is bits 32-63
+         */
+        for (l = 0; l < BS_LANES; l++) {
+            for (i = 0; i < 64; i++) {
+                a[i] = 0;
+                for (j = 7; j >= 0; j--)
+                    a[i] = a[i] << 8 | in[8 * (64 * l + i) + j];
+            }
+            transpose64(a);
+            for (i = 0; i < 64; i++)
+                ((uint64_t *)&s[i])[l] = a[i];
+        }
+
+        batch(c, order, &terms, s);
+
+        /* Output is n2 followed by n1 */
+        for (l = 0; l < BS_LANES; l++) {
+            for (i = 0; i < 32; i++) {
+                a[i] = ((uint64_t *)&s[32 + i])[l];
+                a[32 + i] = ((uint64_t *)&s[i])[l];
+            }
+            transpose64(a);
+            for (i = 0; i < 64; i++)
+                for (j = 0; j < 8; j++)
+                    out[8 * (64 * l + i) + j] = (byte) (a[i] >> (8 * j));
+        }
+    }
+    OPENSSL_cleanse(s, sizeof(s));
+    OPENSSL_cleanse(a, sizeof(a));
+    return done;
+}
@@ -0,0 +1,394 @@
+/**********************************************************************
+ *                        gost89_simd.c                               *
+ *     This file is distributed under the same license as OpenSSL     *
+ *                                                                    *
+ *       Multi-block vector kernels for GOST 28147-89                 *
+ *                                                                    *
+ *   Each vector lane holds one half of an independent block. The     *
+ *   s-box step is done on 4-bit nibbles with byte shuffles (see lo   *
+ *   and hi tables of gost_kbox), so there are no per-block memory    *
+ *   lookups at all.                                                  *
+ **********************************************************************/
+#include "gost89_simd.h"
+
+#ifdef GOST_X86_SIMD
+
+# include <immintrin.h>
+
+# define TARGET_SSSE3 __attribute__((target("ssse3")))
+# define TARGET_AVX2 __attribute__((target("avx2")))
+# define TARGET_AVX512 __attribute__((target("avx512f,avx512vbmi")))
+
+typedef struct {
+    __m128i lo[4], hi[4];       /* Nibble tables, one s-box per table */
+    __m128i bytes[4];           /* Selects byte j of every dword */
+    __m128i nibble;
+} ssse3_tables;
+
+/* Same as f_avx2 on 4 lanes */
+static TARGET_SSSE3 inline __m128i f_ssse3(const ssse3_tables * t, __m128i x)
+{
+    __m128i lo = _mm_and_si128(x, t->nibble);
+    __m128i hi = _mm_and_si128(_mm_srli_epi32(x, 4), t->nibble);
+    __m128i r;
+    int j;
+
+    r = _mm_setzero_si128();
+    for (j = 0; j < 4; j++) {
+        __m128i s = _mm_or_si128(_mm_shuffle_epi8(t->lo[j], lo),
+                                 _mm_shuffle_epi8(t->hi[j], hi));
+        r = _mm_or_si128(r, _mm_and_si128(s, t->bytes[j]));
+    }
+    /* Rotate left 11 bits */
+    return _mm_or_si128(_mm_slli_epi32(r, 11), _mm_srli_epi32(r, 21));
+}
+
+static TARGET_SSSE3 void ssse3_tables_init(ssse3_tables * t,
+                                            const gost_kbox * k)
+{
+    int i;
+    for (i = 0; i < 4; i++) {
+        t->lo[i] = _mm_loadu_si128((const __m128i *)(k->lo + 16 * i));
+        t->hi[i] = _mm_loadu_si128((const __m128i *)(k->hi + 16 * i));
+        t->bytes[i] = _mm_set1_epi32((int)(0xffU << (8 * i)));
+    }
+    t->nibble = _mm_set1_epi8(0x0f);
+}
+
+/* 4 blocks from in to out, key and mask given per round key and lane */
+static TARGET_SSSE3 inline void crypt_ssse3(const ssse3_tables * t,
+                                            const __m128i * key,
+                                            const __m128i * mask,
+                                            const int *order,
+                                            const byte * in, byte * out)
+{
+    __m128 a, b;
+    __m128i n1, n2;
+    int i;
+
+    /* Gather first halves of 4 blocks into n1, second halves into n2 */
+    a = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)in));
+    b = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(in + 16)));
+    n1 = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+    n2 = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+
+    /* Instead of swapping halves, swap names each round */
+    for (i = 0; i < 32; i += 2) {
+        n2 = _mm_xor_si128(n2, f_ssse3(t,
+                 _mm_add_epi32(_mm_add_epi32(n1, key[order[i]]),
+                               mask[order[i]])));
+        n1 = _mm_xor_si128(n1, f_ssse3(t,
+                 _mm_add_epi32(_mm_add_epi32(n2, key[order[i + 1]]),
+                               mask[order[i + 1]])));
+    }
+
+    _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi32(n2, n1));
+    _mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi32(n2, n1));
+}
+
+TARGET_SSSE3 int gost_blocks_ssse3(gost_ctx * c, const byte * in, byte * out,
+                                   int blocks, int decrypt)
+{
+    const int *order = decrypt ? gost_dec_order : gost_enc_order;
+    ssse3_tables t;
+    __m128i key[8], mask[8];
+    int i, done;
+
+    ssse3_tables_init(&t, c->kbox);
+    for (i = 0; i < 8; i++) {
+        key[i] = _mm_set1_epi32((int)c->key[i]);
+        mask[i] = _mm_set1_epi32((int)c->mask[i]);
+    }
+
+    for (done = 0; done + 4 <= blocks; done += 4, in += 32, out += 32)
+        crypt_ssse3(&t, key, mask, order, in, out);
+    return done;
+}
+
+TARGET_SSSE3 void gost_lanes_ssse3(const gost_kbox * k, const u4 * key,
+                                   const u4 * mask, const byte * in,
+                                   byte * out)
+{
+    ssse3_tables t;
+    __m128i lane_key[8], lane_mask[8];
+    int i;
+
+    ssse3_tables_init(&t, k);
+    for (i = 0; i < 8; i++) {
+        lane_key[i] = _mm_loadu_si128((const __m128i *)(key + 4 * i));
+        lane_mask[i] = _mm_loadu_si128((const __m128i *)(mask + 4 * i));
+    }
+    crypt_ssse3(&t, lane_key, lane_mask, gost_enc_order, in, out);
+}
+
+typedef struct {
+    __m256i lo[4], hi[4];       /* Nibble tables, one s-box per table */
+    __m256i bytes[4];           /* Selects byte j of every dword */
+    __m256i nibble;
+} avx2_tables;
+
+/*
+ * vpshufb looks up a 16-entry table, so every s-box needs its own
+ * shuffle, the result is then picked from the byte the s-box belongs to.
+ */
+static TARGET_AVX2 inline __m256i f_avx2(const avx2_tables * t, __m256i x)
+{
+    __m256i lo = _mm256_and_si256(x, t->nibble);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi32(x, 4), t->nibble);
+    __m256i r;
+    int j;
+
+    r = _mm256_setzero_si256();
+    for (j = 0; j < 4; j++) {
+        __m256i s = _mm256_or_si256(_mm256_shuffle_epi8(t->lo[j], lo),
+                                    _mm256_shuffle_epi8(t->hi[j], hi));
+        r = _mm256_or_si256(r, _mm256_and_si256(s, t->bytes[j]));
+    }
+    /* Rotate left 11 bits */
+    return _mm256_or_si256(_mm256_slli_epi32(r, 11), _mm256_srli_epi32(r, 21));
+}
+
+static TARGET_AVX2 void avx2_tables_init(avx2_tables * t,
+                                          const gost_kbox * k)
+{
+    int i;
+    for (i = 0; i < 4; i++) {
+        t->lo[i] = _mm256_broadcastsi128_si256(
+                       _mm_loadu_si128((const __m128i *)(k->lo + 16 * i)));
+        t->hi[i] = _mm256_broadcastsi128_si256(
+                       _mm_loadu_si128((const __m128i *)(k->hi + 16 * i)));
+        t->bytes[i] = _mm256_set1_epi32((int)(0xffU << (8 * i)));
+    }
+    t->nibble = _mm256_set1_epi8(0x0f);
+}
+
+/* 8 blocks from in to out, key and mask given per round key and lane */
+static TARGET_AVX2 inline void crypt_avx2(const avx2_tables * t,
+                                          const __m256i * key,
+                                          const __m256i * mask,
+                                          const int *order, const byte * in,
+                                          byte * out)
+{
+    const __m256i deinterleave = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    const __m256i interleave = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    __m256i a, b, n1, n2;
+    int i;
+
+    /* Gather first halves of 8 blocks into n1, second halves into n2 */
+    a = _mm256_permutevar8x32_epi32(
+            _mm256_loadu_si256((const __m256i *)in), deinterleave);
+    b = _mm256_permutevar8x32_epi32(
+            _mm256_loadu_si256((const __m256i *)(in + 32)), deinterleave);
+    n1 = _mm256_permute2x128_si256(a, b, 0x20);
+    n2 = _mm256_permute2x128_si256(a, b, 0x31);
+
+    /* Instead of swapping halves, swap names each round */
+    for (i = 0; i < 32; i += 2) {
+        n2 = _mm256_xor_si256(n2, f_avx2(t,
+                 _mm256_add_epi32(_mm256_add_epi32(n1, key[order[i]]),
+                                  mask[order[i]])));
+        n1 = _mm256_xor_si256(n1, f_avx2(t,
+                 _mm256_add_epi32(_mm256_add_epi32(n2, key[order[i + 1]]),
+                                  mask[order[i + 1]])));
+    }
+
+    a = _mm256_permute2x128_si256(n2, n1, 0x20);
+    b = _mm256_permute2x128_si256(n2, n1, 0x31);
+    _mm256_storeu_si256((__m256i *)out,
+                        _mm256_permutevar8x32_epi32(a, interleave));
+    _mm256_storeu_si256((__m256i *)(out + 32),
+                        _mm256_permutevar8x32_epi32(b, interleave));
+}
+
+TARGET_AVX2 int gost_blocks_avx2(gost_ctx * c, const byte * in, byte * out,
+                                 int blocks, int decrypt)
+{
+    const int *order = decrypt ? gost_dec_order : gost_enc_order;
+    avx2_tables t;
+    __m256i key[8], mask[8];
+    int i, done;
+
+    avx2_tables_init(&t, c->kbox);
+    for (i = 0; i < 8; i++) {
+        key[i] = _mm256_set1_epi32((int)c->key[i]);
+        mask[i] = _mm256_set1_epi32((int)c->mask[i]);
+    }
+
+    for (done = 0; done + 8 <= blocks; done += 8, in += 64, out += 64)
+        crypt_avx2(&t, key, mask, order, in, out);
+    return done;
+}
+
+TARGET_AVX2 void gost_lanes_avx2(const gost_kbox * k, const u4 * key,
+                                 const u4 * mask, const byte * in, byte * out)
+{
+    avx2_tables t;
+    __m256i lane_key[8], lane_mask[8];
+    int i;
+
+    avx2_tables_init(&t, k);
+    for (i = 0; i < 8; i++) {
+        lane_key[i] = _mm256_loadu_si256((const __m256i *)(key + 8 * i));
+        lane_mask[i] = _mm256_loadu_si256((const __m256i *)(mask + 8 * i));
+    }
+    crypt_avx2(&t, lane_key, lane_mask, gost_enc_order, in, out);
+}
+
+/*
+ * vpermb looks up a 64-entry table, which fits four s-boxes at once
+ * when the byte position is put into bits 4-5 of the index.
+ */
+static TARGET_AVX512 inline __m512i f_avx512(__m512i lo_t, __m512i hi_t,
+                                             __m512i nibble, __m512i pos,
+                                             __m512i x)
+{
+    /* (x & nibble) | pos */
+    __m512i lo = _mm512_ternarylogic_epi32(x, nibble, pos, 0xEA);
+    __m512i hi = _mm512_ternarylogic_epi32(_mm512_srli_epi32(x, 4), nibble,
+                                           pos, 0xEA);
+    x = _mm512_or_si512(_mm512_permutexvar_epi8(lo, lo_t),
+                        _mm512_permutexvar_epi8(hi, hi_t));
+    return _mm512_rol_epi32(x, 11);
+}
+
+/* 16 blocks from in to out, key and mask given per round key and lane */
+static TARGET_AVX512 inline void crypt_avx512(const gost_kbox * k,
+                                              const __m512i * key,
+                                              const __m512i * mask,
+                                              const int *order,
+                                              const byte * in, byte * out)
+{
+    const __m512i even = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14,
+                                           16, 18, 20, 22, 24, 26, 28, 30);
+    const __m512i odd = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15,
+                                          17, 19, 21, 23, 25, 27, 29, 31);
+    const __m512i first = _mm512_setr_epi32(0, 16, 1, 17, 2, 18, 3, 19,
+                                            4, 20, 5, 21, 6, 22, 7, 23);
+    const __m512i second = _mm512_setr_epi32(8, 24, 9, 25, 10, 26, 11, 27,
+                                             12, 28, 13, 29, 14, 30, 15, 31);
+    const __m512i lo_t = _mm512_loadu_si512(k->lo);
+    const __m512i hi_t = _mm512_loadu_si512(k->hi);
+    const __m512i nibble = _mm512_set1_epi8(0x0f);
+    const __m512i pos = _mm512_set1_epi32(0x30201000);
+    __m512i a, b, n1, n2;
+    int i;
+
+    a = _mm512_loadu_si512(in);
+    b = _mm512_loadu_si512(in + 64);
+    n1 = _mm512_permutex2var_epi32(a, even, b);
+    n2 = _mm512_permutex2var_epi32(a, odd, b);
+
+    for (i = 0; i < 32; i += 2) {
+        n2 = _mm512_xor_si512(n2, f_avx512(lo_t, hi_t, nibble, pos,
+                 _mm512_add_epi32(_mm512_add_epi32(n1, key[order[i]]),
+                                  mask[order[i]])));
+        n1 = _mm512_xor_si512(n1, f_avx512(lo_t, hi_t, nibble, pos,
+                 _mm512_add_epi32(_mm512_add_epi32(n2, key[order[i + 1]]),
+                                  mask[order[i + 1]])));
+    }
+
+    _mm512_storeu_si512(out, _mm512_permutex2var_epi32(n2, first, n1));
+    _mm512_storeu_si512(out + 64, _mm512_permutex2var_epi32(n2, second, n1));
+}
+
+TARGET_AVX512 int gost_blocks_avx512(gost_ctx * c, const byte * in,
+                                     byte * out, int blocks, int decrypt)
+{
+    const int *order = decrypt ? gost_dec_order : gost_enc_order;
+    __m512i key[8], mask[8];
+    int i, done;
+
+    for (i = 0; i < 8; i++) {
+        key[i] = _mm512_set1_epi32((int)c->key[i]);
+        mask[i] = _mm512_set1_epi32((int)c->mask[i]);
+    }
+
+    for (done = 0; done + 16 <= blocks; done += 16, in += 128, out += 128)
+        crypt_avx512(c->kbox, key, mask, order, in, out);
+    return done;
+}
+
+TARGET_AVX512 void gost_lanes_avx512(const gost_kbox * k, const u4 * key,
+                                     const u4 * mask, const byte * in,
+                                     byte * out)
+{
+    __m512i lane_key[8], lane_mask[8];
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        lane_key[i] = _mm512_loadu_si512(key + 16 * i);
+        lane_mask[i] = _mm512_loadu_si512(mask + 16 * i);
+    }
+    crypt_avx512(k, lane_key, lane_mask, gost_enc_order, in, out);
+}
+
+int gost_cpu_ssse3(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+}
+
+int gost_cpu_avx2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+int gost_cpu_avx512(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f")
+        && __builtin_cpu_supports("avx512vbmi");
+}
+
+#else
+
+int gost_blocks_ssse3(gost_ctx * c, const byte * in, byte * out, int blocks,
+                      int decrypt)
+{
+    return 0;
+}
+
+int gost_blocks_avx2(gost_ctx * c, const byte * in, byte * out, int blocks,
+                     int decrypt)
+{
+    return 0;
+}
+
+int gost_blocks_avx512(gost_ctx * c, const byte * in, byte * out,
+                       int blocks, int decrypt)
+{
+    return 0;
+}
+
+void gost_lanes_ssse3(const gost_kbox * k, const u4 * key, const u4 * mask,
+                      const byte * in, byte * out)
+{
+}
+
+void gost_lanes_avx2(const gost_kbox * k, const u4 * key, const u4 * mask,
+                     const byte * in, byte * out)
+{
+}
+
+void gost_lanes_avx512(const gost_kbox * k, const u4 * key,
+                       const u4 * mask, const byte * in, byte * out)
+{
+}
+
+int gost_cpu_ssse3(void)
+{
+    return 0;
+}
+
+int gost_cpu_avx2(void)
+{
+    return 0;
+}
+
+int gost_cpu_avx512(void)
+{
+    return 0;
+}
+
+#endif
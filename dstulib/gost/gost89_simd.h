@@ -0,0 +1,60 @@
+/**********************************************************************
+ *                        gost89_simd.h                               *
+ *     This file is distributed under the same license as OpenSSL     *
+ *                                                                    *
+ *         Multi-block kernels for GOST 28147-89 (internal)           *
+ **********************************************************************/
+#ifndef GOST89_SIMD_H
+# define GOST89_SIMD_H
+# include "gost89.h"
+
+# if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#  define GOST_X86_SIMD
+# endif
+
+/* Round key indices for encryption and decryption */
+extern const int gost_enc_order[32];
+extern const int gost_dec_order[32];
+
+/*
+ * Kernels encrypt (or decrypt if decrypt is non-zero) independent blocks
+ * in ECB mode, several blocks at a time. Only the largest multiple of the
+ * kernel width not exceeding blocks is processed, the number of processed
+ * blocks is returned. in and out may be the same buffer.
+ */
+
+/* 4 blocks at a time, pshufb s-box lookups. Needs SSSE3 */
+int gost_blocks_ssse3(gost_ctx * c, const byte * in, byte * out, int blocks,
+                      int decrypt);
+/* 8 blocks at a time, vpshufb s-box lookups. Needs AVX2 */
+int gost_blocks_avx2(gost_ctx * c, const byte * in, byte * out, int blocks,
+                     int decrypt);
+/* 16 blocks at a time, vpermb s-box lookups. Needs AVX-512F and VBMI */
+int gost_blocks_avx512(gost_ctx * c, const byte * in, byte * out,
+                       int blocks, int decrypt);
+
+/* 64 blocks at a time, bitsliced, constant time. Portable */
+int gost_blocks_bitslice(gost_ctx * c, const byte * in, byte * out,
+                         int blocks, int decrypt);
+
+/*
+ * Lane kernels encrypt one block per lane, every lane with its own key.
+ * Word i of the key (and mask) of lane j is key[width * i + j], block of
+ * lane j is at in + 8 * j. in and out may be the same buffer.
+ */
+
+/* 4 lanes, needs SSSE3 */
+void gost_lanes_ssse3(const gost_kbox * k, const u4 * key, const u4 * mask,
+                      const byte * in, byte * out);
+/* 8 lanes, needs AVX2 */
+void gost_lanes_avx2(const gost_kbox * k, const u4 * key, const u4 * mask,
+                     const byte * in, byte * out);
+/* 16 lanes, needs AVX-512F and VBMI */
+void gost_lanes_avx512(const gost_kbox * k, const u4 * key,
+                       const u4 * mask, const byte * in, byte * out);
+
+/* Whether the CPU (and OS) support the kernels above */
+int gost_cpu_ssse3(void);
+int gost_cpu_avx2(void);
+int gost_cpu_avx512(void);
+#endif
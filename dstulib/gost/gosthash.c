@@ -6,6 +6,7 @@
  *    Implementation of GOST R 34.11-94 hash function                 *
  *       uses on gost89.c and gost89.h Doesn't need OpenSSL           *
  **********************************************************************/
+#include <stdint.h>
 #include <string.h>
 
 #include "gost89.h"
@@ -27,37 +28,136 @@
 #endif
 /*
  * Following functions are various bit meshing routines used in GOST R
- * 34.11-94 algorithms
+ * 34.11-94 algorithms. The 256-bit blocks are handled as four
+ * little-endian 64-bit words, so that byte i of a block is byte i % 8 of
+ * word i / 8.
  */
-static void swap_bytes(byte * w, byte * k)
+static uint64_t load64(const byte * p)
 {
-    int i, j;
-    for (i = 0; i < 4; i++)
-        for (j = 0; j < 8; j++)
-            k[i + 4 * j] = w[8 * i + j];
+    return (uint64_t) p[0] | ((uint64_t) p[1] << 8) |
+        ((uint64_t) p[2] << 16) | ((uint64_t) p[3] << 24) |
+        ((uint64_t) p[4] << 32) | ((uint64_t) p[5] << 40) |
+        ((uint64_t) p[6] << 48) | ((uint64_t) p[7] << 56);
+}
 
+static void store64(byte * p, uint64_t v)
+{
+    int i;
+    for (i = 0; i < 8; i++, v >>= 8)
+        p[i] = (byte) v;
 }
 
-/* was A_A */
-static void circle_xor8(const byte * w, byte * k)
+static void load_block(uint64_t * w, const byte * p)
 {
-    byte buf[8];
     int i;
-    memcpy(buf, w, 8);
-    memmove(k, w + 8, 24);
-    for (i = 0; i < 8; i++)
-        k[i + 24] = buf[i] ^ k[i];
+    for (i = 0; i < 4; i++)
+        w[i] = load64(p + 8 * i);
+}
+
+/*
+ * Key transformation P (was swap_bytes): byte m of key word i is byte i
+ * of block word m. Stores the key as lane j of gost_enc_with_keys.
+ */
+static void set_key(u4 * key, int width, int j, const uint64_t * w)
+{
+    int m;
+    for (m = 0; m < 8; m++) {
+        key[width * m + j] = (u4) ((w[0] >> (8 * m)) & 0xff) |
+            (u4) ((w[1] >> (8 * m)) & 0xff) << 8 |
+            (u4) ((w[2] >> (8 * m)) & 0xff) << 16 |
+            (u4) ((w[3] >> (8 * m)) & 0xff) << 24;
+    }
+}
+
+/*
+ * Transformation A on a key word, which holds byte m of the four block
+ * words: key transformation P commutes with A this way, so keys are
+ * derived after P
+ */
+static u4 circle_xor8_key(u4 x)
+{
+    return (x >> 8) | ((x ^ (x >> 8)) & 0xff) << 24;
 }
 
-/* was R_R */
-static void transform_3(byte * data)
+/* Constant C3 xored into U before the third key, after P */
+static const u4 hash_c3[8] = {
+    0xff00ff00, 0x00ff00ff, 0x00ffff00, 0x000000ff,
+    0xffffff00, 0xff0000ff, 0x0000ff00, 0xffff00ff
+};
+
+/*
+ * Mixing transformation psi (was transform_3/R_R): shifts the block by one
+ * 16-bit word, feeding back the xor of words 0, 1, 2, 3, 12 and 15.
+ */
+static void psi(uint64_t * w)
 {
-    unsigned short int acc;
-    acc = (data[0] ^ data[2] ^ data[4] ^ data[6] ^ data[24] ^ data[30]) |
-        ((data[1] ^ data[3] ^ data[5] ^ data[7] ^ data[25] ^ data[31]) << 8);
-    memmove(data, data + 2, 30);
-    data[30] = acc & 0xff;
-    data[31] = acc >> 8;
+    uint64_t f = w[0] ^ (w[0] >> 32);
+    f = (f ^ (f >> 16) ^ w[3] ^ (w[3] >> 48)) & 0xffff;
+    w[0] = (w[0] >> 16) | (w[1] << 48);
+    w[1] = (w[1] >> 16) | (w[2] << 48);
+    w[2] = (w[2] >> 16) | (w[3] << 48);
+    w[3] = (w[3] >> 16) | (f << 48);
+}
+
+/*
+ * psi is linear over 16-bit words, so its powers are fixed xor networks.
+ * Row i of a table holds the output lanes which input word i is xored
+ * into; psi_pow applies such a network in one pass instead of iterating
+ * psi.
+ */
+static const uint64_t psi13[16][4] = {
+    {0xffff000000000000ULL, 0x0000ffffffffffffULL, 0xffffffff0000ffffULL, 0x0000ffff00000000ULL},
+    {0xffff000000000000ULL, 0xffff000000000000ULL, 0x0000ffffffffffffULL, 0xffffffff0000ffffULL},
+    {0xffff000000000000ULL, 0x0000ffffffff0000ULL, 0x00000000ffff0000ULL, 0xffffffffffff0000ULL},
+    {0xffff000000000000ULL, 0xffff0000ffff0000ULL, 0xffff00000000ffffULL, 0xffff000000000000ULL},
+    {0x0000000000000000ULL, 0x0000ffff0000ffffULL, 0x00000000ffffffffULL, 0x000000000000ffffULL},
+    {0x0000000000000000ULL, 0xffff0000ffff0000ULL, 0x0000ffffffff0000ULL, 0x00000000ffff0000ULL},
+    {0x0000000000000000ULL, 0x0000ffff00000000ULL, 0xffffffff0000ffffULL, 0x0000ffff00000000ULL},
+    {0x0000000000000000ULL, 0xffff000000000000ULL, 0xffff0000ffff0000ULL, 0xffff00000000ffffULL},
+    {0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000ffff0000ffffULL, 0x00000000ffffffffULL},
+    {0x0000000000000000ULL, 0x0000000000000000ULL, 0xffff0000ffff0000ULL, 0x0000ffffffff0000ULL},
+    {0x0000000000000000ULL, 0x0000000000000000ULL, 0x0000ffff00000000ULL, 0xffffffff0000ffffULL},
+    {0x0000000000000000ULL, 0x0000000000000000ULL, 0xffff000000000000ULL, 0xffff0000ffff0000ULL},
+    {0xffff000000000000ULL, 0x0000ffffffffffffULL, 0xffffffff0000ffffULL, 0x000000000000ffffULL},
+    {0x000000000000ffffULL, 0xffffffffffffffffULL, 0xffff0000ffff0000ULL, 0x00000000ffffffffULL},
+    {0x00000000ffff0000ULL, 0xffffffffffff0000ULL, 0x0000ffff0000ffffULL, 0x0000ffffffffffffULL},
+    {0xffffffff00000000ULL, 0xffff0000ffffffffULL, 0x0000ffffffff0000ULL, 0xffff0000ffff0000ULL},
+};
+
+static const uint64_t psi61[16][4] = {
+    {0xffff0000ffff0000ULL, 0xffff0000ffffffffULL, 0xffff000000000000ULL, 0x0000ffff0000ffffULL},
+    {0xffffffffffffffffULL, 0xffffffff00000000ULL, 0xffff00000000ffffULL, 0xffffffffffff0000ULL},
+    {0x0000ffff00000000ULL, 0x00000000ffff0000ULL, 0xffff0000ffffffffULL, 0xffff000000000000ULL},
+    {0x00000000ffffffffULL, 0xffffffffffffffffULL, 0xffffffffffff0000ULL, 0x0000ffff00000000ULL},
+    {0x0000ffffffff0000ULL, 0xffffffffffff0000ULL, 0xffffffff0000ffffULL, 0xffff00000000ffffULL},
+    {0xffffffff00000000ULL, 0xffffffff00000000ULL, 0xffff0000ffffffffULL, 0x00000000ffffffffULL},
+    {0xffff000000000000ULL, 0xffff00000000ffffULL, 0x0000ffffffffffffULL, 0x0000ffffffffffffULL},
+    {0x000000000000ffffULL, 0x00000000ffffffffULL, 0xffffffffffffffffULL, 0xffffffffffff0000ULL},
+    {0x00000000ffff0000ULL, 0x0000ffffffff0000ULL, 0xffffffffffff0000ULL, 0xffffffff0000ffffULL},
+    {0x0000ffff00000000ULL, 0xffffffff00000000ULL, 0xffffffff00000000ULL, 0xffff0000ffffffffULL},
+    {0xffff00000000ffffULL, 0xffff000000000000ULL, 0xffff00000000ffffULL, 0x0000ffffffffffffULL},
+    {0x00000000ffffffffULL, 0x000000000000ffffULL, 0x00000000ffffffffULL, 0xffffffffffffffffULL},
+    {0xffffffff00000000ULL, 0xffff00000000ffffULL, 0xffffffffffff0000ULL, 0xffff0000ffffffffULL},
+    {0xffff00000000ffffULL, 0x00000000ffffffffULL, 0xffffffff0000ffffULL, 0x0000ffffffffffffULL},
+    {0x00000000ffffffffULL, 0x0000ffffffffffffULL, 0xffff0000ffff0000ULL, 0xffffffffffffffffULL},
+    {0xffffffff0000ffffULL, 0x0000ffff0000ffffULL, 0xffffffff00000000ULL, 0xffff0000ffff0000ULL},
+};
+
+static void psi_pow(const uint64_t net[16][4], uint64_t * w)
+{
+    uint64_t r0 = 0, r1 = 0, r2 = 0, r3 = 0, b;
+    int i;
+    for (i = 0; i < 16; i++) {
+        b = ((w[i >> 2] >> (16 * (i & 3))) & 0xffff) * 0x0001000100010001ULL;
+        r0 ^= b & net[i][0];
+        r1 ^= b & net[i][1];
+        r2 ^= b & net[i][2];
+        r3 ^= b & net[i][3];
+    }
+    w[0] = r0;
+    w[1] = r1;
+    w[2] = r2;
+    w[3] = r3;
 }
 
 /* Adds blocks of N bytes modulo 2**(8*n). Returns carry*/
@@ -73,92 +173,207 @@ static int add_blocks(int n, byte * left, const byte * right)
     return carry;
 }
 
-/* Xor two sequences of bytes */
-static void xor_blocks(byte * result, const byte * a, const byte * b,
-                       size_t len)
+/* Widest gost_enc_with_keys, 4 hash steps */
+#define MAX_STEPS 4
+
+/* Message parts of the four keys of a step: P of M, A^2(M), A^4(M), A^6(M) */
+static void message_keys(u4 v[4][8], const uint64_t * m)
 {
-    size_t i;
-    for (i = 0; i < len; i++)
-        result[i] = a[i] ^ b[i];
+    int j, i;
+    set_key(v[0], 1, 0, m);
+    for (j = 1; j < 4; j++)
+        for (i = 0; i < 8; i++)
+            v[j][i] = circle_xor8_key(circle_xor8_key(v[j - 1][i]));
 }
 
 /*
- *      Calculate H(i+1) = Hash(Hi,Mi)
- *      Where H and M are 32 bytes long
+ * Derives the four keys of step H, M from H and message_keys of M as
+ * lanes 4 * c .. 4 * c + 3
  */
+static void step_keys_v(u4 * key, int width, int c, const uint64_t * h,
+                        const u4 v[4][8])
+{
+    u4 u[8];
+    int i, j;
+    set_key(u, 1, 0, h);
+    for (j = 0; j < 4; j++) {
+        for (i = 0; i < 8; i++) {
+            if (j)
+                u[i] = circle_xor8_key(u[i]);
+            /* Third key takes the C3 constant, fourth one carries it */
+            if (j == 2)
+                u[i] ^= hash_c3[i];
+            key[width * i + 4 * c + j] = u[i] ^ v[j][i];
+        }
+    }
+}
+
+/* Derives the four keys of step H, M as lanes 4 * c .. 4 * c + 3 */
+static void step_keys(u4 * key, int width, int c, const uint64_t * h,
+                      const uint64_t * m)
+{
+    u4 v[4][8];
+    message_keys(v, m);
+    step_keys_v(key, width, c, h, v);
+}
+
+/*
+ *      Calculate H(i+1) = Hash(Hi,Mi) for n <= width / 4 independent
+ *      steps, H[c] and M[c] being 32 bytes long. Block j of H[c] is
+ *      encrypted with key j of step c, all in one gost_enc_with_keys
+ */
+static void hash_steps(const gost_kbox * k, int width, byte * const *H,
+                       const byte * const *M, int n)
+{
+    uint64_t h[MAX_STEPS][4], m[MAX_STEPS][4], s[4];
+    u4 key[32 * MAX_STEPS];
+    byte in[32 * MAX_STEPS], S[32 * MAX_STEPS];
+    int c, i;
+    for (c = 0; c < n; c++) {
+        load_block(h[c], H[c]);
+        load_block(m[c], M[c]);
+        step_keys(key, width, c, h[c], m[c]);
+        memcpy(in + 32 * c, H[c], 32);
+    }
+    /* Unused lanes are encrypted too, their output is dropped */
+    for (; c < width / 4; c++) {
+        for (i = 0; i < 8; i++)
+            memset(key + width * i + 4 * c, 0, 4 * sizeof(u4));
+        memset(in + 32 * c, 0, 32);
+    }
+    gost_enc_with_keys(k, width, key, in, S);
+    for (c = 0; c < n; c++) {
+        /*
+         * H(i+1) = psi^61(H ^ psi(M ^ psi^12(S))), which is computed as
+         * psi^61(H ^ psi(M) ^ psi^13(S)) to need a single pass per network.
+         */
+        load_block(s, S + 32 * c);
+        psi_pow(psi13, s);
+        psi(m[c]);
+        for (i = 0; i < 4; i++)
+            s[i] ^= m[c][i] ^ h[c][i];
+        psi_pow(psi61, s);
+        for (i = 0; i < 4; i++)
+            store64(H[c] + 8 * i, s[i]);
+    }
+}
+
 static int hash_step(gost_ctx * c, byte * H, const byte * M)
 {
-    byte U[32], W[32], V[32], S[32], Key[32];
-    int i;
-    /* Compute first key */
-    xor_blocks(W, H, M, 32);
-    swap_bytes(W, Key);
-    /* Encrypt first 8 bytes of H with first key */
-    gost_enc_with_key(c, Key, H, S);
-    /* Compute second key */
-    circle_xor8(H, U);
-    circle_xor8(M, V);
-    circle_xor8(V, V);
-    xor_blocks(W, U, V, 32);
-    swap_bytes(W, Key);
-    /* encrypt second 8 bytes of H with second key */
-    gost_enc_with_key(c, Key, H + 8, S + 8);
-    /* compute third key */
-    circle_xor8(U, U);
-    U[31] = ~U[31];
-    U[29] = ~U[29];
-    U[28] = ~U[28];
-    U[24] = ~U[24];
-    U[23] = ~U[23];
-    U[20] = ~U[20];
-    U[18] = ~U[18];
-    U[17] = ~U[17];
-    U[14] = ~U[14];
-    U[12] = ~U[12];
-    U[10] = ~U[10];
-    U[8] = ~U[8];
-    U[7] = ~U[7];
-    U[5] = ~U[5];
-    U[3] = ~U[3];
-    U[1] = ~U[1];
-    circle_xor8(V, V);
-    circle_xor8(V, V);
-    xor_blocks(W, U, V, 32);
-    swap_bytes(W, Key);
-    /* encrypt third 8 bytes of H with third key */
-    gost_enc_with_key(c, Key, H + 16, S + 16);
-    /* Compute fourth key */
-    circle_xor8(U, U);
-    circle_xor8(V, V);
-    circle_xor8(V, V);
-    xor_blocks(W, U, V, 32);
-    swap_bytes(W, Key);
-    /* Encrypt last 8 bytes with fourth key */
-    gost_enc_with_key(c, Key, H + 24, S + 24);
-    for (i = 0; i < 12; i++)
-        transform_3(S);
-    xor_blocks(S, S, M, 32);
-    transform_3(S);
-    xor_blocks(S, S, H, 32);
-    for (i = 0; i < 61; i++)
-        transform_3(S);
-    memcpy(H, S, 32);
+    hash_steps(c->kbox, 4, &H, &M, 1);
     return 1;
 }
 
+/*
+ * Length block of a 32 byte message, 256 in bits: its message_keys and
+ * psi
+ */
+static const u4 len32_keys[4][8] = {
+    {0, 0x00000001, 0, 0, 0, 0, 0, 0},
+    {0, 0x00010000, 0, 0, 0, 0, 0, 0},
+    {0, 0x01000001, 0, 0, 0, 0, 0, 0},
+    {0, 0x00010100, 0, 0, 0, 0, 0, 0}
+};
+
+static const uint64_t len32_psi[4] = { 0, 0, 0, 0x0100000000000000ULL };
+
+/* H = Hash(H, M) on words, given message_keys and psi of M */
+static void hash_step_words(const gost_kbox * k, uint64_t * h,
+                            const u4 v[4][8], const uint64_t * pm)
+{
+    u4 key[32];
+    byte in[32], S[32];
+    uint64_t s[4];
+    int i;
+    step_keys_v(key, 4, 0, h, v);
+    for (i = 0; i < 4; i++)
+        store64(in + 8 * i, h[i]);
+    gost_enc_with_keys4(k, key, in, S);
+    load_block(s, S);
+    psi_pow(psi13, s);
+    for (i = 0; i < 4; i++)
+        s[i] ^= pm[i] ^ h[i];
+    psi_pow(psi61, s);
+    memcpy(h, s, sizeof(s));
+}
+
+/*
+ * A 32 byte message takes three steps: the message itself, its length
+ * and the control sum, which is the message again. Its keys and psi are
+ * derived once for both of its steps
+ */
+void hash32(const gost_kbox * k, const byte * block, byte * hashval)
+{
+    uint64_t h[4] = { 0, 0, 0, 0 }, m[4];
+    u4 v[4][8];
+    int i;
+    load_block(m, block);
+    message_keys(v, m);
+    psi(m);
+    hash_step_words(k, h, v, m);
+    hash_step_words(k, h, len32_keys, len32_psi);
+    hash_step_words(k, h, v, m);
+    for (i = 0; i < 4; i++)
+        store64(hashval + 8 * i, h[i]);
+}
+
+/* Next message block of stream i, NULL when it has none */
+typedef const byte *(*next_block_fn) (void *arg, int i);
+
+/*
+ * Hashes streams 0 .. n-1 into H[i] until next_block runs out of blocks.
+ * Streams with the same s-boxes share hash_steps, a stream taking the lane
+ * of one which has finished. taken is scratch space of n bytes
+ */
+static void hash_lanes(gost_hash_ctx * const *ctx, byte * const *H, int n,
+                       next_block_fn next_block, void *arg, char *taken)
+{
+    int width = gost_keys_width(), per = width / 4, first, i, j, c, cnt;
+    byte *gh[MAX_STEPS];
+    const byte *gm[MAX_STEPS];
+    int lane[MAX_STEPS];
+    const gost_kbox *kbox;
+    memset(taken, 0, n);
+    for (first = 0; first < n; first++) {
+        if (taken[first])
+            continue;
+        kbox = ctx[first]->cipher_ctx->kbox;
+        for (j = first, cnt = 0;;) {
+            for (; cnt < per && j < n; j++) {
+                if (taken[j] || ctx[j]->cipher_ctx->kbox != kbox)
+                    continue;
+                taken[j] = 1;
+                if ((gm[cnt] = next_block(arg, j)) != NULL) {
+                    lane[cnt] = j;
+                    gh[cnt++] = H[j];
+                }
+            }
+            if (!cnt)
+                break;
+            hash_steps(kbox, width, gh, gm, cnt);
+            for (i = 0, c = 0; i < cnt; i++) {
+                if ((gm[c] = next_block(arg, lane[i])) != NULL) {
+                    lane[c] = lane[i];
+                    gh[c++] = gh[i];
+                }
+            }
+            cnt = c;
+        }
+    }
+}
+
 /*
  * Initialize gost_hash ctx - cleans up temporary structures and set up
- * substitution blocks
+ * preprocessed substitution blocks
  */
-int init_gost_hash_ctx(gost_hash_ctx * ctx,
-                       const gost_subst_block * subst_block)
+int init_gost_hash_ctx(gost_hash_ctx * ctx, const gost_kbox * kbox)
 {
     memset(ctx, 0, sizeof(*ctx));
     ctx->cipher_ctx = (gost_ctx *) MYALLOC(sizeof(gost_ctx));
     if (!ctx->cipher_ctx) {
         return 0;
     }
-    gost_init(ctx->cipher_ctx, subst_block);
+    gost_init(ctx->cipher_ctx, kbox);
     return 1;
 }
 
@@ -232,38 +447,187 @@ int hash_block(gost_hash_ctx * ctx, const byte * block, size_t length)
     return 1;
 }
 
+struct block_streams {
+    gost_hash_ctx *const *ctx;
+    const byte **in;
+    size_t *left;
+};
+
+/* Takes the next full block of hash_block_multi input i into S */
+static const byte *next_input_block(void *arg, int i)
+{
+    struct block_streams *b = (struct block_streams *)arg;
+    gost_hash_ctx *ctx = b->ctx[i];
+    const byte *M;
+    if (ctx->left == 32) {
+        M = ctx->remainder;
+        ctx->left = 0;
+    } else if (b->left[i] >= 32) {
+        M = b->in[i];
+        b->in[i] += 32;
+        b->left[i] -= 32;
+    } else
+        return NULL;
+    add_blocks(32, ctx->S, M);
+    ctx->len += 32;
+    return M;
+}
+
 /*
- * Compute hash value from current state of ctx
- * state of hash ctx becomes invalid and cannot be used for further
- * hashing.
+ * Same as hash_block(ctx[i], block[i], length[i]) for every i < n, but
+ * steps of different messages share lane encryptions
  */
-int finish_hash(gost_hash_ctx * ctx, byte * hashval)
+int hash_block_multi(gost_hash_ctx * const *ctx, const byte * const *block,
+                     const size_t *length, int n)
+{
+    struct block_streams b;
+    byte **H;
+    int i;
+    if (n <= 0)
+        return 1;
+    H = (byte **) MYALLOC(n * (2 * sizeof(void *) + sizeof(size_t) + 1));
+    if (!H)
+        return 0;
+    b.ctx = ctx;
+    b.in = (const byte **)(H + n);
+    b.left = (size_t *)(b.in + n);
+    for (i = 0; i < n; i++) {
+        H[i] = ctx[i]->H;
+        b.in[i] = block[i];
+        b.left[i] = length[i];
+        if (ctx[i]->left) {
+            /* Complete the block left from the previous call first */
+            size_t add_bytes = 32 - ctx[i]->left;
+            if (add_bytes > b.left[i])
+                add_bytes = b.left[i];
+            memcpy(&(ctx[i]->remainder[ctx[i]->left]), b.in[i], add_bytes);
+            ctx[i]->left += add_bytes;
+            b.in[i] += add_bytes;
+            b.left[i] -= add_bytes;
+        }
+    }
+    hash_lanes(ctx, H, n, next_input_block, &b, (char *)(b.left + n));
+    for (i = 0; i < n; i++) {
+        if (b.left[i])
+            memcpy(ctx[i]->remainder, b.in[i], ctx[i]->left = b.left[i]);
+    }
+    MYFREE(H);
+    return 1;
+}
+
+/*
+ * Fills the message blocks of the closing steps of ctx: partial block,
+ * length in bits and control sum. Returns their number
+ */
+static int final_blocks(const gost_hash_ctx * ctx, byte M[3][32])
 {
-    byte buf[32];
-    byte H[32];
-    byte S[32];
     ghosthash_len fin_len = ctx->len;
+    byte S[32];
     byte *bptr;
-    memcpy(H, ctx->H, 32);
+    int steps = 0;
     memcpy(S, ctx->S, 32);
     if (ctx->left) {
-        memset(buf, 0, 32);
-        memcpy(buf, ctx->remainder, ctx->left);
-        hash_step(ctx->cipher_ctx, H, buf);
-        add_blocks(32, S, buf);
+        memset(M[steps], 0, 32);
+        memcpy(M[steps], ctx->remainder, ctx->left);
+        add_blocks(32, S, M[steps]);
         fin_len += ctx->left;
+        steps++;
     }
-    memset(buf, 0, 32);
+    memset(M[steps], 0, 32);
     if (fin_len == 0)
-        hash_step(ctx->cipher_ctx, H, buf);
-    bptr = buf;
+        memset(M[++steps], 0, 32);
+    bptr = M[steps++];
     fin_len <<= 3;              /* Hash length in BITS!! */
     while (fin_len > 0) {
         *(bptr++) = (byte) (fin_len & 0xFF);
         fin_len >>= 8;
     };
-    hash_step(ctx->cipher_ctx, H, buf);
-    hash_step(ctx->cipher_ctx, H, S);
+    memcpy(M[steps], S, 32);
+    return steps + 1;
+}
+
+/*
+ * Compute hash value from current state of ctx
+ * state of hash ctx becomes invalid and cannot be used for further
+ * hashing.
+ */
+int finish_hash(gost_hash_ctx * ctx, byte * hashval)
+{
+    byte M[3][32];
+    byte H[32];
+    int i, steps = final_blocks(ctx, M);
+    memcpy(H, ctx->H, 32);
+    for (i = 0; i < steps; i++)
+        hash_step(ctx->cipher_ctx, H, M[i]);
     memcpy(hashval, H, 32);
     return 1;
 }
+
+struct final_state {
+    byte H[32];
+    byte M[3][32];
+    int steps;
+    int done;
+};
+
+static const byte *next_final_block(void *arg, int i)
+{
+    struct final_state *f = (struct final_state *)arg + i;
+    return f->done < f->steps ? f->M[f->done++] : NULL;
+}
+
+/* Same as finish_hash(ctx[i], hashval[i]) for every i < n */
+int finish_hash_multi(gost_hash_ctx * const *ctx, byte * const *hashval,
+                      int n)
+{
+    struct final_state *f;
+    byte **H;
+    int i;
+    if (n <= 0)
+        return 1;
+    f = (struct final_state *)MYALLOC(n * (sizeof(*f) + sizeof(void *) + 1));
+    if (!f)
+        return 0;
+    H = (byte **) (f + n);
+    for (i = 0; i < n; i++) {
+        memcpy(f[i].H, ctx[i]->H, 32);
+        f[i].steps = final_blocks(ctx[i], f[i].M);
+        f[i].done = 0;
+        H[i] = f[i].H;
+    }
+    hash_lanes(ctx, H, n, next_final_block, f, (char *)(H + n));
+    for (i = 0; i < n; i++)
+        memcpy(hashval[i], f[i].H, 32);
+    MYFREE(f);
+    return 1;
+}
+
+void hash_export(const gost_hash_ctx * ctx, byte * out)
+{
+    memset(out, 0, GOST_HASH_STATE_SIZE);
+    out[0] = GOST_HASH_STATE_VERSION;
+    out[1] = (byte) ctx->left;
+    store64(out + 2, (uint64_t) ctx->len);
+    memcpy(out + 10, ctx->H, 32);
+    memcpy(out + 42, ctx->S, 32);
+    memcpy(out + 74, ctx->remainder, ctx->left);
+}
+
+int hash_import(gost_hash_ctx * ctx, const byte * in, size_t in_len)
+{
+    uint64_t len;
+    if (!in || in_len != GOST_HASH_STATE_SIZE
+        || in[0] != GOST_HASH_STATE_VERSION || in[1] >= 32)
+        return 0;
+    len = load64(in + 2);
+    /* Whole blocks only, and the length in bits must fit finish_hash */
+    if (len % 32 || len >> 59)
+        return 0;
+    ctx->len = (ghosthash_len) len;
+    ctx->left = in[1];
+    memcpy(ctx->H, in + 10, 32);
+    memcpy(ctx->S, in + 42, 32);
+    memset(ctx->remainder, 0, 32);
+    memcpy(ctx->remainder, in + 74, ctx->left);
+    return 1;
+}
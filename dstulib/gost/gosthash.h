@@ -30,8 +30,7 @@ typedef struct gost_hash_ctx {
 
 /* Initalizes gost hash ctx, including creation of gost cipher ctx */
 
-int init_gost_hash_ctx(gost_hash_ctx * ctx,
-                       const gost_subst_block * subst_block);
+int init_gost_hash_ctx(gost_hash_ctx * ctx, const gost_kbox * kbox);
 void done_gost_hash_ctx(gost_hash_ctx * ctx);
 
 /*
@@ -49,4 +48,44 @@ int hash_block(gost_hash_ctx * ctx, const byte * block, size_t length);
  */
 int finish_hash(gost_hash_ctx * ctx, byte * hashval);
 
+/*
+ * Hash of exactly 32 bytes of block, same as hash_block and finish_hash on
+ * a fresh context with s-boxes k, without one
+ */
+void hash32(const gost_kbox * k, const byte * block, byte * hashval);
+
+/*
+ * Multi-buffer versions: same as hash_block(ctx[i], block[i], length[i])
+ * and finish_hash(ctx[i], hashval[i]) for every i < n, but contexts move
+ * on in lockstep, and steps of contexts with the same s-boxes share lane
+ * encryptions. Messages may have any lengths, a context may appear only
+ * once
+ */
+int hash_block_multi(gost_hash_ctx * const *ctx, const byte * const *block,
+                     const size_t *length, int n);
+int finish_hash_multi(gost_hash_ctx * const *ctx, byte * const *hashval,
+                      int n);
+
+/*
+ * Serialized hash state (midstate), integers are little-endian:
+ *   0        format version, GOST_HASH_STATE_VERSION
+ *   1        number of buffered bytes, 0 to 31
+ *   2..9     number of bytes hashed in full blocks
+ *   10..41   H
+ *   42..73   S (control sum)
+ *   74..105  buffered bytes, padded with zeros
+ * S-boxes are not part of the state, a state must be imported into a
+ * context using the same ones it was exported from
+ */
+# define GOST_HASH_STATE_VERSION 1
+# define GOST_HASH_STATE_SIZE 106
+
+/* Writes GOST_HASH_STATE_SIZE bytes of ctx state to out */
+void hash_export(const gost_hash_ctx * ctx, byte * out);
+/*
+ * Replaces state of ctx (but not its cipher ctx) with the one in, returns
+ * 0 and leaves ctx alone if in is not a valid state of in_len bytes
+ */
+int hash_import(gost_hash_ctx * ctx, const byte * in, size_t in_len);
+
 #endif
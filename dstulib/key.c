@@ -392,11 +392,12 @@ DSTU_KEY *key_from_asn1(const DSTU_AlgorithmParameters *params,
 
     if (DSTU_STANDARD_CURVE == params->curve->type)
     {
-        group = group_from_nid(OBJ_obj2nid(params->curve->curve.named_curve));
-        if (!group)
+        /* Shared group, EC_KEY_set_group makes its own copy */
+        const EC_GROUP *named = named_curve_group_by_nid(OBJ_obj2nid(params->curve->curve.named_curve));
+        if (!named)
             goto err;
 
-        if (!EC_KEY_set_group(key->ec, group))
+        if (!EC_KEY_set_group(key->ec, named))
             goto err;
     }
     else
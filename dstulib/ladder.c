@@ -0,0 +1,225 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+#include "ladder.h"
+#include "gf2m.h"
+
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <openssl/obj_mac.h>
+
+/*
+ * Formulas below are from J. Lopez, R. Dahab, "Fast multiplication on elliptic curves over GF(2^m)
+ * without precomputation", same as OpenSSL ladder uses. Points are (X, Z) with x = X / Z
+ */
+
+/* (X1, Z1) += (X2, Z2), x being the affine x of their difference */
+static void ld_madd(const DSTU_GF2M_FIELD *f, const gf2m_elem x, gf2m_elem X1, gf2m_elem Z1,
+                    const gf2m_elem X2, const gf2m_elem Z2)
+{
+    gf2m_elem t1, t2;
+
+    /* Z1 = (X1 * Z2 + X2 * Z1)^2, X1 = x * Z1 + X1 * Z2 * X2 * Z1 */
+    gf2m_mul(f, t1, X1, Z2);
+    gf2m_mul(f, t2, X2, Z1);
+    gf2m_add(f, Z1, t1, t2);
+    gf2m_sqr(f, Z1, Z1);
+    gf2m_mul(f, t1, t1, t2);
+    gf2m_mul(f, X1, x, Z1);
+    gf2m_add(f, X1, X1, t1);
+}
+
+/* (X, Z) = 2 * (X, Z) */
+static void ld_mdouble(const DSTU_GF2M_FIELD *f, const gf2m_elem b, gf2m_elem X, gf2m_elem Z)
+{
+    gf2m_elem t;
+
+    /* Z = X^2 * Z^2, X = X^4 + b * Z^4 */
+    gf2m_sqr(f, X, X);
+    gf2m_sqr(f, t, Z);
+    gf2m_mul(f, Z, X, t);
+    gf2m_sqr(f, X, X);
+    gf2m_sqr(f, t, t);
+    gf2m_mul(f, t, t, b);
+    gf2m_add(f, X, X, t);
+}
+
+/*
+ * Affine (xr, yr) of (X1, Z1) = kP, given P = (x, y) and (X2, Z2) = (k + 1)P.
+ * Neither of them may be infinity and x must not be zero
+ */
+static void ld_mxy(const DSTU_GF2M_FIELD *f, const gf2m_elem x, const gf2m_elem y,
+                   const gf2m_elem X1, const gf2m_elem Z1, const gf2m_elem X2, const gf2m_elem Z2,
+                   gf2m_elem xr, gf2m_elem yr)
+{
+    gf2m_elem A, B, C, D, E;
+
+    /* D = Z1 * Z2, A = X1 + x * Z1, B = (X2 + x * Z2) * A, C = X1 * x * Z2 */
+    gf2m_mul(f, D, Z1, Z2);
+    gf2m_mul(f, A, x, Z1);
+    gf2m_add(f, A, A, X1);
+    gf2m_mul(f, B, x, Z2);
+    gf2m_mul(f, C, B, X1);
+    gf2m_add(f, B, B, X2);
+    gf2m_mul(f, B, B, A);
+
+    /* E = ((x^2 + y) * D + B) / (x * D), xr = C / (x * D), yr = (xr + x) * E + y */
+    gf2m_sqr(f, E, x);
+    gf2m_add(f, E, E, y);
+    gf2m_mul(f, E, E, D);
+    gf2m_add(f, E, E, B);
+    gf2m_mul(f, D, D, x);
+    gf2m_inv(f, D, D);
+    gf2m_mul(f, E, E, D);
+    gf2m_mul(f, xr, C, D);
+    gf2m_add(f, yr, xr, x);
+    gf2m_mul(f, yr, yr, E);
+    gf2m_add(f, yr, yr, y);
+}
+
+int dstu_scalar_pad(BIGNUM *kk, const BIGNUM *k, const BIGNUM *n, BN_CTX *ctx)
+{
+    BIGNUM *t;
+    int bits = BN_num_bits(n), words = (bits + 1) / BN_BITS2 + 1, ret = 0;
+
+    BN_CTX_start(ctx);
+    t = BN_CTX_get(ctx);
+    if (!t)
+        goto err;
+
+    /* Setting and clearing the top bit leaves room for k + 2n, so that BN_add does not resize either */
+    if (!BN_set_bit(kk, words * BN_BITS2 - 1) || !BN_clear_bit(kk, words * BN_BITS2 - 1)
+            || !BN_set_bit(t, words * BN_BITS2 - 1) || !BN_clear_bit(t, words * BN_BITS2 - 1))
+        goto err;
+
+    if (!BN_add(kk, k, n) || !BN_add(t, kk, n))
+        goto err;
+    BN_consttime_swap((BN_ULONG) !BN_is_bit_set(kk, bits), kk, t, words);
+
+    ret = 1;
+
+    err:
+
+    if (t)
+        BN_clear(t);
+    BN_CTX_end(ctx);
+    return ret;
+}
+
+static int ladder_mul(const EC_GROUP *group, EC_POINT *r, const EC_POINT *point, const BIGNUM *k, BN_CTX *ctx,
+                      int *fallback)
+{
+    const DSTU_GF2M_FIELD *f;
+    BIGNUM *p, *b, *x, *y, *card, *kk;
+    gf2m_elem ex, ey, eb, X1, Z1, X2, Z2;
+    int i, ret = 0;
+    gf2m_word bit;
+
+    *fallback = 1;
+
+    BN_CTX_start(ctx);
+    p = BN_CTX_get(ctx);
+    b = BN_CTX_get(ctx);
+    x = BN_CTX_get(ctx);
+    y = BN_CTX_get(ctx);
+    card = BN_CTX_get(ctx);
+    kk = BN_CTX_get(ctx);
+    if (!kk)
+        goto err;
+
+    if (!EC_GROUP_get_curve_GF2m(group, p, NULL, b, ctx))
+        goto err;
+
+    f = gf2m_field(p);
+    if (!f)
+        goto err;
+
+    /* Scalars are taken modulo the number of curve points, as any point is fine here */
+    if (!EC_GROUP_get_order(group, card, ctx) || !EC_GROUP_get_cofactor(group, x, ctx) || BN_is_zero(x)
+            || !BN_mul(card, card, x, ctx))
+        goto err;
+    if (BN_is_zero(k) || BN_is_negative(k) || (BN_cmp(k, card) >= 0))
+        goto err;
+
+    if (EC_POINT_is_at_infinity(group, point)
+            || !EC_POINT_get_affine_coordinates_GF2m(group, point, x, y, ctx))
+        goto err;
+    if (BN_is_zero(x) || !gf2m_from_bn(f, ex, x) || !gf2m_from_bn(f, ey, y) || !gf2m_from_bn(f, eb, b))
+        goto err;
+
+    /* Same as in dstu_generator_mul: padded to one bit more than card */
+    if (!dstu_scalar_pad(kk, k, card, ctx))
+        goto err;
+
+    /* (X1, Z1) = P, (X2, Z2) = 2P for the top bit, then (X2, Z2) - (X1, Z1) stays P */
+    gf2m_copy(X1, ex);
+    gf2m_one(Z1);
+    gf2m_sqr(f, Z2, ex);
+    gf2m_sqr(f, X2, Z2);
+    gf2m_add(f, X2, X2, eb);
+
+    for (i = BN_num_bits(card) - 1; i >= 0; i--)
+    {
+        /* Bit 1 adds into (X1, Z1) and doubles (X2, Z2), bit 0 the other way round */
+        bit = (gf2m_word) BN_is_bit_set(kk, i);
+        gf2m_cswap(f, bit, X1, X2);
+        gf2m_cswap(f, bit, Z1, Z2);
+        ld_madd(f, ex, X2, Z2, X1, Z1);
+        ld_mdouble(f, eb, X1, Z1);
+        gf2m_cswap(f, bit, X1, X2);
+        gf2m_cswap(f, bit, Z1, Z2);
+    }
+
+    /* kP or (k + 1)P is infinity, which a valid scalar gives with negligible probability */
+    if (gf2m_is_zero(f, Z1) || gf2m_is_zero(f, Z2))
+        goto err;
+
+    *fallback = 0;
+
+    ld_mxy(f, ex, ey, X1, Z1, X2, Z2, X1, Z1);
+    if (!gf2m_to_bn(f, x, X1) || !gf2m_to_bn(f, y, Z1))
+        goto err;
+
+    ret = EC_POINT_set_affine_coordinates_GF2m(group, r, x, y, ctx);
+
+    err:
+
+    OPENSSL_cleanse(X1, sizeof(X1));
+    OPENSSL_cleanse(Z1, sizeof(Z1));
+    OPENSSL_cleanse(X2, sizeof(X2));
+    OPENSSL_cleanse(Z2, sizeof(Z2));
+    BN_clear(kk);
+    BN_CTX_end(ctx);
+    return ret;
+}
+
+int dstu_ladder_mul(const EC_GROUP *group, EC_POINT *r, const EC_POINT *point, const BIGNUM *k, BN_CTX *ctx)
+{
+    int fallback;
+
+    return ladder_mul(group, r, point, k, ctx, &fallback);
+}
+
+int dstu_point_mul(const EC_GROUP *group, EC_POINT *r, const EC_POINT *point, const BIGNUM *k, BN_CTX *ctx)
+{
+    BN_CTX *new_ctx = NULL;
+    int ret, fallback;
+
+    if (NID_X9_62_characteristic_two_field != EC_METHOD_get_field_type(EC_GROUP_method_of(group)))
+        return EC_POINT_mul(group, r, NULL, point, k, ctx);
+
+    if (!ctx)
+    {
+        ctx = new_ctx = BN_CTX_new();
+        if (!ctx)
+            return 0;
+    }
+
+    ret = ladder_mul(group, r, point, k, ctx, &fallback);
+    if (fallback)
+        ret = EC_POINT_mul(group, r, NULL, point, k, ctx);
+
+    BN_CTX_free(new_ctx);
+    return ret;
+}
@@ -0,0 +1,28 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+#ifndef DSTU_LADDER_H_
+#define DSTU_LADDER_H_
+
+#include <openssl/ec.h>
+
+/* Variable-base multiplication on curves over DSTU fields.
+ * Montgomery ladder on x and z only in Lopez-Dahab coordinates, y is recovered at the end with
+ * a single inversion. The scalar is padded to a fixed length and every step does the same field
+ * operations, whatever its bits.
+ */
+
+/* r = k * point. Falls back to EC_POINT_mul for other curves and k outside (0, cardinality). ctx may be NULL */
+int dstu_point_mul(const EC_GROUP *group, EC_POINT *r, const EC_POINT *point, const BIGNUM *k, BN_CTX *ctx);
+
+/* Same as dstu_point_mul without the fallback, 0 whenever it would be taken. ctx may not be NULL */
+int dstu_ladder_mul(const EC_GROUP *group, EC_POINT *r, const EC_POINT *point, const BIGNUM *k, BN_CTX *ctx);
+
+/*
+ * kk = k + n or k + 2n, the one with exactly one bit more than n, given k in [0, n). Both sums are
+ * computed into the same number of words and the choice is a BN_consttime_swap, as in OpenSSL ladder
+ */
+int dstu_scalar_pad(BIGNUM *kk, const BIGNUM *k, const BIGNUM *n, BN_CTX *ctx);
+
+#endif /* DSTU_LADDER_H_ */
@@ -0,0 +1,121 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+#include "parallel.h"
+
+#if defined(_WIN32)
+#define DSTU_NO_THREADS
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include <openssl/crypto.h>
+
+/* Upper limit for the default number of threads */
+#define DSTU_PARALLEL_MAX_THREADS 64
+
+static int threads_override = 0;
+
+struct parallel_job
+{
+    dstu_parallel_fn fn;
+    void *arg;
+    int index;
+};
+
+#ifndef DSTU_NO_THREADS
+static void *parallel_thread(void *data)
+{
+    struct parallel_job *job = data;
+
+    job->fn(job->arg, job->index);
+    return NULL;
+}
+#endif
+
+void dstu_parallel_run(int n, dstu_parallel_fn fn, void *arg)
+{
+#ifndef DSTU_NO_THREADS
+    struct parallel_job *jobs = NULL;
+    pthread_t *threads = NULL;
+    char *started = NULL;
+    int i;
+
+    if (n > 1)
+    {
+        jobs = OPENSSL_malloc(n * sizeof(struct parallel_job));
+        threads = OPENSSL_malloc(n * sizeof(pthread_t));
+        started = OPENSSL_zalloc(n);
+    }
+
+    if (!jobs || !threads || !started)
+    {
+        for (i = 0; i < n; i++)
+            fn(arg, i);
+    }
+    else
+    {
+        for (i = 1; i < n; i++)
+        {
+            jobs[i].fn = fn;
+            jobs[i].arg = arg;
+            jobs[i].index = i;
+            started[i] = !pthread_create(&threads[i], NULL, parallel_thread, &jobs[i]);
+        }
+
+        fn(arg, 0);
+
+        for (i = 1; i < n; i++)
+        {
+            if (started[i])
+                pthread_join(threads[i], NULL);
+            else
+                fn(arg, i);
+        }
+    }
+
+    OPENSSL_free(jobs);
+    OPENSSL_free(threads);
+    OPENSSL_free(started);
+#else
+    int i;
+
+    for (i = 0; i < n; i++)
+        fn(arg, i);
+#endif
+}
+
+int dstu_parallel_threads(void)
+{
+    long cpus = 1;
+
+    if (threads_override > 0)
+        return threads_override;
+
+#if !defined(DSTU_NO_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    if (cpus < 1)
+        return 1;
+
+    return cpus > DSTU_PARALLEL_MAX_THREADS ? DSTU_PARALLEL_MAX_THREADS : (int) cpus;
+}
+
+void dstu_parallel_set_threads(int n)
+{
+    threads_override = n > 0 ? n : 0;
+}
+
+int dstu_parallel_threads_for(size_t size)
+{
+    size_t useful = size / DSTU_PARALLEL_MIN_BYTES;
+    int threads = dstu_parallel_threads();
+
+    if (useful < 1)
+        return 1;
+
+    return useful < (size_t) threads ? (int) useful : threads;
+}
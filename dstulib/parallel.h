@@ -0,0 +1,27 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+#ifndef DSTU_PARALLEL_H_
+#define DSTU_PARALLEL_H_
+
+#include <stddef.h>
+
+/* Bulk operations split work between threads only if each one gets at least that much */
+#define DSTU_PARALLEL_MIN_BYTES (256 * 1024)
+
+typedef void (*dstu_parallel_fn)(void *arg, int index);
+
+/* Runs fn(arg, 0) ... fn(arg, n - 1) concurrently and waits for all of them to finish.
+ * Index 0 runs in the calling thread. If a thread cannot be started its index runs in the calling thread too.
+ */
+void dstu_parallel_run(int n, dstu_parallel_fn fn, void *arg);
+
+/* Maximum number of threads a bulk operation may use, number of online CPUs by default */
+int dstu_parallel_threads(void);
+/* Overrides maximum number of threads, 1 disables threading, 0 restores default */
+void dstu_parallel_set_threads(int n);
+/* Number of threads worth using for a bulk operation on size bytes */
+int dstu_parallel_threads_for(size_t size);
+
+#endif /* DSTU_PARALLEL_H_ */
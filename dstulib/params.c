@@ -4,8 +4,10 @@
  ==================================================================== */
 
 #include "params.h"
+#include "fixedbase.h" // dstu_generator_mul
 
 #include <openssl/evp.h>
+#include <openssl/crypto.h> // CRYPTO_ONCE
 
 #include <string.h>
 
@@ -279,51 +281,23 @@ DSTU_NAMED_CURVE dstu_curves[] =
     {NID_uacurve9, {431, 5, 3, 1, 0, -1}, data431}
 };
 
-int curve_nid_from_group(const EC_GROUP *group)
-{
-    int m = EC_GROUP_get_degree(group), i, nid = NID_undef;
-    EC_GROUP* std_group = NULL;
-
-    for (i = 0; i < (sizeof(dstu_curves) / sizeof(DSTU_NAMED_CURVE)); i++)
-    {
-        if (m == dstu_curves[i].poly[0])
-            break;
-    }
-
-    if (i < (sizeof(dstu_curves) / sizeof(DSTU_NAMED_CURVE)))
-    {
-        std_group = group_from_named_curve(i);
-
-        if (std_group)
-        {
-            if (!EC_GROUP_cmp(group, std_group, NULL))
-            nid = dstu_curves[i].nid;
-        }
-    }
-
-    if (std_group)
-        EC_GROUP_free(std_group);
-
-    return nid;
-}
-
 void dstu_get_sbox(gost_ctx *ctx, gost_subst_block *sbox)
 {
     int i;
 
     for (i = 0; i < 256; i++)
     {
-        sbox->k8[i >> 4] = (ctx->k87[i] >> 28) & 0xf;
-        sbox->k7[i & 15] = (ctx->k87[i] >> 24) & 0xf;
+        sbox->k8[i >> 4] = (ctx->kbox->k87[i] >> 28) & 0xf;
+        sbox->k7[i & 15] = (ctx->kbox->k87[i] >> 24) & 0xf;
 
-        sbox->k6[i >> 4] = (ctx->k65[i] >> 20) & 0xf;
-        sbox->k5[i & 15] = (ctx->k65[i] >> 16) & 0xf;
+        sbox->k6[i >> 4] = (ctx->kbox->k65[i] >> 20) & 0xf;
+        sbox->k5[i & 15] = (ctx->kbox->k65[i] >> 16) & 0xf;
 
-        sbox->k4[i >> 4] = (ctx->k43[i] >> 12) & 0xf;
-        sbox->k3[i & 15] = (ctx->k43[i] >> 8) & 0xf;
+        sbox->k4[i >> 4] = (ctx->kbox->k43[i] >> 12) & 0xf;
+        sbox->k3[i & 15] = (ctx->kbox->k43[i] >> 8) & 0xf;
 
-        sbox->k2[i >> 4] = (ctx->k21[i] >> 4) & 0xf;
-        sbox->k1[i & 15] = ctx->k21[i] & 0xf;
+        sbox->k2[i >> 4] = (ctx->kbox->k21[i] >> 4) & 0xf;
+        sbox->k1[i & 15] = ctx->kbox->k21[i] & 0xf;
     }
 
 }
@@ -387,7 +361,7 @@ unsigned char default_sbox[64] =
     0x12, 0x3e, 0x6d, 0xb8, 0xfa, 0xc5, 0x79, 0x04
 };
 
-EC_GROUP *group_from_named_curve(int curve_num)
+static EC_GROUP *build_named_curve(int curve_num)
 {
     int bytesize = ((dstu_curves[curve_num].poly[0]) + 7) / 8;
     BIGNUM *p, *a, *b, *Px, *Py, *N;
@@ -470,19 +444,138 @@ EC_GROUP *group_from_named_curve(int curve_num)
     return ret;
 }
 
-EC_GROUP *group_from_nid(int nid)
+/* Named curves are built once and never change, so every user can share them */
+typedef struct
+{
+    EC_GROUP *group;
+    /* Fingerprint: curve coefficients and parts of the group cheap to get from any other one */
+    BIGNUM *p, *a, *b;
+    const BIGNUM *order;
+    const EC_POINT *generator;
+} DSTU_NAMED_GROUP;
+
+static DSTU_NAMED_GROUP named_groups[DSTU_CURVE_COUNT];
+static CRYPTO_ONCE named_groups_init = CRYPTO_ONCE_STATIC_INIT;
+static int named_groups_ok = 0;
+
+static void do_named_groups_init(void)
 {
     int i;
 
-    for (i = 0; i < (sizeof(dstu_curves) / sizeof(DSTU_NAMED_CURVE)); i++)
+    for (i = 0; i < DSTU_CURVE_COUNT; i++)
+    {
+        named_groups[i].group = build_named_curve(i);
+        named_groups[i].p = BN_new();
+        named_groups[i].a = BN_new();
+        named_groups[i].b = BN_new();
+
+        if (!named_groups[i].group || !named_groups[i].b || !named_groups[i].a || !named_groups[i].p)
+            return;
+
+        if (!EC_GROUP_get_curve_GF2m(named_groups[i].group, named_groups[i].p, named_groups[i].a, named_groups[i].b, NULL))
+            return;
+
+        named_groups[i].order = EC_GROUP_get0_order(named_groups[i].group);
+        named_groups[i].generator = EC_GROUP_get0_generator(named_groups[i].group);
+    }
+
+    named_groups_ok = 1;
+}
+
+static int named_curve_ready(void)
+{
+    return CRYPTO_THREAD_run_once(&named_groups_init, do_named_groups_init) && named_groups_ok;
+}
+
+/* Same as !EC_GROUP_cmp(group, named->group), but compares the cheapest parts first */
+static int group_matches(const EC_GROUP *group, const DSTU_NAMED_GROUP *named)
+{
+    const BIGNUM *order = EC_GROUP_get0_order(group), *cofactor = EC_GROUP_get0_cofactor(group);
+    const EC_POINT *generator = EC_GROUP_get0_generator(group);
+    BN_CTX *ctx = NULL;
+    BIGNUM *p, *a, *b;
+    int ret = 0;
+
+    if (group == named->group)
+        return 1;
+
+    if (EC_GROUP_method_of(group) != EC_GROUP_method_of(named->group))
+        return 0;
+
+    if (!order || !cofactor || !generator || BN_cmp(order, named->order) || !BN_is_one(cofactor))
+        return 0;
+
+    ctx = BN_CTX_new();
+    if (!ctx)
+        return 0;
+
+    BN_CTX_start(ctx);
+    p = BN_CTX_get(ctx);
+    a = BN_CTX_get(ctx);
+    b = BN_CTX_get(ctx);
+
+    if (b && EC_GROUP_get_curve_GF2m(group, p, a, b, ctx)
+            && !BN_cmp(p, named->p) && !BN_cmp(a, named->a) && !BN_cmp(b, named->b)
+            && !EC_POINT_cmp(named->group, generator, named->generator, ctx))
+        ret = 1;
+
+    BN_CTX_end(ctx);
+    BN_CTX_free(ctx);
+
+    return ret;
+}
+
+const EC_GROUP *named_curve_group(int curve_num)
+{
+    if ((curve_num < 0) || (curve_num >= DSTU_CURVE_COUNT) || !named_curve_ready())
+        return NULL;
+
+    return named_groups[curve_num].group;
+}
+
+const EC_GROUP *named_curve_group_by_nid(int nid)
+{
+    int i;
+
+    for (i = 0; i < DSTU_CURVE_COUNT; i++)
     {
         if (nid == dstu_curves[i].nid)
-            return group_from_named_curve(i);
+            return named_curve_group(i);
     }
 
     return NULL;
 }
 
+EC_GROUP *group_from_named_curve(int curve_num)
+{
+    const EC_GROUP *group = named_curve_group(curve_num);
+
+    return group ? EC_GROUP_dup(group) : NULL;
+}
+
+EC_GROUP *group_from_nid(int nid)
+{
+    const EC_GROUP *group = named_curve_group_by_nid(nid);
+
+    return group ? EC_GROUP_dup(group) : NULL;
+}
+
+int curve_nid_from_group(const EC_GROUP *group)
+{
+    int m = EC_GROUP_get_degree(group), i;
+
+    for (i = 0; i < DSTU_CURVE_COUNT; i++)
+    {
+        if (m == dstu_curves[i].poly[0])
+            break;
+    }
+
+    if ((i < DSTU_CURVE_COUNT) && named_curve_ready() && group_matches(group, &(named_groups[i])))
+        return dstu_curves[i].nid;
+
+    return NID_undef;
+}
+
 int dstu_generate_key(EC_KEY *key)
 {
     const EC_GROUP *group = EC_KEY_get0_group(key);
@@ -544,7 +637,7 @@ int dstu_add_public_key(EC_KEY *key)
     if (!pbk)
         return 0;
 
-    if (!EC_POINT_mul(group, pbk, prk, NULL, NULL, NULL))
+    if (!dstu_generator_mul(group, pbk, prk, NULL))
         goto err;
 
     if (!EC_POINT_invert(group, pbk, NULL))
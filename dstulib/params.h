@@ -11,7 +11,8 @@
 #include <openssl/ec.h>
 
 #define DEFAULT_CURVE 6
-#define get_default_group() group_from_named_curve(DEFAULT_CURVE)
+#define DSTU_CURVE_COUNT 10
+#define get_default_group() named_curve_group(DEFAULT_CURVE)
 
 typedef struct dstu_named_curve_st
 {
@@ -29,6 +30,10 @@ void dstu_get_sbox(gost_ctx *ctx, gost_subst_block *sbox);
 int is_default_sbox(const unsigned char *sbox);
 unsigned char* copy_sbox(const unsigned char *sbox);
 
+/* Shared named curves (uacurve0..9), built once and never freed. Must not be modified */
+const EC_GROUP* named_curve_group(int curve_num);
+const EC_GROUP* named_curve_group_by_nid(int nid);
+/* Copies of named curves, owned by the caller */
 EC_GROUP* group_from_named_curve(int curve_num);
 EC_GROUP* group_from_nid(int nid);
 
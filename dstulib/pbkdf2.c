@@ -0,0 +1,121 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+#include "pbkdf2.h"
+#include "params.h" // default_sbox
+#include "sbox.h" // dstu_sbox_get
+
+#include "gost/gosthash.h" // gost_hash_ctx
+
+#include <openssl/crypto.h>
+
+#include <string.h>
+
+/* DSTU 34311 block and digest size */
+#define HMAC_BLOCK 32
+
+typedef struct
+{
+    gost_ctx cctx;
+    /* States after the ipad and opad blocks */
+    gost_hash_ctx inner;
+    gost_hash_ctx outer;
+} DSTU_HMAC;
+
+static void hmac_init(DSTU_HMAC *h, const gost_kbox *kbox, const unsigned char *pass, size_t passlen)
+{
+    unsigned char key[HMAC_BLOCK], pad[HMAC_BLOCK];
+    size_t i;
+
+    gost_init(&(h->cctx), kbox);
+    memset(&(h->inner), 0, sizeof(h->inner));
+    h->inner.cipher_ctx = &(h->cctx);
+
+    /* Longer keys are hashed first */
+    memset(key, 0, sizeof(key));
+    if (passlen > HMAC_BLOCK)
+    {
+        hash_block(&(h->inner), pass, passlen);
+        finish_hash(&(h->inner), key);
+        start_hash(&(h->inner));
+    }
+    else if (passlen)
+        memcpy(key, pass, passlen);
+
+    h->outer = h->inner;
+    for (i = 0; i < HMAC_BLOCK; i++)
+        pad[i] = key[i] ^ 0x36;
+    hash_block(&(h->inner), pad, HMAC_BLOCK);
+    for (i = 0; i < HMAC_BLOCK; i++)
+        pad[i] = key[i] ^ 0x5c;
+    hash_block(&(h->outer), pad, HMAC_BLOCK);
+
+    OPENSSL_cleanse(key, sizeof(key));
+    OPENSSL_cleanse(pad, sizeof(pad));
+}
+
+/* out = HMAC(first || second), second may be empty */
+static void hmac(const DSTU_HMAC *h, const unsigned char *first, size_t first_len,
+                 const unsigned char *second, size_t second_len, unsigned char *out)
+{
+    gost_hash_ctx ctx = h->inner;
+
+    hash_block(&ctx, first, first_len);
+    if (second_len)
+        hash_block(&ctx, second, second_len);
+    finish_hash(&ctx, out);
+
+    ctx = h->outer;
+    hash_block(&ctx, out, HMAC_BLOCK);
+    finish_hash(&ctx, out);
+    OPENSSL_cleanse(&ctx, sizeof(ctx));
+}
+
+int dstu_pbkdf2(const unsigned char *pass, size_t passlen,
+                const unsigned char *salt, size_t saltlen, unsigned long iter,
+                const gost_kbox *kbox, unsigned char *out, size_t outlen)
+{
+    DSTU_HMAC h;
+    unsigned char u[HMAC_BLOCK], t[HMAC_BLOCK], index[4];
+    unsigned long block, j;
+    size_t i, len;
+
+    if (!iter || (passlen && !pass) || (saltlen && !salt) || (outlen && !out))
+        return 0;
+
+    /* default_sbox tables are built in, no reference needs to be kept */
+    if (!kbox)
+        kbox = dstu_sbox_get(default_sbox);
+    if (!kbox)
+        return 0;
+
+    hmac_init(&h, kbox, pass, passlen);
+
+    for (block = 1; outlen; block++)
+    {
+        index[0] = (unsigned char) (block >> 24);
+        index[1] = (unsigned char) (block >> 16);
+        index[2] = (unsigned char) (block >> 8);
+        index[3] = (unsigned char) block;
+
+        hmac(&h, salt, saltlen, index, sizeof(index), u);
+        memcpy(t, u, HMAC_BLOCK);
+        for (j = 1; j < iter; j++)
+        {
+            hmac(&h, u, HMAC_BLOCK, NULL, 0, u);
+            for (i = 0; i < HMAC_BLOCK; i++)
+                t[i] ^= u[i];
+        }
+
+        len = outlen < HMAC_BLOCK ? outlen : HMAC_BLOCK;
+        memcpy(out, t, len);
+        out += len;
+        outlen -= len;
+    }
+
+    OPENSSL_cleanse(&h, sizeof(h));
+    OPENSSL_cleanse(u, sizeof(u));
+    OPENSSL_cleanse(t, sizeof(t));
+    return 1;
+}
@@ -0,0 +1,20 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+#ifndef DSTU_PBKDF2_H_
+#define DSTU_PBKDF2_H_
+
+#include "gost/gost89.h"
+
+#include <stddef.h>
+
+/* PBKDF2 (RFC 8018) with HMAC-DSTU34311 as PRF, the same as PKCS5_PBKDF2_HMAC with dstu34311 digest.
+ * Padded password blocks are hashed once, every iteration continues from their hash states.
+ * kbox NULL means default_sbox. Returns 1 on success, 0 on failure.
+ */
+int dstu_pbkdf2(const unsigned char *pass, size_t passlen,
+                const unsigned char *salt, size_t saltlen, unsigned long iter,
+                const gost_kbox *kbox, unsigned char *out, size_t outlen);
+
+#endif /* DSTU_PBKDF2_H_ */
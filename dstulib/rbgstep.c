@@ -0,0 +1,44 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+#include "rbgstep.h"
+
+#include <openssl/crypto.h>
+
+#include <string.h>
+
+/* DSTU RBG is bit oriented. It gives one bit at a time */
+byte dstu_rbg_step(gost_ctx *cryptor, const u4 *I, u4 *s)
+{
+    u4 x[2];
+
+    x[0] = I[0] ^ s[0];
+    x[1] = I[1] ^ s[1];
+    gostcrypt(cryptor, (byte*) x, (byte*) x);
+
+    s[0] = x[0] ^ I[0];
+    s[1] = x[1] ^ I[1];
+    gostcrypt(cryptor, (byte*) s, (byte*) s);
+
+    return (byte) (x[0] & 1);
+}
+
+void dstu_rbg_lanes_step(DSTU_RBG_LANES_STATE *lanes, const gost_kbox *kbox, unsigned char *out)
+{
+    u4 x[2 * DSTU_RBG_LANES];
+    int j;
+
+    for (j = 0; j < 2 * DSTU_RBG_LANES; j++)
+        x[j] = lanes->I[j] ^ lanes->s[j];
+    gost_enc_with_keys(kbox, DSTU_RBG_LANES, lanes->key, (byte*) x, (byte*) x);
+
+    for (j = 0; j < 2 * DSTU_RBG_LANES; j++)
+        lanes->s[j] = x[j] ^ lanes->I[j];
+    gost_enc_with_keys(kbox, DSTU_RBG_LANES, lanes->key, (byte*) lanes->s, (byte*) lanes->s);
+
+    memset(out, 0, DSTU_RBG_LANES / 8);
+    for (j = 0; j < DSTU_RBG_LANES; j++)
+        out[j / 8] |= (byte) (x[2 * j] & 1) << (j % 8);
+    OPENSSL_cleanse(x, sizeof(x));
+}
@@ -0,0 +1,38 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+#ifndef DSTU_RBGSTEP_H_
+#define DSTU_RBGSTEP_H_
+
+#include "gost/gost89.h"
+
+#include <stddef.h>
+
+/* Per-bit steps of the DSTU RBG, a generator of the engine RAND each */
+
+/* Lanes of the multi-lane mode, each one a generator of its own */
+#define DSTU_RBG_LANES 16
+
+/*
+ * Generators of the multi-lane mode run the same per-bit steps in lockstep, so that one
+ * multi-key kernel call does a step of all of them. Word i of lane j is at [DSTU_RBG_LANES * i + j]
+ * for keys and at [2 * j + i] for I and s, which are blocks
+ */
+typedef struct
+{
+    u4 key[8 * DSTU_RBG_LANES];
+    u4 I[2 * DSTU_RBG_LANES];
+    u4 s[2 * DSTU_RBG_LANES];
+    /* Output of the last step not given out yet: left bytes at the end of out */
+    unsigned char out[DSTU_RBG_LANES / 8];
+    size_t left;
+} DSTU_RBG_LANES_STATE;
+
+/* Next bit of the generator keyed in cryptor with blocks I and s, s is updated */
+byte dstu_rbg_step(gost_ctx *cryptor, const u4 *I, u4 *s);
+
+/* Same as dstu_rbg_step in every lane, bit j of out (DSTU_RBG_LANES / 8 bytes) is the bit of lane j */
+void dstu_rbg_lanes_step(DSTU_RBG_LANES_STATE *lanes, const gost_kbox *kbox, unsigned char *out);
+
+#endif /* DSTU_RBGSTEP_H_ */
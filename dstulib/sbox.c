@@ -0,0 +1,162 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+#include "sbox.h"
+#include "params.h" // default_sbox, unpack_sbox, pack_sbox
+
+#include <openssl/crypto.h>
+
+#include <string.h>
+
+typedef struct dstu_sbox_entry_st
+{
+    /* Must be the first member, entries are found by kbox pointers */
+    gost_kbox kbox;
+    unsigned char packed[sizeof(default_sbox)];
+    int refs;
+    struct dstu_sbox_entry_st *next;
+} DSTU_SBOX_ENTRY;
+
+#define BUILTIN_SBOX_COUNT 9
+
+static DSTU_SBOX_ENTRY builtin[BUILTIN_SBOX_COUNT];
+static DSTU_SBOX_ENTRY *custom = NULL;
+static CRYPTO_RWLOCK *custom_lock = NULL;
+static CRYPTO_ONCE registry_init = CRYPTO_ONCE_STATIC_INIT;
+
+static void builtin_from_packed(DSTU_SBOX_ENTRY *entry, const unsigned char *packed)
+{
+    gost_subst_block sbox;
+
+    memcpy(entry->packed, packed, sizeof(entry->packed));
+    unpack_sbox(entry->packed, &sbox);
+    kboxinit(&(entry->kbox), &sbox);
+    entry->refs = 0;
+    entry->next = NULL;
+}
+
+static void builtin_from_block(DSTU_SBOX_ENTRY *entry, gost_subst_block *sbox)
+{
+    pack_sbox(sbox, entry->packed);
+    kboxinit(&(entry->kbox), sbox);
+    entry->refs = 0;
+    entry->next = NULL;
+}
+
+static void do_registry_init(void)
+{
+    /* default_sbox goes first since it is looked up most of the time */
+    builtin_from_packed(&builtin[0], default_sbox);
+    builtin_from_block(&builtin[1], &GostR3411_94_TestParamSet);
+    builtin_from_block(&builtin[2], &GostR3411_94_CryptoProParamSet);
+    builtin_from_block(&builtin[3], &Gost28147_TestParamSet);
+    builtin_from_block(&builtin[4], &Gost28147_CryptoProParamSetA);
+    builtin_from_block(&builtin[5], &Gost28147_CryptoProParamSetB);
+    builtin_from_block(&builtin[6], &Gost28147_CryptoProParamSetC);
+    builtin_from_block(&builtin[7], &Gost28147_CryptoProParamSetD);
+    builtin_from_block(&builtin[8], &Gost28147_TC26ParamSetZ);
+
+    custom_lock = CRYPTO_THREAD_lock_new();
+}
+
+/* Built-in entries are never freed and need no reference counting */
+static int is_builtin(const DSTU_SBOX_ENTRY *entry)
+{
+    return entry >= builtin && entry < builtin + BUILTIN_SBOX_COUNT;
+}
+
+static int registry_ready(void)
+{
+    return CRYPTO_THREAD_run_once(&registry_init, do_registry_init);
+}
+
+const gost_kbox *dstu_sbox_get(const unsigned char *packed_sbox)
+{
+    DSTU_SBOX_ENTRY *entry;
+    int i;
+
+    if (!packed_sbox || !registry_ready())
+        return NULL;
+
+    /* Built-in entries are immutable, no locking needed */
+    for (i = 0; i < BUILTIN_SBOX_COUNT; i++)
+    {
+        if (!memcmp(builtin[i].packed, packed_sbox, sizeof(builtin[i].packed)))
+            return &(builtin[i].kbox);
+    }
+
+    if (!custom_lock || !CRYPTO_THREAD_write_lock(custom_lock))
+        return NULL;
+
+    for (entry = custom; entry; entry = entry->next)
+    {
+        if (!memcmp(entry->packed, packed_sbox, sizeof(entry->packed)))
+        {
+            entry->refs++;
+            CRYPTO_THREAD_unlock(custom_lock);
+            return &(entry->kbox);
+        }
+    }
+
+    entry = OPENSSL_malloc(sizeof(DSTU_SBOX_ENTRY));
+    if (entry)
+    {
+        builtin_from_packed(entry, packed_sbox);
+        entry->refs = 1;
+        entry->next = custom;
+        custom = entry;
+    }
+
+    CRYPTO_THREAD_unlock(custom_lock);
+
+    return entry ? &(entry->kbox) : NULL;
+}
+
+void dstu_sbox_ref(const gost_kbox *kbox)
+{
+    DSTU_SBOX_ENTRY *entry = (DSTU_SBOX_ENTRY *) kbox;
+
+    if (!entry || is_builtin(entry))
+        return;
+
+    if (!CRYPTO_THREAD_write_lock(custom_lock))
+        return;
+    entry->refs++;
+    CRYPTO_THREAD_unlock(custom_lock);
+}
+
+void dstu_sbox_release(const gost_kbox *kbox)
+{
+    DSTU_SBOX_ENTRY *entry = (DSTU_SBOX_ENTRY *) kbox, **link;
+
+    if (!entry || is_builtin(entry))
+        return;
+
+    if (!CRYPTO_THREAD_write_lock(custom_lock))
+        return;
+
+    if (--(entry->refs) == 0)
+    {
+        for (link = &custom; *link; link = &((*link)->next))
+        {
+            if (*link == entry)
+            {
+                *link = entry->next;
+                break;
+            }
+        }
+    }
+    else
+        entry = NULL;
+
+    CRYPTO_THREAD_unlock(custom_lock);
+
+    if (entry)
+        OPENSSL_free(entry);
+}
+
+const unsigned char *dstu_sbox_packed(const gost_kbox *kbox)
+{
+    return ((const DSTU_SBOX_ENTRY *) kbox)->packed;
+}
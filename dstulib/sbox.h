@@ -0,0 +1,25 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+#ifndef DSTU_SBOX_H_
+#define DSTU_SBOX_H_
+
+#include "gost/gost89.h"
+
+/* Process-wide registry of preprocessed s-boxes.
+ * Each distinct packed s-box (64 bytes, see default_sbox) is expanded only once
+ * and shared by all cipher and hash contexts using it. default_sbox and RFC 4357
+ * parameter sets are always present and never freed, other s-boxes are reference counted.
+ */
+
+/* Returns tables for a packed s-box taking a reference on them, NULL on failure */
+const gost_kbox *dstu_sbox_get(const unsigned char *packed_sbox);
+/* Takes one more reference on tables returned by dstu_sbox_get */
+void dstu_sbox_ref(const gost_kbox *kbox);
+/* Drops a reference taken by dstu_sbox_get or dstu_sbox_ref, NULL is ignored */
+void dstu_sbox_release(const gost_kbox *kbox);
+/* Returns the packed s-box the tables were built from */
+const unsigned char *dstu_sbox_packed(const gost_kbox *kbox);
+
+#endif /* DSTU_SBOX_H_ */
@@ -4,17 +4,24 @@
  ==================================================================== */
 
 #include "cipher.h"
-#include "params.h" // default_sbox, unpack_sbox, pack_sbox
+#include "params.h" // default_sbox
+#include "sbox.h" // dstu_sbox_*
 #include "control.h"
+#include "err.h"
 
 #include "gost/gost89.h" // gost_*
 
+#include <limits.h>
+#include <stdint.h>
 #include <string.h>
 
 /* DSTU uses Russian GOST 28147 but with different s-boxes and no key meshing */
-/* We implement CFB mode here because it is mostly used */
+/* We implement CFB mode here because it is mostly used, and gamma (counter) mode for bulk data since its blocks are independent */
+/* CFB combined with DSTU 28147 MAC is provided as an AEAD cipher for encrypt-then-MAC in one pass */
 
 #define DSTU_CIPHER_BLOCK_SIZE 8
+/* 32 bit MAC, as gost_mac is mostly used */
+#define DSTU_CIPHER_MAC_DEFAULT_TAG_SIZE 4
 
 /* 2 bytes for sequence header, 2 bytes for each octet string header and 8 bytes for iv and 64 bytes for dke. Total 78 < 128 so we are ok with 1 byte length */
 #define DSTU_CIPHER_ASN1_PARAM_SIZE (2 + 2 + DSTU_CIPHER_BLOCK_SIZE + 2 + sizeof(default_sbox))
@@ -22,11 +29,14 @@
 static int dstu_cipher_init(EVP_CIPHER_CTX *ctx, const unsigned char *key,
                             const unsigned char *iv, int enc)
 {
-    gost_subst_block sbox;
+    const gost_kbox *kbox = dstu_sbox_get(default_sbox);
     gost_ctx *gctx = EVP_CIPHER_CTX_get_cipher_data(ctx);
 
-    unpack_sbox(default_sbox, &sbox);
-    gost_init(gctx, &sbox);
+    if (!kbox)
+        return 0;
+
+    dstu_sbox_release(gctx->kbox);
+    gost_init(gctx, kbox);
 
     if (key)
         gost_key(gctx, key);
@@ -42,8 +52,9 @@ static int dstu_cipher_init(EVP_CIPHER_CTX *ctx, const unsigned char *key,
     return 1;
 }
 
-static int dstu_cipher_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
-                                 const unsigned char *in, size_t inl)
+/* CFB processing, adding ciphertext to MAC state m if it is not NULL */
+static int dstu_cipher_cfb(EVP_CIPHER_CTX *ctx, gost_mac_ctx *m, unsigned char *out,
+                           const unsigned char *in, size_t inl)
 {
     size_t to_use, i, blocks;
     gost_ctx *gctx = EVP_CIPHER_CTX_get_cipher_data(ctx);
@@ -62,6 +73,9 @@ static int dstu_cipher_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
     {
         to_use = (num < inl) ? num : inl;
 
+        if (m && !EVP_CIPHER_CTX_encrypting(ctx))
+            gost_mac_update(m, in, to_use);
+
         for (i = 0; i < to_use; i++)
         {
             if (EVP_CIPHER_CTX_encrypting(ctx))
@@ -78,6 +92,9 @@ static int dstu_cipher_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
             out++;
         }
 
+        if (m && EVP_CIPHER_CTX_encrypting(ctx))
+            gost_mac_update(m, out - to_use, to_use);
+
         num -= to_use;
         inl -= to_use;
         EVP_CIPHER_CTX_set_num(ctx, num);
@@ -94,7 +111,10 @@ static int dstu_cipher_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
         {
             if (EVP_CIPHER_CTX_encrypting(ctx))
             {
-                gost_enc_cfb(gctx, iv, in, out, blocks);
+                if (m)
+                    gost_enc_cfb_mac(gctx, iv, in, out, blocks, m);
+                else
+                    gost_enc_cfb(gctx, iv, in, out, blocks);
                 memcpy(iv, out + (blocks * DSTU_CIPHER_BLOCK_SIZE)- DSTU_CIPHER_BLOCK_SIZE,
                        DSTU_CIPHER_BLOCK_SIZE);
             }
@@ -103,7 +123,10 @@ static int dstu_cipher_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
                 memcpy(tmpiv, iv, DSTU_CIPHER_BLOCK_SIZE);
                 memcpy(iv, in + (blocks * DSTU_CIPHER_BLOCK_SIZE)- DSTU_CIPHER_BLOCK_SIZE,
                        DSTU_CIPHER_BLOCK_SIZE);
-                gost_dec_cfb(gctx, tmpiv, in, out, blocks);
+                if (m)
+                    gost_dec_cfb_mac(gctx, tmpiv, in, out, blocks, m);
+                else
+                    gost_dec_cfb(gctx, tmpiv, in, out, blocks);
             }
             gostcrypt(gctx, iv, buf);
 
@@ -115,6 +138,9 @@ static int dstu_cipher_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
 
     if (inl)
     {
+        if (m && !EVP_CIPHER_CTX_encrypting(ctx))
+            gost_mac_update(m, in, inl);
+
         for (i = 0; i < inl; i++)
         {
             if (EVP_CIPHER_CTX_encrypting(ctx))
@@ -131,20 +157,36 @@ static int dstu_cipher_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
             out++;
         }
 
+        if (m && EVP_CIPHER_CTX_encrypting(ctx))
+            gost_mac_update(m, out - inl, inl);
+
         EVP_CIPHER_CTX_set_num(ctx, DSTU_CIPHER_BLOCK_SIZE - inl);
     }
 
     return out - out_start;
 }
 
+static int dstu_cipher_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+                                 const unsigned char *in, size_t inl)
+{
+    return dstu_cipher_cfb(ctx, NULL, out, in, inl);
+}
+
 static int dstu_cipher_cleanup(EVP_CIPHER_CTX *ctx)
 {
+    gost_ctx *gctx = EVP_CIPHER_CTX_get_cipher_data(ctx);
+
+    if (gctx)
+    {
+        dstu_sbox_release(gctx->kbox);
+        gctx->kbox = NULL;
+    }
     return 1;
 }
 
 static int dstu_cipher_ctrl(EVP_CIPHER_CTX *ctx, int cmd, int p1, void *p2)
 {
-    gost_subst_block sbox;
+    const gost_kbox *kbox;
     gost_ctx *gctx = EVP_CIPHER_CTX_get_cipher_data(ctx);
 
     switch (cmd)
@@ -152,8 +194,11 @@ static int dstu_cipher_ctrl(EVP_CIPHER_CTX *ctx, int cmd, int p1, void *p2)
         case DSTU_SET_CUSTOM_SBOX:
             if ((!p2) || (sizeof(default_sbox) != p1))
                 return 0;
-            unpack_sbox((unsigned char *) p2, &sbox);
-            gost_init(gctx, &sbox);
+            kbox = dstu_sbox_get(p2);
+            if (!kbox)
+                return 0;
+            dstu_sbox_release(gctx->kbox);
+            gost_init(gctx, kbox);
             memcpy(EVP_CIPHER_CTX_iv_noconst(ctx), EVP_CIPHER_CTX_original_iv(ctx), DSTU_CIPHER_BLOCK_SIZE);
             gostcrypt(gctx, EVP_CIPHER_CTX_iv(ctx), EVP_CIPHER_CTX_buf_noconst(ctx));
             return 1;
@@ -162,6 +207,11 @@ static int dstu_cipher_ctrl(EVP_CIPHER_CTX *ctx, int cmd, int p1, void *p2)
                 return 0;
             *((int *)(p2)) = NID_hmacWithDstu34311;
             return 1;
+        case EVP_CTRL_COPY:
+            /* Cipher data was copied as is, so the copy holds one more reference on s-box tables */
+            gctx = EVP_CIPHER_CTX_get_cipher_data((EVP_CIPHER_CTX *) p2);
+            dstu_sbox_ref(gctx->kbox);
+            return 1;
     }
 
     return 0;
@@ -170,7 +220,6 @@ static int dstu_cipher_ctrl(EVP_CIPHER_CTX *ctx, int cmd, int p1, void *p2)
 static int dstu_cipher_set_asn1_parameters(EVP_CIPHER_CTX *ctx, ASN1_TYPE *asn1_type)
 {
     /* We defined params asn1 structure, but for now we will use manual composition for speed here */
-    gost_subst_block sbox;
     gost_ctx* gctx = EVP_CIPHER_CTX_get_cipher_data(ctx);
 
     byte params[DSTU_CIPHER_ASN1_PARAM_SIZE];
@@ -186,8 +235,7 @@ static int dstu_cipher_set_asn1_parameters(EVP_CIPHER_CTX *ctx, ASN1_TYPE *asn1_
     params[4 + DSTU_CIPHER_BLOCK_SIZE] = V_ASN1_OCTET_STRING;
     params[4 + DSTU_CIPHER_BLOCK_SIZE + 1] = sizeof(default_sbox);
 
-    dstu_get_sbox(gctx, &sbox);
-    pack_sbox(&sbox, &(params[4 + DSTU_CIPHER_BLOCK_SIZE + 2]));
+    memcpy(&(params[4 + DSTU_CIPHER_BLOCK_SIZE + 2]), dstu_sbox_packed(gctx->kbox), sizeof(default_sbox));
 
     seq.type = V_ASN1_SEQUENCE;
     seq.length = sizeof(params);
@@ -228,7 +276,7 @@ EVP_CIPHER *dstu_cipher_new()
     if (res == NULL)
         return NULL;
     if (!EVP_CIPHER_meth_set_iv_length(res, DSTU_CIPHER_BLOCK_SIZE) ||
-        !EVP_CIPHER_meth_set_flags(res, EVP_CIPH_CFB_MODE | EVP_CIPH_NO_PADDING | EVP_CIPH_CUSTOM_IV | EVP_CIPH_FLAG_CUSTOM_CIPHER | EVP_CIPH_ALWAYS_CALL_INIT) ||
+        !EVP_CIPHER_meth_set_flags(res, EVP_CIPH_CFB_MODE | EVP_CIPH_NO_PADDING | EVP_CIPH_CUSTOM_IV | EVP_CIPH_FLAG_CUSTOM_CIPHER | EVP_CIPH_ALWAYS_CALL_INIT | EVP_CIPH_CUSTOM_COPY) ||
         !EVP_CIPHER_meth_set_init(res, dstu_cipher_init) ||
         !EVP_CIPHER_meth_set_do_cipher(res, dstu_cipher_do_cipher) ||
         !EVP_CIPHER_meth_set_cleanup(res, dstu_cipher_cleanup) ||
@@ -247,3 +295,411 @@ void dstu_cipher_free(EVP_CIPHER *cipher)
 {
     EVP_CIPHER_meth_free(cipher);
 }
+
+/* Gamma mode keeps no chaining state but the offset, so it can seek anywhere */
+typedef struct
+{
+    /* Must be the first member, code shared with CFB takes cipher data for gost_ctx */
+    gost_ctx gctx;
+    /* Encrypted IV, counters are made from it */
+    unsigned char start[DSTU_CIPHER_BLOCK_SIZE];
+    /* Byte offset in the keystream */
+    uint64_t pos;
+} DSTU_CTR_CTX;
+
+static void dstu_cipher_ctr_reset(EVP_CIPHER_CTX *ctx)
+{
+    DSTU_CTR_CTX *cctx = EVP_CIPHER_CTX_get_cipher_data(ctx);
+
+    gostcrypt(&(cctx->gctx), EVP_CIPHER_CTX_original_iv(ctx), cctx->start);
+    cctx->pos = 0;
+}
+
+static int dstu_cipher_ctr_init(EVP_CIPHER_CTX *ctx, const unsigned char *key,
+                                const unsigned char *iv, int enc)
+{
+    if (!dstu_cipher_init(ctx, key, iv, enc))
+        return 0;
+
+    dstu_cipher_ctr_reset(ctx);
+    return 1;
+}
+
+/* Processes len bytes within one keystream block */
+static void dstu_cipher_ctr_partial(DSTU_CTR_CTX *cctx, unsigned char *out,
+                                    const unsigned char *in, size_t len)
+{
+    unsigned char gamma[DSTU_CIPHER_BLOCK_SIZE] = {0};
+    size_t skip = cctx->pos % DSTU_CIPHER_BLOCK_SIZE, i;
+
+    gost_cnt_crypt(&(cctx->gctx), cctx->start, cctx->pos / DSTU_CIPHER_BLOCK_SIZE, gamma, gamma, 1);
+    for (i = 0; i < len; i++)
+        out[i] = in[i] ^ gamma[skip + i];
+    cctx->pos += len;
+
+    OPENSSL_cleanse(gamma, sizeof(gamma));
+}
+
+static int dstu_cipher_ctr_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+                                     const unsigned char *in, size_t inl)
+{
+    DSTU_CTR_CTX *cctx = EVP_CIPHER_CTX_get_cipher_data(ctx);
+    size_t to_use, blocks, total = inl;
+
+    if ((!inl) && (!in))
+        return 0;
+
+    if ((!inl) || (!in))
+        return -1;
+
+    if (cctx->pos % DSTU_CIPHER_BLOCK_SIZE)
+    {
+        to_use = DSTU_CIPHER_BLOCK_SIZE - cctx->pos % DSTU_CIPHER_BLOCK_SIZE;
+        if (to_use > inl)
+            to_use = inl;
+        dstu_cipher_ctr_partial(cctx, out, in, to_use);
+        in += to_use;
+        out += to_use;
+        inl -= to_use;
+    }
+
+    blocks = inl / DSTU_CIPHER_BLOCK_SIZE;
+    if (blocks)
+    {
+        gost_cnt_crypt(&(cctx->gctx), cctx->start, cctx->pos / DSTU_CIPHER_BLOCK_SIZE, in, out, blocks);
+        cctx->pos += blocks * DSTU_CIPHER_BLOCK_SIZE;
+        in += blocks * DSTU_CIPHER_BLOCK_SIZE;
+        out += blocks * DSTU_CIPHER_BLOCK_SIZE;
+        inl -= blocks * DSTU_CIPHER_BLOCK_SIZE;
+    }
+
+    if (inl)
+        dstu_cipher_ctr_partial(cctx, out, in, inl);
+
+    return total;
+}
+
+static int dstu_cipher_ctr_ctrl(EVP_CIPHER_CTX *ctx, int cmd, int p1, void *p2)
+{
+    DSTU_CTR_CTX *cctx = EVP_CIPHER_CTX_get_cipher_data(ctx);
+
+    switch (cmd)
+    {
+        case DSTU_SET_CIPHER_POSITION:
+            if (!p2)
+                return 0;
+            cctx->pos = *((const uint64_t *)(p2));
+            return 1;
+        case DSTU_GET_CIPHER_POSITION:
+            if (!p2)
+                return 0;
+            *((uint64_t *)(p2)) = cctx->pos;
+            return 1;
+        case DSTU_SET_CUSTOM_SBOX:
+            /* Counters are made with the old s-boxes, so start over */
+            if (!dstu_cipher_ctrl(ctx, cmd, p1, p2))
+                return 0;
+            dstu_cipher_ctr_reset(ctx);
+            return 1;
+    }
+
+    return dstu_cipher_ctrl(ctx, cmd, p1, p2);
+}
+
+static int dstu_cipher_ctr_get_asn1_parameters(EVP_CIPHER_CTX *ctx, ASN1_TYPE *asn1_type)
+{
+    int ret = dstu_cipher_get_asn1_parameters(ctx, asn1_type);
+
+    if (ret > 0)
+        dstu_cipher_ctr_reset(ctx);
+    return ret;
+}
+
+EVP_CIPHER *dstu_cipher_ctr_new()
+{
+    EVP_CIPHER *res = EVP_CIPHER_meth_new(NID_dstu28147_ofb, 1, 32);
+    if (res == NULL)
+        return NULL;
+    if (!EVP_CIPHER_meth_set_iv_length(res, DSTU_CIPHER_BLOCK_SIZE) ||
+        !EVP_CIPHER_meth_set_flags(res, EVP_CIPH_CTR_MODE | EVP_CIPH_NO_PADDING | EVP_CIPH_CUSTOM_IV | EVP_CIPH_FLAG_CUSTOM_CIPHER | EVP_CIPH_ALWAYS_CALL_INIT | EVP_CIPH_CUSTOM_COPY) ||
+        !EVP_CIPHER_meth_set_init(res, dstu_cipher_ctr_init) ||
+        !EVP_CIPHER_meth_set_do_cipher(res, dstu_cipher_ctr_do_cipher) ||
+        !EVP_CIPHER_meth_set_cleanup(res, dstu_cipher_cleanup) ||
+        !EVP_CIPHER_meth_set_impl_ctx_size(res, sizeof(DSTU_CTR_CTX)) ||
+        !EVP_CIPHER_meth_set_set_asn1_params(res, dstu_cipher_set_asn1_parameters) ||
+        !EVP_CIPHER_meth_set_get_asn1_params(res, dstu_cipher_ctr_get_asn1_parameters) ||
+        !EVP_CIPHER_meth_set_ctrl(res, dstu_cipher_ctr_ctrl))
+    {
+        EVP_CIPHER_meth_free(res);
+        return NULL;
+    }
+    return res;
+}
+
+/* CFB with MAC of the ciphertext (encrypt-then-MAC), both done in one pass over the data */
+/* 64 byte key: first half is the cipher key, second half is the MAC key */
+typedef struct
+{
+    /* Must be the first member, code shared with CFB takes cipher data for gost_ctx */
+    gost_ctx gctx;
+    gost_ctx mac_gctx;
+    gost_mac_ctx mctx;
+    unsigned char tag[DSTU_CIPHER_BLOCK_SIZE];
+    /* Tag length in bytes, MAC length is 8 times that */
+    int tag_len;
+    /* Expected tag is set for decryption, or tag is computed by encryption */
+    int tag_ready;
+} DSTU_CFB_MAC_CTX;
+
+static int dstu_cipher_mac_init(EVP_CIPHER_CTX *ctx, const unsigned char *key,
+                                const unsigned char *iv, int enc)
+{
+    DSTU_CFB_MAC_CTX *mctx = EVP_CIPHER_CTX_get_cipher_data(ctx);
+
+    if (!dstu_cipher_init(ctx, key, iv, enc))
+        return 0;
+
+    /* Both halves use the same s-box tables */
+    dstu_sbox_release(mctx->mac_gctx.kbox);
+    gost_init(&(mctx->mac_gctx), mctx->gctx.kbox);
+    dstu_sbox_ref(mctx->mac_gctx.kbox);
+
+    if (key)
+        gost_key(&(mctx->mac_gctx), key + 32);
+
+    if (!mctx->tag_len)
+        mctx->tag_len = DSTU_CIPHER_MAC_DEFAULT_TAG_SIZE;
+    mctx->tag_ready = 0;
+    gost_mac_start(&(mctx->mctx), &(mctx->mac_gctx));
+    return 1;
+}
+
+static int dstu_cipher_mac_do_cipher(EVP_CIPHER_CTX *ctx, unsigned char *out,
+                                     const unsigned char *in, size_t inl)
+{
+    DSTU_CFB_MAC_CTX *mctx = EVP_CIPHER_CTX_get_cipher_data(ctx);
+    unsigned char tag[DSTU_CIPHER_BLOCK_SIZE] = {0};
+
+    if ((!inl) && (!in))
+    {
+        /* EVP_CipherFinal_ex */
+        gost_mac_finish(&(mctx->mctx), 8 * mctx->tag_len, tag);
+        if (EVP_CIPHER_CTX_encrypting(ctx))
+        {
+            memcpy(mctx->tag, tag, mctx->tag_len);
+            mctx->tag_ready = 1;
+            return 0;
+        }
+        if ((!mctx->tag_ready) || CRYPTO_memcmp(tag, mctx->tag, mctx->tag_len))
+        {
+            OPENSSL_cleanse(tag, sizeof(tag));
+            return -1;
+        }
+        OPENSSL_cleanse(tag, sizeof(tag));
+        return 0;
+    }
+
+    /* There is no additional authenticated data */
+    if (!out)
+        return -1;
+
+    return dstu_cipher_cfb(ctx, &(mctx->mctx), out, in, inl);
+}
+
+static int dstu_cipher_mac_cleanup(EVP_CIPHER_CTX *ctx)
+{
+    DSTU_CFB_MAC_CTX *mctx = EVP_CIPHER_CTX_get_cipher_data(ctx);
+
+    if (mctx)
+    {
+        dstu_sbox_release(mctx->mac_gctx.kbox);
+        mctx->mac_gctx.kbox = NULL;
+    }
+    return dstu_cipher_cleanup(ctx);
+}
+
+static int dstu_cipher_mac_ctrl(EVP_CIPHER_CTX *ctx, int cmd, int p1, void *p2)
+{
+    DSTU_CFB_MAC_CTX *mctx = EVP_CIPHER_CTX_get_cipher_data(ctx);
+    DSTU_CFB_MAC_CTX *to;
+
+    switch (cmd)
+    {
+        case EVP_CTRL_AEAD_SET_TAG:
+            if ((p1 < 1) || (p1 > DSTU_CIPHER_BLOCK_SIZE))
+                return 0;
+            if (p2)
+            {
+                if (EVP_CIPHER_CTX_encrypting(ctx))
+                    return 0;
+                memcpy(mctx->tag, p2, p1);
+                mctx->tag_ready = 1;
+            }
+            mctx->tag_len = p1;
+            return 1;
+        case EVP_CTRL_AEAD_GET_TAG:
+            if ((!p2) || (p1 < 1) || (p1 > mctx->tag_len) || (!EVP_CIPHER_CTX_encrypting(ctx)) || (!mctx->tag_ready))
+                return 0;
+            memcpy(p2, mctx->tag, p1);
+            return 1;
+        case DSTU_SET_CUSTOM_SBOX:
+            if (!dstu_cipher_ctrl(ctx, cmd, p1, p2))
+                return 0;
+            dstu_sbox_release(mctx->mac_gctx.kbox);
+            gost_init(&(mctx->mac_gctx), mctx->gctx.kbox);
+            dstu_sbox_ref(mctx->mac_gctx.kbox);
+            gost_mac_start(&(mctx->mctx), &(mctx->mac_gctx));
+            return 1;
+        case EVP_CTRL_COPY:
+            if (!dstu_cipher_ctrl(ctx, cmd, p1, p2))
+                return 0;
+            to = EVP_CIPHER_CTX_get_cipher_data((EVP_CIPHER_CTX *) p2);
+            dstu_sbox_ref(to->mac_gctx.kbox);
+            to->mctx.cipher_ctx = &(to->mac_gctx);
+            return 1;
+    }
+
+    return dstu_cipher_ctrl(ctx, cmd, p1, p2);
+}
+
+EVP_CIPHER *dstu_cipher_mac_new(int nid)
+{
+    EVP_CIPHER *res = EVP_CIPHER_meth_new(nid, 1, 64);
+    if (res == NULL)
+        return NULL;
+    if (!EVP_CIPHER_meth_set_iv_length(res, DSTU_CIPHER_BLOCK_SIZE) ||
+        !EVP_CIPHER_meth_set_flags(res, EVP_CIPH_CFB_MODE | EVP_CIPH_NO_PADDING | EVP_CIPH_CUSTOM_IV | EVP_CIPH_FLAG_CUSTOM_CIPHER | EVP_CIPH_ALWAYS_CALL_INIT | EVP_CIPH_CUSTOM_COPY | EVP_CIPH_FLAG_AEAD_CIPHER) ||
+        !EVP_CIPHER_meth_set_init(res, dstu_cipher_mac_init) ||
+        !EVP_CIPHER_meth_set_do_cipher(res, dstu_cipher_mac_do_cipher) ||
+        !EVP_CIPHER_meth_set_cleanup(res, dstu_cipher_mac_cleanup) ||
+        !EVP_CIPHER_meth_set_impl_ctx_size(res, sizeof(DSTU_CFB_MAC_CTX)) ||
+        !EVP_CIPHER_meth_set_ctrl(res, dstu_cipher_mac_ctrl))
+    {
+        EVP_CIPHER_meth_free(res);
+        return NULL;
+    }
+    return res;
+}
+
+static int dstu_cipher_batch_valid(const DSTU_CIPHER_BATCH *batch)
+{
+    EVP_CIPHER_CTX *ctx;
+    size_t i;
+
+    if (!batch)
+        return 0;
+
+    if (batch->count && ((!batch->ctx) || (!batch->out) || (!batch->in) || (!batch->inl)))
+        return 0;
+
+    for (i = 0; i < batch->count; i++)
+    {
+        ctx = batch->ctx[i];
+        if ((!ctx) || (!EVP_CIPHER_CTX_get_cipher_data(ctx)) || (NID_dstu28147_cfb != EVP_CIPHER_CTX_nid(ctx)))
+            return 0;
+        if (batch->inl[i] && ((!batch->in[i]) || (!batch->out[i])))
+            return 0;
+        if ((batch->inl[i] / DSTU_CIPHER_BLOCK_SIZE) > INT_MAX)
+            return 0;
+    }
+
+    return 1;
+}
+
+/* Same as dstu_cipher_do_cipher on every context of the batch, but full blocks of encrypting contexts go through gost_enc_cfb_multi together */
+/* Decryption is left as is, since gost_dec_cfb handles it in parallel already */
+int dstu_cipher_batch(const DSTU_CIPHER_BATCH *batch)
+{
+    EVP_CIPHER_CTX *ctx;
+    gost_ctx **gctx = NULL;
+    const byte **iv = NULL, **in = NULL;
+    byte **out = NULL;
+    int *blocks = NULL;
+    size_t *index = NULL, i, n = 0, head, rest;
+    int ret = 0;
+
+    if (!dstu_cipher_batch_valid(batch))
+    {
+        DSTUerr(DSTU_F_DSTU_CIPHER_BATCH, DSTU_R_INVALID_CIPHER_BATCH);
+        return 0;
+    }
+
+    if (!batch->count)
+        return 1;
+
+    gctx = OPENSSL_malloc(batch->count * sizeof(*gctx));
+    iv = OPENSSL_malloc(batch->count * sizeof(*iv));
+    in = OPENSSL_malloc(batch->count * sizeof(*in));
+    out = OPENSSL_malloc(batch->count * sizeof(*out));
+    blocks = OPENSSL_malloc(batch->count * sizeof(*blocks));
+    index = OPENSSL_malloc(batch->count * sizeof(*index));
+    if ((!gctx) || (!iv) || (!in) || (!out) || (!blocks) || (!index))
+    {
+        DSTUerr(DSTU_F_DSTU_CIPHER_BATCH, ERR_R_MALLOC_FAILURE);
+        goto err;
+    }
+
+    for (i = 0; i < batch->count; i++)
+    {
+        ctx = batch->ctx[i];
+        if (!batch->inl[i])
+            continue;
+
+        if (!EVP_CIPHER_CTX_encrypting(ctx))
+        {
+            if (dstu_cipher_do_cipher(ctx, batch->out[i], batch->in[i], batch->inl[i]) < 0)
+                goto err;
+            continue;
+        }
+
+        /* Use up gamma left from the previous call first */
+        head = EVP_CIPHER_CTX_num(ctx);
+        if (head > batch->inl[i])
+            head = batch->inl[i];
+        if (head && (dstu_cipher_do_cipher(ctx, batch->out[i], batch->in[i], head) < 0))
+            goto err;
+
+        rest = batch->inl[i] - head;
+        if (rest < DSTU_CIPHER_BLOCK_SIZE)
+        {
+            if (rest && (dstu_cipher_do_cipher(ctx, batch->out[i] + head, batch->in[i] + head, rest) < 0))
+                goto err;
+            continue;
+        }
+
+        gctx[n] = EVP_CIPHER_CTX_get_cipher_data(ctx);
+        iv[n] = EVP_CIPHER_CTX_iv(ctx);
+        in[n] = batch->in[i] + head;
+        out[n] = batch->out[i] + head;
+        blocks[n] = rest / DSTU_CIPHER_BLOCK_SIZE;
+        index[n] = i;
+        n++;
+    }
+
+    gost_enc_cfb_multi(gctx, iv, in, out, blocks, n);
+
+    /* Chain every context on and encrypt what is left of its input */
+    for (i = 0; i < n; i++)
+    {
+        ctx = batch->ctx[index[i]];
+        in[i] += blocks[i] * DSTU_CIPHER_BLOCK_SIZE;
+        out[i] += blocks[i] * DSTU_CIPHER_BLOCK_SIZE;
+        memcpy(EVP_CIPHER_CTX_iv_noconst(ctx), out[i] - DSTU_CIPHER_BLOCK_SIZE, DSTU_CIPHER_BLOCK_SIZE);
+        gostcrypt(gctx[i], EVP_CIPHER_CTX_iv(ctx), EVP_CIPHER_CTX_buf_noconst(ctx));
+
+        rest = batch->inl[index[i]] - (out[i] - batch->out[index[i]]);
+        if (rest && (dstu_cipher_do_cipher(ctx, out[i], in[i], rest) < 0))
+            goto err;
+    }
+
+    ret = 1;
+
+err:
+    OPENSSL_free(gctx);
+    OPENSSL_free(iv);
+    OPENSSL_free(in);
+    OPENSSL_free(out);
+    OPENSSL_free(blocks);
+    OPENSSL_free(index);
+    return ret;
+}
@@ -2,5 +2,17 @@
 
 #include <openssl/evp.h>
 
+#include "control.h" // DSTU_CIPHER_BATCH
+
 EVP_CIPHER *dstu_cipher_new();
 void dstu_cipher_free(EVP_CIPHER *cipher);
+
+EVP_CIPHER *dstu_cipher_ctr_new();
+
+/* DSTU 28147 CFB with MAC has no NID in OpenSSL, it is created on engine bind */
+#define DSTU_CIPHER_MAC_SN "dstu28147-cfb-mac"
+#define DSTU_CIPHER_MAC_LN "DSTU Gost 28147-2009 CFB mode with MAC"
+
+EVP_CIPHER *dstu_cipher_mac_new(int nid);
+
+int dstu_cipher_batch(const DSTU_CIPHER_BATCH *batch);
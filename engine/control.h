@@ -1,7 +1,89 @@
 #pragma once
 
+#include <openssl/engine.h>
+#include <openssl/evp.h>
+
 /* This ctrl command to set custom sbox for MD and CIPHER */
 /* p2 should point to char array of 64 bytes (packed format, see default_sbox), p1 should be set to size of the array (64) */
 #define DSTU_SET_CUSTOM_SBOX (EVP_MD_CTRL_ALG_CTRL + 1)
 
 #define DSTU_SET_CURVE (EVP_PKEY_ALG_CTRL + 2)
+
+/* ENGINE ctrl command to run EVP_CipherUpdate on many DSTU 28147 CFB contexts at once */
+/* p should point to DSTU_CIPHER_BATCH, i is not used. Every context gets in[k] of inl[k] bytes and writes exactly inl[k] bytes to out[k] */
+/* Encrypting contexts are processed side by side, so many short independent messages go faster than one by one */
+#define DSTU_ENGINE_CIPHER_BATCH ENGINE_CMD_BASE
+
+/* ENGINE ctrl command "GOST_IMPL" to select GOST 28147 kernels: p should point to implementation name, i is not used */
+/* Names are "auto", "scalar", "table", "ssse3", "avx2", "avx512" and "bitslice", fails if the CPU does not support it */
+/* DSTU_GOST_IMPL environment variable does the same when the engine is bound */
+#define DSTU_ENGINE_GOST_IMPL (ENGINE_CMD_BASE + 1)
+
+typedef struct
+{
+    EVP_CIPHER_CTX **ctx;
+    unsigned char **out;
+    const unsigned char **in;
+    const size_t *inl;
+    size_t count;
+} DSTU_CIPHER_BATCH;
+
+/* ENGINE ctrl command to run EVP_DigestUpdate on many DSTU 34311 contexts at once */
+/* p should point to DSTU_DIGEST_BATCH, i is not used. Every context gets in[k] of inl[k] bytes, then if md is not NULL md[k] gets 32 bytes of its digest */
+/* Contexts are not wiped as by EVP_DigestFinal_ex and may be reset with EVP_DigestInit_ex(ctx, NULL, NULL). Messages of any length are hashed side by side */
+#define DSTU_ENGINE_DIGEST_BATCH (ENGINE_CMD_BASE + 2)
+
+/* ENGINE ctrl command "RBG_REFILL" to choose how DSTU RBG output is generated ahead: p should point to mode name, i is not used */
+/* "off" (default) generates output when asked. "watermark" keeps a buffer per thread, refilled by the calling thread when it runs low, */
+/* so most requests are served by a copy. "background" refills the buffers in a background thread, off the callers' path. */
+/* A forked child seeds its generators again and refills at the watermark, as the thread is not forked */
+#define DSTU_ENGINE_RBG_REFILL (ENGINE_CMD_BASE + 3)
+
+/* ENGINE ctrl command "KEY_MASK" to select where DSTU 28147 key masks come from: p should point to source name, i is not used */
+/* "drbg" (default) is OpenSSL's own private DRBG, "rand" is RAND_priv_bytes, which is this engine's RBG when it is the default RAND */
+/* DSTU_KEY_MASK environment variable does the same when the engine is bound */
+#define DSTU_ENGINE_KEY_MASK (ENGINE_CMD_BASE + 4)
+
+/* ENGINE ctrl command "RBG_MODE" to choose the DSTU RBG generator: p should point to mode name, i is not used */
+/* "serial" (default) is one generator per thread. "lanes" runs 16 generators, each seeded on its own and stepped as specified, */
+/* in lockstep on the multi-key GOST kernels, and interleaves their output bits, for bulk key generation */
+#define DSTU_ENGINE_RBG_MODE (ENGINE_CMD_BASE + 5)
+
+/* ENGINE ctrl command "NONCE_POOL" to precompute DSTU 4145 signing nonces: i is the number of pairs kept per named curve, p is not used */
+/* 0 (default) computes them when signing. Otherwise a background thread keeps e and x(eG) ready for every curve signed with, */
+/* each pair is used once and wiped, so signing does only a few multiplications. Pairs are not used in a forked child */
+#define DSTU_ENGINE_NONCE_POOL (ENGINE_CMD_BASE + 6)
+
+/* ENGINE ctrl command "PBES2" to run PBES2 key derivation with HMAC-DSTU34311 on the engine: i is 1 to turn it on, p is not used */
+/* Off (default), OpenSSL builtin PBES2 derives keys with the engine digest. On replaces the builtin PBES2 for the whole process */
+/* and cannot be turned off, other PRFs then go to PKCS5_v2_PBE_keyivgen, which on OpenSSL 3 uses the default library context */
+#define DSTU_ENGINE_PBES2 (ENGINE_CMD_BASE + 7)
+
+typedef struct
+{
+    EVP_MD_CTX **ctx;
+    const unsigned char **in;
+    const size_t *inl;
+    unsigned char **md;
+    size_t count;
+} DSTU_DIGEST_BATCH;
+
+/* ctrl commands to move DSTU 28147 gamma (counter) mode cipher to a byte offset in its keystream and to get the current offset */
+/* p2 should point to uint64_t, p1 is not used */
+#define DSTU_SET_CIPHER_POSITION (EVP_MD_CTRL_ALG_CTRL + 3)
+#define DSTU_GET_CIPHER_POSITION (EVP_MD_CTRL_ALG_CTRL + 4)
+
+/* MD ctrl commands for DSTU 28147 MAC (see mac.h) */
+/* Set 256 bit key and start new message: p2 should point to 32 bytes of key, p1 should be set to 32 */
+/* Key, s-boxes and MAC length survive EVP_DigestInit_ex(ctx, NULL, NULL), which starts a new message. EVP_DigestFinal_ex wipes the context, */
+/* so to MAC many messages keep one keyed context and EVP_MD_CTX_copy_ex it for every message, no key or s-box setup is repeated */
+#define DSTU_SET_MAC_KEY (EVP_MD_CTRL_ALG_CTRL + 5)
+/* Set MAC length in bits: p1 from 1 to 64, 32 by default. p2 is not used */
+#define DSTU_SET_MAC_LENGTH (EVP_MD_CTRL_ALG_CTRL + 6)
+
+/* MD ctrl commands to save and restore DSTU 34311 midstate, e.g. to hash a common prefix once or to resume hashing later */
+/* State is DSTU_HASH_STATE_SIZE bytes: versioned hash state (first byte is the format version, 1 for now) followed by 64 bytes of packed s-box */
+/* p2 should point to the buffer, p1 should be set to its size. Setting the state also sets the s-boxes it was saved with */
+#define DSTU_GET_HASH_STATE (EVP_MD_CTRL_ALG_CTRL + 7)
+#define DSTU_SET_HASH_STATE (EVP_MD_CTRL_ALG_CTRL + 8)
+#define DSTU_HASH_STATE_SIZE 170
@@ -1,12 +1,18 @@
 #include "md.h"
+#include "mac.h"
 #include "cipher.h"
 #include "rbg.h"
+#include "nonce.h"
 #include "pmeth.h"
 #include "ameth.h"
+#include "pbe.h"
 #include "err.h"
 
+#include "gost/gost89.h" // gost_set_impl
+
 #include <openssl/engine.h>
 
+#include <stdlib.h>
 #include <string.h>
 
 static const char *engine_dstu_id = "dstu";
@@ -17,13 +23,28 @@ static int dstu_nids[] =
 {
     NID_dstu4145le, NID_dstu4145be
 };
+/* MAC NID is known only after bind */
 static int digest_nids[] =
 {
-    NID_dstu34311
+    NID_dstu34311, NID_undef
 };
+/* CFB with MAC NID is known only after bind */
 static int cipher_nids[] =
 {
-    NID_dstu28147_cfb
+    NID_dstu28147_cfb, NID_dstu28147_ofb, NID_undef
+};
+
+static const ENGINE_CMD_DEFN dstu_cmd_defns[] =
+{
+    {DSTU_ENGINE_CIPHER_BATCH, "CIPHER_BATCH", "Process several DSTU 28147 CFB contexts at once (DSTU_CIPHER_BATCH)", ENGINE_CMD_FLAG_INTERNAL},
+    {DSTU_ENGINE_GOST_IMPL, "GOST_IMPL", "GOST 28147 implementation: auto, scalar, table, ssse3, avx2, avx512 or bitslice", ENGINE_CMD_FLAG_STRING},
+    {DSTU_ENGINE_DIGEST_BATCH, "DIGEST_BATCH", "Process several DSTU 34311 contexts at once (DSTU_DIGEST_BATCH)", ENGINE_CMD_FLAG_INTERNAL},
+    {DSTU_ENGINE_RBG_REFILL, "RBG_REFILL", "DSTU RBG output buffering: off, watermark or background", ENGINE_CMD_FLAG_STRING},
+    {DSTU_ENGINE_KEY_MASK, "KEY_MASK", "Source of DSTU 28147 key masks: drbg or rand", ENGINE_CMD_FLAG_STRING},
+    {DSTU_ENGINE_RBG_MODE, "RBG_MODE", "DSTU RBG generator: serial or lanes", ENGINE_CMD_FLAG_STRING},
+    {DSTU_ENGINE_NONCE_POOL, "NONCE_POOL", "DSTU 4145 signing nonces precomputed per curve, 0 for none", ENGINE_CMD_FLAG_NUMERIC},
+    {DSTU_ENGINE_PBES2, "PBES2", "1 replaces builtin PBES2 for PBKDF2 with HMAC-DSTU34311 process-wide, for good", ENGINE_CMD_FLAG_NUMERIC},
+    {0, NULL, NULL, 0}
 };
 
 static const int DSTU_ENGINE_FLAGS =
@@ -31,7 +52,12 @@ static const int DSTU_ENGINE_FLAGS =
     ENGINE_METHOD_DIGESTS | ENGINE_METHOD_CIPHERS | ENGINE_METHOD_RAND;
 
 static EVP_MD *dstu_md = NULL;
+static EVP_MD *dstu_mac = NULL;
+static int dstu_mac_nid = NID_undef;
 static EVP_CIPHER *dstu_cipher = NULL;
+static EVP_CIPHER *dstu_cipher_ctr = NULL;
+static EVP_CIPHER *dstu_cipher_mac = NULL;
+static int dstu_cipher_mac_nid = NID_undef;
 static EVP_PKEY_METHOD *dstu_pkey_methods[] = {NULL, NULL};
 static EVP_PKEY_ASN1_METHOD *dstu_asn1_methods[] = {NULL, NULL};
 
@@ -42,6 +68,13 @@ static EVP_MD *dstu_md_get()
     return dstu_md;
 }
 
+static EVP_MD *dstu_mac_get()
+{
+    if (dstu_mac == NULL)
+        dstu_mac = dstu_mac_new(dstu_mac_nid);
+    return dstu_mac;
+}
+
 static EVP_CIPHER *dstu_cipher_get()
 {
     if (dstu_cipher == NULL)
@@ -49,6 +82,20 @@ static EVP_CIPHER *dstu_cipher_get()
     return dstu_cipher;
 }
 
+static EVP_CIPHER *dstu_cipher_ctr_get()
+{
+    if (dstu_cipher_ctr == NULL)
+        dstu_cipher_ctr = dstu_cipher_ctr_new();
+    return dstu_cipher_ctr;
+}
+
+static EVP_CIPHER *dstu_cipher_mac_get()
+{
+    if (dstu_cipher_mac == NULL)
+        dstu_cipher_mac = dstu_cipher_mac_new(dstu_cipher_mac_nid);
+    return dstu_cipher_mac;
+}
+
 static EVP_PKEY_METHOD *dstu_pkey_meth_get(int nid)
 {
     int i = 0;
@@ -89,14 +136,119 @@ static int dstu_engine_init(ENGINE *e)
 static int dstu_engine_finish(ENGINE *e)
 {
     int i;
+    /* Background refill must not outlive the engine */
+    dstu_rbg_set_refill(DSTU_RBG_REFILL_OFF);
+    dstu_nonce_pool_set_size(0);
     dstu_cipher_free(dstu_cipher);
+    dstu_cipher_free(dstu_cipher_ctr);
+    dstu_cipher_free(dstu_cipher_mac);
     dstu_digest_free(dstu_md);
+    dstu_mac_free(dstu_mac);
 
     ERR_unload_DSTU_strings();
 
     return 1;
 }
 
+static int dstu_set_gost_impl(const char *name)
+{
+    if (!gost_set_impl(gost_impl_by_name(name)))
+    {
+        DSTUerr(DSTU_F_DSTU_ENGINE_CTRL, DSTU_R_UNSUPPORTED_GOST_IMPL);
+        return 0;
+    }
+    return 1;
+}
+
+static int dstu_set_key_mask(const char *name)
+{
+    if (!gost_set_mask_source(gost_mask_source_by_name(name)))
+    {
+        DSTUerr(DSTU_F_DSTU_ENGINE_CTRL, DSTU_R_UNSUPPORTED_KEY_MASK);
+        return 0;
+    }
+    return 1;
+}
+
+static int dstu_set_rbg_mode(const char *name)
+{
+    if (!dstu_rbg_set_mode(dstu_rbg_mode_by_name(name)))
+    {
+        DSTUerr(DSTU_F_DSTU_ENGINE_CTRL, DSTU_R_UNSUPPORTED_RBG_MODE);
+        return 0;
+    }
+    return 1;
+}
+
+static int dstu_set_rbg_refill(const char *name)
+{
+    if (!dstu_rbg_set_refill(dstu_rbg_refill_by_name(name)))
+    {
+        DSTUerr(DSTU_F_DSTU_ENGINE_CTRL, DSTU_R_UNSUPPORTED_RBG_REFILL);
+        return 0;
+    }
+    return 1;
+}
+
+static int dstu_set_nonce_pool(long size)
+{
+    if ((size > DSTU_NONCE_POOL_MAX) || !dstu_nonce_pool_set_size((int) size))
+    {
+        DSTUerr(DSTU_F_DSTU_ENGINE_CTRL, DSTU_R_UNSUPPORTED_NONCE_POOL);
+        return 0;
+    }
+    return 1;
+}
+
+/* PBES2 handler replaces the builtin one for the whole process, so it is added on request only and once */
+static CRYPTO_ONCE pbes2_once = CRYPTO_ONCE_STATIC_INIT;
+static int pbes2_added = 0;
+
+static void do_pbes2_add(void)
+{
+    pbes2_added = EVP_PBE_alg_add_type(EVP_PBE_TYPE_OUTER, NID_pbes2, -1, -1, dstu_pbes2_keyivgen);
+}
+
+static int dstu_set_pbes2(long on)
+{
+    if (on == 1 && CRYPTO_THREAD_run_once(&pbes2_once, do_pbes2_add) && pbes2_added)
+        return 1;
+    /* Builtin PBES2 cannot be restored */
+    if (!on && !pbes2_added)
+        return 1;
+    DSTUerr(DSTU_F_DSTU_ENGINE_CTRL, DSTU_R_UNSUPPORTED_PBES2);
+    return 0;
+}
+
+static int dstu_engine_ctrl(ENGINE *e, int cmd, long i, void *p, void (*f)(void))
+{
+    (void) e;
+    (void) f;
+
+    switch (cmd)
+    {
+        case DSTU_ENGINE_CIPHER_BATCH:
+            return dstu_cipher_batch(p);
+        case DSTU_ENGINE_DIGEST_BATCH:
+            return dstu_digest_batch(p);
+        case DSTU_ENGINE_GOST_IMPL:
+            return dstu_set_gost_impl(p);
+        case DSTU_ENGINE_RBG_REFILL:
+            return dstu_set_rbg_refill(p);
+        case DSTU_ENGINE_KEY_MASK:
+            return dstu_set_key_mask(p);
+        case DSTU_ENGINE_RBG_MODE:
+            return dstu_set_rbg_mode(p);
+        case DSTU_ENGINE_NONCE_POOL:
+            return dstu_set_nonce_pool(i);
+        case DSTU_ENGINE_PBES2:
+            return dstu_set_pbes2(i);
+    }
+
+    DSTUerr(DSTU_F_DSTU_ENGINE_CTRL, DSTU_R_UNKNOWN_COMMAND);
+    return 0;
+}
+
 static int dstu_digests(ENGINE *e, const EVP_MD **digest, const int **nids,
                         int nid)
 {
@@ -107,6 +259,11 @@ static int dstu_digests(ENGINE *e, const EVP_MD **digest, const int **nids,
             *digest = dstu_md_get();
             return 1;
         }
+        else if (dstu_mac_nid != NID_undef && dstu_mac_nid == nid)
+        {
+            *digest = dstu_mac_get();
+            return 1;
+        }
         else
             return 0;
     }
@@ -115,7 +272,7 @@ static int dstu_digests(ENGINE *e, const EVP_MD **digest, const int **nids,
         if (!nids)
             return -1;
         *nids = digest_nids;
-        return 1;
+        return dstu_mac_nid != NID_undef ? 2 : 1;
     }
 }
 
@@ -129,6 +286,16 @@ static int dstu_ciphers(ENGINE *e, const EVP_CIPHER **cipher, const int **nids,
             *cipher = dstu_cipher_get();
             return 1;
         }
+        else if (NID_dstu28147_ofb == nid)
+        {
+            *cipher = dstu_cipher_ctr_get();
+            return 1;
+        }
+        else if (dstu_cipher_mac_nid != NID_undef && dstu_cipher_mac_nid == nid)
+        {
+            *cipher = dstu_cipher_mac_get();
+            return 1;
+        }
         else
             return 0;
     }
@@ -137,7 +304,7 @@ static int dstu_ciphers(ENGINE *e, const EVP_CIPHER **cipher, const int **nids,
         if (!nids)
             return -1;
         *nids = cipher_nids;
-        return 1;
+        return sizeof(cipher_nids) / sizeof(int) - (dstu_cipher_mac_nid == NID_undef ? 1 : 0);
     }
 }
 
@@ -173,15 +340,76 @@ static int dstu_asn1_meths(ENGINE *e, EVP_PKEY_ASN1_METHOD **ameth,
     return 0;
 }
 
+static int dstu_mac_nid_init()
+{
+    if (dstu_mac_nid == NID_undef)
+        dstu_mac_nid = OBJ_txt2nid(DSTU_MAC_OID);
+    if (dstu_mac_nid == NID_undef)
+        dstu_mac_nid = OBJ_create(DSTU_MAC_OID, DSTU_MAC_SN, DSTU_MAC_LN);
+    digest_nids[1] = dstu_mac_nid;
+    return dstu_mac_nid != NID_undef;
+}
+
+/* There is no OID for CFB with MAC, so its object has names only */
+static int dstu_cipher_mac_nid_init()
+{
+    ASN1_OBJECT *obj;
+    int nid;
+
+    if (dstu_cipher_mac_nid == NID_undef)
+        dstu_cipher_mac_nid = OBJ_sn2nid(DSTU_CIPHER_MAC_SN);
+    if (dstu_cipher_mac_nid == NID_undef)
+    {
+        nid = OBJ_new_nid(1);
+        obj = ASN1_OBJECT_create(nid, NULL, 0, DSTU_CIPHER_MAC_SN, DSTU_CIPHER_MAC_LN);
+        if (obj && OBJ_add_object(obj) != NID_undef)
+            dstu_cipher_mac_nid = nid;
+        ASN1_OBJECT_free(obj);
+    }
+    cipher_nids[2] = dstu_cipher_mac_nid;
+    return dstu_cipher_mac_nid != NID_undef;
+}
+
+/* Kernels are picked once for the CPU, unless DSTU_GOST_IMPL names a supported one. DSTU_KEY_MASK picks mask source */
+static void dstu_gost_impl_init()
+{
+    const char *name = getenv("DSTU_GOST_IMPL");
+
+    if (!name || !gost_set_impl(gost_impl_by_name(name)))
+        gost_set_impl(GOST_IMPL_AUTO);
+
+    /* Unknown DSTU_KEY_MASK keeps the default */
+    gost_set_mask_source(gost_mask_source_by_name(getenv("DSTU_KEY_MASK")));
+}
+
+/* Adding our algorithms to support PBKDF2, once however many times the engine is bound */
+static CRYPTO_ONCE prf_once = CRYPTO_ONCE_STATIC_INIT;
+static int prf_added = 0;
+
+static void do_prf_add(void)
+{
+    prf_added = EVP_PBE_alg_add_type(EVP_PBE_TYPE_PRF, NID_hmacWithDstu34311, -1, NID_dstu34311, NULL);
+}
+
 static int dstu_bind(ENGINE *e, const char *id)
 {
     if (id && strcmp(id, engine_dstu_id))
         return 0;
 
+    dstu_gost_impl_init();
+
+    if (!dstu_mac_nid_init() || !dstu_cipher_mac_nid_init())
+    {
+        DSTUerr(DSTU_F_BIND_DSTU, ERR_R_OBJ_LIB);
+        return 0;
+    }
+
     if (!ENGINE_set_id(e, engine_dstu_id) ||
         !ENGINE_set_name(e, engine_dstu_name) ||
         !ENGINE_set_init_function(e, dstu_engine_init) ||
         !ENGINE_set_finish_function(e, dstu_engine_finish) ||
+        !ENGINE_set_ctrl_function(e, dstu_engine_ctrl) ||
+        !ENGINE_set_cmd_defns(e, dstu_cmd_defns) ||
         !ENGINE_set_digests(e, dstu_digests) ||
         !ENGINE_set_ciphers(e, dstu_ciphers) ||
         !ENGINE_set_RAND(e, &dstu_rand_meth) ||
@@ -193,8 +421,11 @@ static int dstu_bind(ENGINE *e, const char *id)
         !ENGINE_register_pkey_meths(e) ||
         !ENGINE_register_pkey_asn1_meths(e) ||
         !EVP_add_digest(dstu_md_get()) ||
+        !EVP_add_digest(dstu_mac_get()) ||
         !EVP_add_cipher(dstu_cipher_get()) ||
-        !EVP_PBE_alg_add_type(EVP_PBE_TYPE_PRF, NID_hmacWithDstu34311, -1, NID_dstu34311, NULL)) /* Adding our algorithms to support PBKDF2 */
+        !EVP_add_cipher(dstu_cipher_ctr_get()) ||
+        !EVP_add_cipher(dstu_cipher_mac_get()) ||
+        !CRYPTO_THREAD_run_once(&prf_once, do_prf_add) || !prf_added)
     {
         DSTUerr(DSTU_F_BIND_DSTU, ERR_R_EVP_LIB);
         return 0;
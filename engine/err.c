@@ -73,8 +73,12 @@ static ERR_STRING_DATA DSTU_str_functs[] =
     {ERR_FUNC(DSTU_F_DSTU_ASN1_PRIV_ENCODE),  "DSTU_ASN1_PRIV_ENCODE"},
     {ERR_FUNC(DSTU_F_DSTU_ASN1_PUB_DECODE),   "DSTU_ASN1_PUB_DECODE"},
     {ERR_FUNC(DSTU_F_DSTU_ASN1_PUB_ENCODE),   "DSTU_ASN1_PUB_ENCODE"},
+    {ERR_FUNC(DSTU_F_DSTU_CIPHER_BATCH),      "DSTU_CIPHER_BATCH"},
+    {ERR_FUNC(DSTU_F_DSTU_DIGEST_BATCH),      "DSTU_DIGEST_BATCH"},
     {ERR_FUNC(DSTU_F_DSTU_DO_SIGN),           "DSTU_DO_SIGN"},
     {ERR_FUNC(DSTU_F_DSTU_DO_VERIFY),         "DSTU_DO_VERIFY"},
+    {ERR_FUNC(DSTU_F_DSTU_ENGINE_CTRL),       "DSTU_ENGINE_CTRL"},
+    {ERR_FUNC(DSTU_F_DSTU_PBES2_KEYIVGEN),    "DSTU_PBES2_KEYIVGEN"},
     {ERR_FUNC(DSTU_F_DSTU_PKEY_CTRL),         "DSTU_PKEY_CTRL"},
     {ERR_FUNC(DSTU_F_DSTU_PKEY_INIT_BE),      "DSTU_PKEY_INIT_BE"},
     {ERR_FUNC(DSTU_F_DSTU_PKEY_INIT_LE),      "DSTU_PKEY_INIT_LE"},
@@ -90,11 +94,20 @@ static ERR_STRING_DATA DSTU_str_reasons[] =
     {ERR_REASON(DSTU_R_ASN1_PARAMETER_ENCODE_FAILED), "asn1 parameter encode failed"},
     {ERR_REASON(DSTU_R_INCORRECT_FIELD_TYPE) ,        "incorrect field type"},
     {ERR_REASON(DSTU_R_INVALID_ASN1_PARAMETERS),      "invalid asn1 parameters"},
+    {ERR_REASON(DSTU_R_INVALID_CIPHER_BATCH),         "invalid cipher batch"},
+    {ERR_REASON(DSTU_R_INVALID_DIGEST_BATCH),         "invalid digest batch"},
     {ERR_REASON(DSTU_R_INVALID_DIGEST_TYPE),          "invalid digest type"},
     {ERR_REASON(DSTU_R_NOT_DSTU_KEY),                 "not dstu key"},
     {ERR_REASON(DSTU_R_PMETH_INIT_FAILED),            "pmeth init failed"},
     {ERR_REASON(DSTU_R_POINT_COMPRESS_FAILED),        "point compress failed"},
     {ERR_REASON(DSTU_R_POINT_UNCOMPRESS_FAILED),      "point uncompress failed"},
+    {ERR_REASON(DSTU_R_UNKNOWN_COMMAND),              "unknown command"},
+    {ERR_REASON(DSTU_R_UNSUPPORTED_GOST_IMPL),        "unsupported GOST implementation"},
+    {ERR_REASON(DSTU_R_UNSUPPORTED_KEY_MASK),         "unsupported key mask source"},
+    {ERR_REASON(DSTU_R_UNSUPPORTED_NONCE_POOL),       "unsupported nonce pool size"},
+    {ERR_REASON(DSTU_R_UNSUPPORTED_PBES2),            "unsupported PBES2 setting"},
+    {ERR_REASON(DSTU_R_UNSUPPORTED_RBG_MODE),         "unsupported RBG mode"},
+    {ERR_REASON(DSTU_R_UNSUPPORTED_RBG_REFILL),       "unsupported RBG refill mode"},
     {0, NULL}
 };
 
@@ -21,6 +21,9 @@ void ERR_DSTU_error(int function, int reason, char *file, int line);
 
 /* Function codes. */
 #define DSTU_F_BIND_DSTU              100
+#define DSTU_F_DSTU_CIPHER_BATCH      117
+#define DSTU_F_DSTU_DIGEST_BATCH      119
+#define DSTU_F_DSTU_ENGINE_CTRL       118
 #define DSTU_F_DSTU_ASN1_PARAM_COPY   102
 #define DSTU_F_DSTU_ASN1_PARAM_DECODE 101
 #define DSTU_F_DSTU_ASN1_PARAM_ENCODE 103
@@ -31,6 +34,7 @@ void ERR_DSTU_error(int function, int reason, char *file, int line);
 #define DSTU_F_DSTU_ASN1_PUB_ENCODE   108
 #define DSTU_F_DSTU_DO_SIGN           109
 #define DSTU_F_DSTU_DO_VERIFY         110
+#define DSTU_F_DSTU_PBES2_KEYIVGEN    120
 #define DSTU_F_DSTU_PKEY_CTRL         116
 #define DSTU_F_DSTU_PKEY_INIT_BE      111
 #define DSTU_F_DSTU_PKEY_INIT_LE      112
@@ -43,11 +47,20 @@ void ERR_DSTU_error(int function, int reason, char *file, int line);
 #define DSTU_R_ASN1_PARAMETER_ENCODE_FAILED 103
 #define DSTU_R_INCORRECT_FIELD_TYPE         107
 #define DSTU_R_INVALID_ASN1_PARAMETERS      102
+#define DSTU_R_INVALID_CIPHER_BATCH         109
+#define DSTU_R_INVALID_DIGEST_BATCH         112
 #define DSTU_R_INVALID_DIGEST_TYPE          108
 #define DSTU_R_NOT_DSTU_KEY                 104
 #define DSTU_R_PMETH_INIT_FAILED            101
 #define DSTU_R_POINT_COMPRESS_FAILED        105
 #define DSTU_R_POINT_UNCOMPRESS_FAILED      106
+#define DSTU_R_UNKNOWN_COMMAND              110
+#define DSTU_R_UNSUPPORTED_GOST_IMPL        111
+#define DSTU_R_UNSUPPORTED_KEY_MASK         114
+#define DSTU_R_UNSUPPORTED_NONCE_POOL       116
+#define DSTU_R_UNSUPPORTED_PBES2            117
+#define DSTU_R_UNSUPPORTED_RBG_MODE         115
+#define DSTU_R_UNSUPPORTED_RBG_REFILL       113
 
 #ifdef  __cplusplus
 }
@@ -0,0 +1,151 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+#include "mac.h"
+#include "params.h" // default_sbox
+#include "sbox.h" // dstu_sbox_*
+#include "control.h"
+
+#include "gost/gost89.h" // gost_ctx, gost_mac_*
+
+#include <string.h>
+
+/* MAC is up to 64 bits, EVP always gets all of them with bits past MAC length zeroed */
+#define DSTU_MAC_SIZE 8
+#define DSTU_MAC_DEFAULT_BITS 32
+
+struct dstu_mac_ctx
+{
+    gost_mac_ctx mctx;
+    gost_ctx cctx;
+    int mac_bits;
+    int key_set;
+};
+
+static int dstu_mac_init(EVP_MD_CTX *ctx)
+{
+    const gost_kbox *kbox;
+    struct dstu_mac_ctx *c = EVP_MD_CTX_md_data(ctx);
+
+    /* Reinitialization keeps key, s-boxes and MAC length, so keyed context is reused for next message as is */
+    if (!c->cctx.kbox)
+    {
+        kbox = dstu_sbox_get(default_sbox);
+        if (!kbox)
+            return 0;
+        gost_init(&(c->cctx), kbox);
+        c->mac_bits = DSTU_MAC_DEFAULT_BITS;
+    }
+
+    gost_mac_start(&(c->mctx), &(c->cctx));
+    return 1;
+}
+
+static int dstu_mac_update(EVP_MD_CTX *ctx, const void *data, size_t count)
+{
+    struct dstu_mac_ctx *c = EVP_MD_CTX_md_data(ctx);
+
+    if (!c->key_set)
+        return 0;
+
+    gost_mac_update(&(c->mctx), data, count);
+    return 1;
+}
+
+static int dstu_mac_final(EVP_MD_CTX *ctx, unsigned char *md)
+{
+    struct dstu_mac_ctx *c = EVP_MD_CTX_md_data(ctx);
+
+    if (!c->key_set)
+        return 0;
+
+    memset(md, 0, DSTU_MAC_SIZE);
+    gost_mac_finish(&(c->mctx), c->mac_bits, md);
+    return 1;
+}
+
+static int dstu_mac_copy(EVP_MD_CTX *to, const EVP_MD_CTX *from)
+{
+    struct dstu_mac_ctx *to_ctx = EVP_MD_CTX_md_data(to);
+    struct dstu_mac_ctx *from_ctx = EVP_MD_CTX_md_data(from);
+    if (to_ctx && from_ctx)
+    {
+        memcpy(to_ctx, from_ctx, sizeof(struct dstu_mac_ctx));
+        to_ctx->mctx.cipher_ctx = &(to_ctx->cctx);
+        dstu_sbox_ref(to_ctx->cctx.kbox);
+    }
+    return 1;
+}
+
+static int dstu_mac_cleanup(EVP_MD_CTX *ctx)
+{
+    struct dstu_mac_ctx *c = EVP_MD_CTX_md_data(ctx);
+    if (c)
+    {
+        dstu_sbox_release(c->cctx.kbox);
+        OPENSSL_cleanse(c, sizeof(struct dstu_mac_ctx));
+    }
+    return 1;
+}
+
+static int dstu_mac_ctrl(EVP_MD_CTX *ctx, int cmd, int p1, void *p2)
+{
+    const gost_kbox *kbox;
+    struct dstu_mac_ctx *c = EVP_MD_CTX_md_data(ctx);
+
+    switch (cmd)
+    {
+        case DSTU_SET_MAC_KEY:
+            if ((!p2) || (32 != p1))
+                return 0;
+            gost_key(&(c->cctx), p2);
+            c->key_set = 1;
+            gost_mac_start(&(c->mctx), &(c->cctx));
+            return 1;
+        case DSTU_SET_MAC_LENGTH:
+            if ((p1 < 1) || (p1 > 8 * DSTU_MAC_SIZE))
+                return 0;
+            c->mac_bits = p1;
+            return 1;
+        case DSTU_SET_CUSTOM_SBOX:
+            if ((!p2) || (sizeof(default_sbox) != p1))
+                return 0;
+            kbox = dstu_sbox_get(p2);
+            if (!kbox)
+                return 0;
+            dstu_sbox_release(c->cctx.kbox);
+            gost_init(&(c->cctx), kbox);
+            gost_mac_start(&(c->mctx), &(c->cctx));
+            return 1;
+    }
+
+    return 0;
+}
+
+EVP_MD *dstu_mac_new(int nid)
+{
+    EVP_MD *res = EVP_MD_meth_new(nid, 0);
+    if (res == NULL)
+        return NULL;
+    if (!EVP_MD_meth_set_result_size(res, DSTU_MAC_SIZE) ||
+        !EVP_MD_meth_set_input_blocksize(res, 8) ||
+        !EVP_MD_meth_set_app_datasize(res, sizeof(struct dstu_mac_ctx)) ||
+        !EVP_MD_meth_set_flags(res, 0) ||
+        !EVP_MD_meth_set_init(res, dstu_mac_init) ||
+        !EVP_MD_meth_set_update(res, dstu_mac_update) ||
+        !EVP_MD_meth_set_final(res, dstu_mac_final) ||
+        !EVP_MD_meth_set_copy(res, dstu_mac_copy) ||
+        !EVP_MD_meth_set_cleanup(res, dstu_mac_cleanup) ||
+        !EVP_MD_meth_set_ctrl(res, dstu_mac_ctrl))
+    {
+        EVP_MD_meth_free(res);
+        return NULL;
+    }
+    return res;
+}
+
+void dstu_mac_free(EVP_MD *mac)
+{
+    EVP_MD_meth_free(mac);
+}
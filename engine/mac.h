@@ -0,0 +1,11 @@
+#pragma once
+
+#include <openssl/evp.h>
+
+/* DSTU 28147 MAC (imitovstavka) has no NID in OpenSSL, it is created on engine bind */
+#define DSTU_MAC_OID "1.2.804.2.1.1.1.1.1.1.4"
+#define DSTU_MAC_SN "dstu28147-mac"
+#define DSTU_MAC_LN "DSTU Gost 28147-2009 MAC"
+
+EVP_MD *dstu_mac_new(int nid);
+void dstu_mac_free(EVP_MD *mac);
@@ -4,13 +4,16 @@
  ==================================================================== */
 
 #include "md.h"
-#include "params.h" // default_sbox, unpack_sbox
+#include "params.h" // default_sbox
+#include "sbox.h" // dstu_sbox_*
 #include "key.h" // DSTU_KEY
 #include "control.h"
+#include "err.h"
 
 #include "gost/gosthash.h" // gost_hash_ctx
-#include "gost/gost89.h" // gost_subst_block
+#include "gost/gost89.h" // gost_ctx
 
+#include <limits.h>
 #include <string.h>
 
 struct dstu_digest_ctx
@@ -21,16 +24,21 @@ struct dstu_digest_ctx
 
 static int dstu_md_init(EVP_MD_CTX *ctx)
 {
-    gost_subst_block sbox;
+    const gost_kbox *kbox;
     struct dstu_digest_ctx *c = EVP_MD_CTX_md_data(ctx);
     EVP_PKEY_CTX *pkey_ctx = EVP_MD_CTX_pkey_ctx(ctx);
     EVP_PKEY *pkey = pkey_ctx ? EVP_PKEY_CTX_get0_pkey(pkey_ctx) : NULL;
     DSTU_KEY *dstu_key = pkey ? EVP_PKEY_get0(pkey) : NULL;
     unsigned char *sbox_source = dstu_key && dstu_key->sbox ? dstu_key->sbox : default_sbox;
 
-    unpack_sbox(sbox_source, &sbox);
+    kbox = dstu_sbox_get(sbox_source);
+    if (!kbox)
+        return 0;
+
+    /* Context may be reinitialized without cleanup */
+    dstu_sbox_release(c->cctx.kbox);
     memset(&(c->dctx), 0, sizeof(gost_hash_ctx));
-    gost_init(&(c->cctx), &sbox);
+    gost_init(&(c->cctx), kbox);
     c->dctx.cipher_ctx = &(c->cctx);
     return 1;
 }
@@ -53,6 +61,7 @@ static int dstu_md_copy(EVP_MD_CTX *to, const EVP_MD_CTX *from)
     {
         memcpy(to_ctx, from_ctx, sizeof(struct dstu_digest_ctx));
         to_ctx->dctx.cipher_ctx = &(to_ctx->cctx);
+        dstu_sbox_ref(to_ctx->cctx.kbox);
     }
     return 1;
 }
@@ -61,13 +70,16 @@ static int dstu_md_cleanup(EVP_MD_CTX *ctx)
 {
     struct dstu_digest_ctx *c = EVP_MD_CTX_md_data(ctx);
     if (c)
+    {
+        dstu_sbox_release(c->cctx.kbox);
         memset(c, 0, sizeof(struct dstu_digest_ctx));
+    }
     return 1;
 }
 
 static int dstu_md_ctrl(EVP_MD_CTX *ctx, int cmd, int p1, void *p2)
 {
-    gost_subst_block sbox;
+    const gost_kbox *kbox;
     struct dstu_digest_ctx *c = EVP_MD_CTX_md_data(ctx);
 
     switch (cmd)
@@ -75,8 +87,31 @@ static int dstu_md_ctrl(EVP_MD_CTX *ctx, int cmd, int p1, void *p2)
         case DSTU_SET_CUSTOM_SBOX:
             if ((!p2) || (sizeof(default_sbox) != p1))
                 return 0;
-            unpack_sbox((unsigned char *) p2, &sbox);
-            gost_init(&(c->cctx), &sbox);
+            kbox = dstu_sbox_get(p2);
+            if (!kbox)
+                return 0;
+            dstu_sbox_release(c->cctx.kbox);
+            gost_init(&(c->cctx), kbox);
+            return 1;
+        case DSTU_GET_HASH_STATE:
+            if ((!p2) || (p1 < DSTU_HASH_STATE_SIZE) || (!c->cctx.kbox))
+                return 0;
+            hash_export(&(c->dctx), p2);
+            memcpy((unsigned char *)p2 + GOST_HASH_STATE_SIZE, dstu_sbox_packed(c->cctx.kbox), sizeof(default_sbox));
+            return 1;
+        case DSTU_SET_HASH_STATE:
+            if ((!p2) || (DSTU_HASH_STATE_SIZE != p1))
+                return 0;
+            kbox = dstu_sbox_get((unsigned char *)p2 + GOST_HASH_STATE_SIZE);
+            if (!kbox)
+                return 0;
+            if (!hash_import(&(c->dctx), p2, GOST_HASH_STATE_SIZE))
+            {
+                dstu_sbox_release(kbox);
+                return 0;
+            }
+            dstu_sbox_release(c->cctx.kbox);
+            gost_init(&(c->cctx), kbox);
             return 1;
     }
 
@@ -109,3 +144,71 @@ void dstu_digest_free(EVP_MD *digest)
 {
     EVP_MD_meth_free(digest);
 }
+
+static int dstu_digest_batch_valid(const DSTU_DIGEST_BATCH *batch)
+{
+    EVP_MD_CTX *ctx;
+    size_t i;
+
+    if (!batch)
+        return 0;
+
+    if (batch->count > INT_MAX)
+        return 0;
+
+    if (batch->count && ((!batch->ctx) || (!batch->in) || (!batch->inl)))
+        return 0;
+
+    for (i = 0; i < batch->count; i++)
+    {
+        ctx = batch->ctx[i];
+        if ((!ctx) || (!EVP_MD_CTX_md(ctx)) || (!EVP_MD_CTX_md_data(ctx)) || (NID_dstu34311 != EVP_MD_type(EVP_MD_CTX_md(ctx))))
+            return 0;
+        if (batch->inl[i] && (!batch->in[i]))
+            return 0;
+        if (batch->md && (!batch->md[i]))
+            return 0;
+    }
+
+    return 1;
+}
+
+/* Same as dstu_md_update (and dstu_md_final) on every context of the batch, but all of them go through hash_block_multi together */
+int dstu_digest_batch(const DSTU_DIGEST_BATCH *batch)
+{
+    gost_hash_ctx **hctx = NULL;
+    int ret = 0;
+    size_t i;
+
+    if (!dstu_digest_batch_valid(batch))
+    {
+        DSTUerr(DSTU_F_DSTU_DIGEST_BATCH, DSTU_R_INVALID_DIGEST_BATCH);
+        return 0;
+    }
+
+    if (!batch->count)
+        return 1;
+
+    hctx = OPENSSL_malloc(batch->count * sizeof(*hctx));
+    if (!hctx)
+    {
+        DSTUerr(DSTU_F_DSTU_DIGEST_BATCH, ERR_R_MALLOC_FAILURE);
+        return 0;
+    }
+
+    for (i = 0; i < batch->count; i++)
+        hctx[i] = EVP_MD_CTX_md_data(batch->ctx[i]);
+
+    if (!hash_block_multi(hctx, batch->in, batch->inl, (int)batch->count))
+        goto err;
+    if (batch->md && (!finish_hash_multi(hctx, batch->md, (int)batch->count)))
+        goto err;
+
+    ret = 1;
+
+err:
+    if (!ret)
+        DSTUerr(DSTU_F_DSTU_DIGEST_BATCH, ERR_R_INTERNAL_ERROR);
+    OPENSSL_free(hctx);
+    return ret;
+}
@@ -2,5 +2,8 @@
 
 #include <openssl/evp.h>
 
+#include "control.h" // DSTU_DIGEST_BATCH
+
 EVP_MD *dstu_digest_new();
 void dstu_digest_free(EVP_MD *digest);
+int dstu_digest_batch(const DSTU_DIGEST_BATCH *batch);
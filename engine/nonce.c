@@ -0,0 +1,336 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+#include "nonce.h"
+#include "params.h" // curve_nid_from_group, dstu_curves, named_curve_group
+#include "fixedbase.h" // dstu_generator_mul
+
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <openssl/obj_mac.h>
+
+#if defined(_WIN32)
+#define DSTU_NONCE_NO_WORKER
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include <string.h>
+
+#ifndef DSTU_NONCE_NO_WORKER
+
+/* Order and field of the largest named curve fit in that many bytes */
+#define DSTU_NONCE_BYTES 54
+
+/* e and x(eG), little-endian */
+typedef struct
+{
+    unsigned char e[DSTU_NONCE_BYTES];
+    unsigned char Fe[DSTU_NONCE_BYTES];
+} DSTU_NONCE;
+
+/* Ready pairs of a named curve are pairs[0 .. count - 1] */
+typedef struct
+{
+    DSTU_NONCE *pairs;
+    size_t count;
+    /* Only curves somebody signs with are filled */
+    int used;
+} DSTU_NONCE_POOL;
+
+/* Pools, pool_pid and worker_stop are guarded by pool_mutex, the worker waits on pool_cond */
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static DSTU_NONCE_POOL pools[DSTU_CURVE_COUNT];
+static size_t pool_size = 0;
+static int worker_stop = 0;
+/* Process that filled the pools, 0 when they are off. A forked child must not sign with the nonces of its parent */
+static pid_t pool_pid = 0;
+/* Resizes, worker start and stop are serialized by worker_mutex, which guards worker_thread and worker_running */
+static pthread_mutex_t worker_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t worker_thread;
+static int worker_running = 0;
+static CRYPTO_ONCE pool_hooks = CRYPTO_ONCE_STATIC_INIT;
+
+/* Same as dstu_do_sign draws its nonces */
+static int nonce_compute(int curve, DSTU_NONCE *nonce, BN_CTX *ctx)
+{
+    const EC_GROUP *group = named_curve_group(curve);
+    BIGNUM *e, *Fe;
+    EC_POINT *eG = NULL;
+    int ret = 0;
+
+    if (!group)
+        return 0;
+
+    BN_CTX_start(ctx);
+    e = BN_CTX_get(ctx);
+    Fe = BN_CTX_get(ctx);
+    if (!Fe)
+        goto err;
+
+    eG = EC_POINT_new(group);
+    if (!eG)
+        goto err;
+
+    do
+    {
+        if (!BN_rand_range(e, EC_GROUP_get0_order(group)))
+            goto err;
+
+        if (!dstu_generator_mul(group, eG, e, ctx))
+            goto err;
+
+        if (!EC_POINT_get_affine_coordinates_GF2m(group, eG, Fe, NULL, ctx))
+            goto err;
+    }
+    while (BN_is_zero(Fe));
+
+    if ((BN_bn2lebinpad(e, nonce->e, DSTU_NONCE_BYTES) < 0) || (BN_bn2lebinpad(Fe, nonce->Fe, DSTU_NONCE_BYTES) < 0))
+        goto err;
+
+    ret = 1;
+
+    err:
+
+    if (eG)
+        EC_POINT_clear_free(eG);
+    BN_clear(e);
+    BN_CTX_end(ctx);
+    return ret;
+}
+
+/* Curve to top up, -1 if all used ones are full. pool_mutex is held */
+static int nonce_pool_short(void)
+{
+    int i;
+
+    for (i = 0; i < DSTU_CURVE_COUNT; i++)
+    {
+        if (pools[i].used && pools[i].count < pool_size)
+            return i;
+    }
+    return -1;
+}
+
+/* Computes pairs one at a time outside the mutex, so that signers taking them do not wait */
+static void *dstu_nonce_worker(void *arg)
+{
+    BN_CTX *ctx = BN_CTX_new();
+    DSTU_NONCE nonce;
+    int curve, ok;
+
+    (void) arg;
+
+    pthread_mutex_lock(&pool_mutex);
+    while (!worker_stop)
+    {
+        curve = ctx ? nonce_pool_short() : -1;
+        if (curve < 0)
+        {
+            pthread_cond_wait(&pool_cond, &pool_mutex);
+            continue;
+        }
+
+        pthread_mutex_unlock(&pool_mutex);
+        ok = nonce_compute(curve, &nonce, ctx);
+        pthread_mutex_lock(&pool_mutex);
+
+        if (ok && pools[curve].count < pool_size)
+            pools[curve].pairs[pools[curve].count++] = nonce;
+        OPENSSL_cleanse(&nonce, sizeof(nonce));
+
+        /* Failed to draw a nonce, retry when the next one is taken */
+        if (!ok && !worker_stop)
+            pthread_cond_wait(&pool_cond, &pool_mutex);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    BN_CTX_free(ctx);
+    return NULL;
+}
+
+/* worker_mutex is held */
+static void dstu_nonce_stop_worker(void)
+{
+    if (!worker_running)
+        return;
+    pthread_mutex_lock(&pool_mutex);
+    worker_stop = 1;
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&pool_mutex);
+    pthread_join(worker_thread, NULL);
+    worker_running = 0;
+}
+
+/* Resizes every pool keeping as many ready pairs as fit, size 0 wipes them all. pool_mutex is held */
+static int nonce_pool_resize(size_t size)
+{
+    DSTU_NONCE *pairs[DSTU_CURVE_COUNT];
+    int i;
+
+    for (i = 0; i < DSTU_CURVE_COUNT; i++)
+    {
+        pairs[i] = NULL;
+        if (size && !(pairs[i] = OPENSSL_zalloc(size * sizeof(DSTU_NONCE))))
+        {
+            while (i--)
+                OPENSSL_free(pairs[i]);
+            return 0;
+        }
+    }
+
+    for (i = 0; i < DSTU_CURVE_COUNT; i++)
+    {
+        /* Pairs of another process are never kept */
+        if (pool_pid != getpid())
+            pools[i].count = 0;
+        if (pools[i].count > size)
+            pools[i].count = size;
+        if (pools[i].count)
+            memcpy(pairs[i], pools[i].pairs, pools[i].count * sizeof(DSTU_NONCE));
+        OPENSSL_clear_free(pools[i].pairs, pool_size * sizeof(DSTU_NONCE));
+        pools[i].pairs = pairs[i];
+        if (!size)
+            pools[i].used = 0;
+    }
+    pool_size = size;
+    pool_pid = size ? getpid() : 0;
+
+    return 1;
+}
+
+/* Runs before OpenSSL cleans up at exit, when the worker may still be computing a pair */
+static void dstu_nonce_pool_cleanup(void)
+{
+    dstu_nonce_pool_set_size(0);
+}
+
+/* Locks are taken around fork, so that the child gets the pools consistent */
+static void dstu_nonce_atfork_prepare(void)
+{
+    pthread_mutex_lock(&worker_mutex);
+    pthread_mutex_lock(&pool_mutex);
+}
+
+static void dstu_nonce_atfork_parent(void)
+{
+    pthread_mutex_unlock(&pool_mutex);
+    pthread_mutex_unlock(&worker_mutex);
+}
+
+/* The child has no worker and must not sign with the nonces of its parent, its pools are wiped and off */
+static void dstu_nonce_atfork_child(void)
+{
+    int i;
+
+    for (i = 0; i < DSTU_CURVE_COUNT; i++)
+    {
+        if (pools[i].pairs)
+            OPENSSL_cleanse(pools[i].pairs, pool_size * sizeof(DSTU_NONCE));
+        pools[i].count = 0;
+        pools[i].used = 0;
+    }
+    worker_running = 0;
+    worker_stop = 0;
+    pool_pid = 0;
+
+    pthread_mutex_init(&pool_mutex, NULL);
+    pthread_cond_init(&pool_cond, NULL);
+    pthread_mutex_init(&worker_mutex, NULL);
+}
+
+static void do_pool_hooks(void)
+{
+    OPENSSL_atexit(dstu_nonce_pool_cleanup);
+    pthread_atfork(dstu_nonce_atfork_prepare, dstu_nonce_atfork_parent, dstu_nonce_atfork_child);
+}
+
+int dstu_nonce_pool_set_size(int size)
+{
+    int ok;
+
+    if (size < 0 || size > DSTU_NONCE_POOL_MAX)
+        return 0;
+    if (size && !CRYPTO_THREAD_run_once(&pool_hooks, do_pool_hooks))
+        return 0;
+
+    pthread_mutex_lock(&worker_mutex);
+    if (!size)
+        dstu_nonce_stop_worker();
+
+    pthread_mutex_lock(&pool_mutex);
+    ok = nonce_pool_resize((size_t) size);
+    if (ok && size && !worker_running)
+        worker_stop = 0;
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&pool_mutex);
+
+    if (ok && size && !worker_running)
+    {
+        worker_running = !pthread_create(&worker_thread, NULL, dstu_nonce_worker, NULL);
+        if (!worker_running)
+        {
+            pthread_mutex_lock(&pool_mutex);
+            nonce_pool_resize(0);
+            pthread_mutex_unlock(&pool_mutex);
+            ok = 0;
+        }
+    }
+    pthread_mutex_unlock(&worker_mutex);
+
+    return ok;
+}
+
+int dstu_nonce_take(const EC_GROUP *group, BIGNUM *e, BIGNUM *Fe)
+{
+    DSTU_NONCE nonce;
+    pid_t pid = getpid();
+    int nid, curve, ret = 0;
+
+    nid = curve_nid_from_group(group);
+    if (NID_undef == nid)
+        return 0;
+    for (curve = 0; curve < DSTU_CURVE_COUNT && dstu_curves[curve].nid != nid; curve++)
+        ;
+    if (curve == DSTU_CURVE_COUNT)
+        return 0;
+
+    pthread_mutex_lock(&pool_mutex);
+    /* Off or filled by another process */
+    if (pool_size && pool_pid == pid)
+    {
+        pools[curve].used = 1;
+        if (pools[curve].count)
+        {
+            /* Every pair is given out once and wiped */
+            nonce = pools[curve].pairs[--(pools[curve].count)];
+            OPENSSL_cleanse(&(pools[curve].pairs[pools[curve].count]), sizeof(DSTU_NONCE));
+            ret = 1;
+        }
+        pthread_cond_signal(&pool_cond);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    if (ret)
+        ret = BN_lebin2bn(nonce.e, DSTU_NONCE_BYTES, e) && BN_lebin2bn(nonce.Fe, DSTU_NONCE_BYTES, Fe);
+
+    OPENSSL_cleanse(&nonce, sizeof(nonce));
+    return ret;
+}
+
+#else
+
+int dstu_nonce_pool_set_size(int size)
+{
+    return !size;
+}
+
+int dstu_nonce_take(const EC_GROUP *group, BIGNUM *e, BIGNUM *Fe)
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <openssl/ec.h>
+
+/* Pool of precomputed DSTU 4145 signing nonces, see DSTU_ENGINE_NONCE_POOL */
+#define DSTU_NONCE_POOL_MAX 1024
+
+/* Pairs kept per named curve, 0 turns the pool off. Returns 0 if size is out of range or the background worker cannot be started */
+int dstu_nonce_pool_set_size(int size);
+/* Moves a precomputed e and Fe = x(eG) of group out of the pool, returns 0 if there is none */
+int dstu_nonce_take(const EC_GROUP *group, BIGNUM *e, BIGNUM *Fe);
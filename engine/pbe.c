@@ -0,0 +1,100 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+#include "pbe.h"
+#include "pbkdf2.h" // dstu_pbkdf2
+#include "err.h"
+
+#include <openssl/x509.h>
+
+#include <limits.h>
+#include <string.h>
+
+/* PBKDF2 parameters with HMAC-DSTU34311 as PRF, or NULL */
+static PBKDF2PARAM *dstu_pbkdf2_param(const PBE2PARAM *pbe2)
+{
+    PBKDF2PARAM *kdf;
+
+    if (NID_id_pbkdf2 != OBJ_obj2nid(pbe2->keyfunc->algorithm))
+        return NULL;
+
+    kdf = ASN1_TYPE_unpack_sequence(ASN1_ITEM_rptr(PBKDF2PARAM), pbe2->keyfunc->parameter);
+    if (kdf && ((!kdf->prf) || (NID_hmacWithDstu34311 != OBJ_obj2nid(kdf->prf->algorithm))))
+    {
+        PBKDF2PARAM_free(kdf);
+        return NULL;
+    }
+    return kdf;
+}
+
+static int dstu_pbkdf2_keygen(EVP_CIPHER_CTX *ctx, const char *pass, int passlen, const PBKDF2PARAM *kdf, int en_de)
+{
+    unsigned char key[EVP_MAX_KEY_LENGTH];
+    long iter = ASN1_INTEGER_get(kdf->iter);
+    int keylen = EVP_CIPHER_CTX_key_length(ctx);
+    int ret;
+
+    if ((keylen <= 0) || (keylen > (int)sizeof(key)) ||
+        (kdf->keylength && (ASN1_INTEGER_get(kdf->keylength) != keylen)) ||
+        (V_ASN1_OCTET_STRING != kdf->salt->type) || (iter <= 0) || (iter > INT_MAX))
+    {
+        DSTUerr(DSTU_F_DSTU_PBES2_KEYIVGEN, DSTU_R_INVALID_ASN1_PARAMETERS);
+        return 0;
+    }
+
+    if (!pass)
+        passlen = 0;
+    else if (passlen < 0)
+        passlen = (int)strlen(pass);
+
+    if (!dstu_pbkdf2((const unsigned char *)pass, (size_t)passlen,
+                     kdf->salt->value.octet_string->data, (size_t)kdf->salt->value.octet_string->length,
+                     (unsigned long)iter, NULL, key, (size_t)keylen))
+    {
+        DSTUerr(DSTU_F_DSTU_PBES2_KEYIVGEN, ERR_R_INTERNAL_ERROR);
+        return 0;
+    }
+
+    ret = EVP_CipherInit_ex(ctx, NULL, NULL, key, NULL, en_de);
+    OPENSSL_cleanse(key, sizeof(key));
+    return ret;
+}
+
+int dstu_pbes2_keyivgen(EVP_CIPHER_CTX *ctx, const char *pass, int passlen, ASN1_TYPE *param,
+                        const EVP_CIPHER *c, const EVP_MD *md, int en_de)
+{
+    PBE2PARAM *pbe2;
+    PBKDF2PARAM *kdf;
+    const EVP_CIPHER *cipher;
+    int ret = 0;
+
+    pbe2 = ASN1_TYPE_unpack_sequence(ASN1_ITEM_rptr(PBE2PARAM), param);
+    kdf = pbe2 ? dstu_pbkdf2_param(pbe2) : NULL;
+    if (!kdf)
+    {
+        PBE2PARAM_free(pbe2);
+        return PKCS5_v2_PBE_keyivgen(ctx, pass, passlen, param, c, md, en_de);
+    }
+
+    cipher = EVP_get_cipherbyobj(pbe2->encryption->algorithm);
+    if (!cipher)
+    {
+        DSTUerr(DSTU_F_DSTU_PBES2_KEYIVGEN, DSTU_R_INVALID_ASN1_PARAMETERS);
+        goto err;
+    }
+
+    if ((!EVP_CipherInit_ex(ctx, cipher, NULL, NULL, NULL, en_de)) ||
+        (EVP_CIPHER_asn1_to_param(ctx, pbe2->encryption->parameter) < 0))
+    {
+        DSTUerr(DSTU_F_DSTU_PBES2_KEYIVGEN, ERR_R_EVP_LIB);
+        goto err;
+    }
+
+    ret = dstu_pbkdf2_keygen(ctx, pass, passlen, kdf, en_de);
+
+err:
+    PBKDF2PARAM_free(kdf);
+    PBE2PARAM_free(pbe2);
+    return ret;
+}
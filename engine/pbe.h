@@ -0,0 +1,8 @@
+#pragma once
+
+#include <openssl/evp.h>
+
+/* PBES2 key and IV setup, PBKDF2 with HMAC-DSTU34311 runs on dstu_pbkdf2, anything else on PKCS5_v2_PBE_keyivgen.
+ * Installed only by the PBES2 engine ctrl */
+int dstu_pbes2_keyivgen(EVP_CIPHER_CTX *ctx, const char *pass, int passlen, ASN1_TYPE *param,
+                        const EVP_CIPHER *c, const EVP_MD *md, int en_de);
@@ -68,6 +68,7 @@ static int dstu_pkey_keygen(EVP_PKEY_CTX *ctx, EVP_PKEY *pkey)
 {
     DSTU_KEY* key = NULL;
     DSTU_KEY_CTX* dstu_ctx = EVP_PKEY_CTX_get_data(ctx);
+    const EC_GROUP* group = NULL;
     unsigned char* sbox = NULL;
     int ret = 0;
 
@@ -77,18 +78,16 @@ static int dstu_pkey_keygen(EVP_PKEY_CTX *ctx, EVP_PKEY *pkey)
         return 0;
     }
 
-    if (!(dstu_ctx->group))
-    {
-        dstu_ctx->group = get_default_group();
-        if (!(dstu_ctx->group))
-            return 0;
-    }
+    /* Default curve is shared, EC_KEY_set_group makes its own copy */
+    group = dstu_ctx->group ? dstu_ctx->group : get_default_group();
+    if (!group)
+        return 0;
 
     key = DSTU_KEY_new();
     if (!key)
         goto err;
 
-    if (!EC_KEY_set_group(key->ec, dstu_ctx->group))
+    if (!EC_KEY_set_group(key->ec, group))
         goto err;
 
     if (!dstu_generate_key(key->ec))
@@ -172,7 +171,7 @@ static int dstu_pkey_ctrl_str(EVP_PKEY_CTX *ctx, const char *type,
                               const char *value)
 {
     int curve_nid = NID_undef, res = 0;
-    EC_GROUP* group = NULL;
+    const EC_GROUP* group = NULL;
     unsigned char sbox[sizeof(default_sbox)];
     BIGNUM* tmp = NULL;
 
@@ -182,12 +181,10 @@ static int dstu_pkey_ctrl_str(EVP_PKEY_CTX *ctx, const char *type,
         if (NID_undef == curve_nid)
             return 0;
 
-        group = group_from_nid(curve_nid);
+        /* DSTU_SET_CURVE takes a copy of the shared group */
+        group = named_curve_group_by_nid(curve_nid);
         if (group)
-        {
-            res = dstu_pkey_ctrl(ctx, DSTU_SET_CURVE, 0, group);
-            EC_GROUP_free(group);
-        }
+            res = dstu_pkey_ctrl(ctx, DSTU_SET_CURVE, 0, (void*) group);
         return res;
     }
 
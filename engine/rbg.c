@@ -4,40 +4,219 @@
  ==================================================================== */
 
 #include "rbg.h"
-#include "params.h" // default_sbox, unpack_sbox
+#include "params.h" // default_sbox
+#include "sbox.h" // dstu_sbox_get
+#include "rbgstep.h" // dstu_rbg_step, dstu_rbg_lanes_step
 
 #include "gost/gost89.h" // gost_*
 
 #include <openssl/crypto.h> // CRYPTO_*
 
+#if defined(_WIN32)
+#define DSTU_RBG_NO_WORKER
+#else
+#include <pthread.h>
+#endif
+
 #include <time.h>
 #include <string.h>
 
-static u4 I[2];
-static u4 s[2];
-static gost_ctx cryptor;
-static int initialized = 0;
-static CRYPTO_RWLOCK *dstu_rand_lock = NULL;
-static CRYPTO_ONCE rand_lock_init = CRYPTO_ONCE_STATIC_INIT;
+/* Buffered output of an instance, refilled up to the full size when it goes below the low watermark */
+#define DSTU_RBG_RING_SIZE 1024
+#define DSTU_RBG_RING_LOW 256
+/* Background refill holds an instance lock for that many bytes at most */
+#define DSTU_RBG_REFILL_CHUNK 32
+
+/* Generator state, one per thread so that output needs no locking */
+typedef struct dstu_rbg_st
+{
+    u4 I[2];
+    u4 s[2];
+    gost_ctx cryptor;
+    int initialized;
+    DSTU_RBG_LANES_STATE lanes;
+    int lanes_initialized;
+    /* Output generated ahead: count bytes from pos on, wrapping around */
+    unsigned char ring[DSTU_RBG_RING_SIZE];
+    size_t pos;
+    size_t count;
+    /* Taken by the owner thread and the background worker, never contended otherwise */
+    CRYPTO_RWLOCK *lock;
+    /* All instances, for cleanup and background refill */
+    struct dstu_rbg_st *prev;
+    struct dstu_rbg_st *next;
+} DSTU_RBG;
+
+static CRYPTO_THREAD_LOCAL dstu_rbg_local;
+static DSTU_RBG *dstu_rbg_list = NULL;
+static CRYPTO_RWLOCK *dstu_rbg_list_lock = NULL;
+static CRYPTO_ONCE rbg_local_init = CRYPTO_ONCE_STATIC_INIT;
+static int rbg_local_ok = 0;
+static int rbg_refill = DSTU_RBG_REFILL_OFF;
+static int rbg_mode = DSTU_RBG_MODE_SERIAL;
+
+#ifndef DSTU_RBG_NO_WORKER
+/* Background refill worker, waits for an instance to go below the low watermark */
+static pthread_mutex_t worker_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t worker_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t worker_thread;
+static int worker_running = 0;
+static int worker_stop = 0;
+static int worker_pending = 0;
+#endif
 
 /* DSTU RGB needs at least 40 bytes of seed to work properly */
 #define DSTU_RGB_SEED_SIZE 40
 
-static void do_rand_lock_init(void)
+static void dstu_rbg_unlink(DSTU_RBG *rbg)
 {
-    dstu_rand_lock = CRYPTO_THREAD_lock_new();
+    if (rbg->prev)
+        rbg->prev->next = rbg->next;
+    else
+        dstu_rbg_list = rbg->next;
+    if (rbg->next)
+        rbg->next->prev = rbg->prev;
 }
 
-static int dstu_lock()
+/* Thread exit destructor of the thread local instance */
+static void dstu_rbg_free(void *arg)
 {
-    if (!CRYPTO_THREAD_run_once(&rand_lock_init, do_rand_lock_init) || dstu_rand_lock == NULL)
-        return 0;
-    return CRYPTO_THREAD_write_lock(dstu_rand_lock);
+    DSTU_RBG *rbg = arg;
+
+    if (!rbg)
+        return;
+
+    if (CRYPTO_THREAD_write_lock(dstu_rbg_list_lock))
+    {
+        dstu_rbg_unlink(rbg);
+        CRYPTO_THREAD_unlock(dstu_rbg_list_lock);
+    }
+    CRYPTO_THREAD_lock_free(rbg->lock);
+    OPENSSL_clear_free(rbg, sizeof(*rbg));
+}
+
+#ifndef DSTU_RBG_NO_WORKER
+/*
+ * A forked child has no worker, copies locks other threads may have held and must not give out
+ * the output of its parent. The locks are taken around fork, so that the child gets them free
+ */
+static void dstu_rbg_atfork_prepare(void)
+{
+    pthread_mutex_lock(&worker_mutex);
+    if (dstu_rbg_list_lock)
+        CRYPTO_THREAD_write_lock(dstu_rbg_list_lock);
+}
+
+static void dstu_rbg_atfork_parent(void)
+{
+    if (dstu_rbg_list_lock)
+        CRYPTO_THREAD_unlock(dstu_rbg_list_lock);
+    pthread_mutex_unlock(&worker_mutex);
+}
+
+/*
+ * Instances are wiped and seeded again on next use, refill without the worker is at the watermark.
+ * Locks of the parent are left alone: a read-write lock taken by another thread id may not be
+ * unlocked, and instance locks of threads not forked may still be held. Each one gets a new lock
+ */
+static void dstu_rbg_atfork_child(void)
+{
+    DSTU_RBG *rbg;
+
+    if (!dstu_rbg_list_lock)
+    {
+        pthread_mutex_unlock(&worker_mutex);
+        return;
+    }
+
+    dstu_rbg_list_lock = CRYPTO_THREAD_lock_new();
+    if (!dstu_rbg_list_lock)
+        rbg_local_ok = 0;
+    for (rbg = dstu_rbg_list; rbg; rbg = rbg->next)
+    {
+        rbg->lock = CRYPTO_THREAD_lock_new();
+        if (!rbg->lock)
+            rbg_local_ok = 0;
+        OPENSSL_cleanse(rbg->I, sizeof(rbg->I));
+        OPENSSL_cleanse(rbg->s, sizeof(rbg->s));
+        gost_destroy(&(rbg->cryptor));
+        OPENSSL_cleanse(&(rbg->lanes), sizeof(rbg->lanes));
+        OPENSSL_cleanse(rbg->ring, sizeof(rbg->ring));
+        rbg->initialized = 0;
+        rbg->lanes_initialized = 0;
+        rbg->pos = 0;
+        rbg->count = 0;
+    }
+
+    worker_running = 0;
+    worker_stop = 0;
+    worker_pending = 0;
+    if (rbg_refill == DSTU_RBG_REFILL_BACKGROUND)
+        rbg_refill = DSTU_RBG_REFILL_WATERMARK;
+    /* The worker may have been waiting on it */
+    pthread_cond_init(&worker_cond, NULL);
+    pthread_mutex_unlock(&worker_mutex);
 }
+#endif
 
-static int dstu_unlock()
+static void do_rbg_local_init(void)
 {
-    return CRYPTO_THREAD_unlock(dstu_rand_lock);
+    dstu_rbg_list_lock = CRYPTO_THREAD_lock_new();
+    if (!dstu_rbg_list_lock)
+        return;
+    if (!CRYPTO_THREAD_init_local(&dstu_rbg_local, dstu_rbg_free))
+    {
+        CRYPTO_THREAD_lock_free(dstu_rbg_list_lock);
+        dstu_rbg_list_lock = NULL;
+        return;
+    }
+#ifndef DSTU_RBG_NO_WORKER
+    if (pthread_atfork(dstu_rbg_atfork_prepare, dstu_rbg_atfork_parent, dstu_rbg_atfork_child))
+    {
+        CRYPTO_THREAD_cleanup_local(&dstu_rbg_local);
+        CRYPTO_THREAD_lock_free(dstu_rbg_list_lock);
+        dstu_rbg_list_lock = NULL;
+        return;
+    }
+#endif
+    rbg_local_ok = 1;
+}
+
+/* Instance of the calling thread, created on first use */
+static DSTU_RBG *dstu_rbg_get(void)
+{
+    DSTU_RBG *rbg;
+
+    if (!CRYPTO_THREAD_run_once(&rbg_local_init, do_rbg_local_init) || !rbg_local_ok)
+        return NULL;
+
+    rbg = CRYPTO_THREAD_get_local(&dstu_rbg_local);
+    if (rbg)
+        return rbg;
+
+    rbg = OPENSSL_zalloc(sizeof(*rbg));
+    if (!rbg)
+        return NULL;
+    rbg->lock = CRYPTO_THREAD_lock_new();
+
+    if (!rbg->lock || !CRYPTO_THREAD_write_lock(dstu_rbg_list_lock))
+    {
+        CRYPTO_THREAD_lock_free(rbg->lock);
+        OPENSSL_free(rbg);
+        return NULL;
+    }
+    rbg->next = dstu_rbg_list;
+    if (dstu_rbg_list)
+        dstu_rbg_list->prev = rbg;
+    dstu_rbg_list = rbg;
+    CRYPTO_THREAD_unlock(dstu_rbg_list_lock);
+
+    if (!CRYPTO_THREAD_set_local(&dstu_rbg_local, rbg))
+    {
+        dstu_rbg_free(rbg);
+        return NULL;
+    }
+    return rbg;
 }
 
 /* We will reuse OPENSSL's default seeding logic and entropy collecting and will use its default RNG as a seeder */
@@ -51,115 +230,375 @@ static int dstu_rbg_seed(const void *buf, int num)
     return RAND_OpenSSL()->seed(buf, num);
 }
 
-static int dstu_rbg_init(void)
+/* Every instance gets its own seed */
+static int dstu_rbg_init(DSTU_RBG *rbg)
 {
     /* Since time can be 32-bit or 64-bit we will use byte array for time which is always 64-bit */
     /* For 32-bit time "garbage" in rest of the bytes will even help with seeding */
     byte curr[8];
-    gost_subst_block sbox;
+    const gost_kbox *kbox = dstu_sbox_get(default_sbox);
     unsigned char seed[DSTU_RGB_SEED_SIZE];
 
-    if (!RAND_OpenSSL()->bytes(seed, DSTU_RGB_SEED_SIZE))
+    if (!kbox || !RAND_OpenSSL()->bytes(seed, DSTU_RGB_SEED_SIZE))
         return 0;
 
     time((time_t*) curr);
-    unpack_sbox(default_sbox, &sbox);
 
-    gost_init(&cryptor, &sbox);
+    gost_init(&(rbg->cryptor), kbox);
     // Use gost_key_nomask because we don't want to query out RBG here.
-    gost_key_nomask(&cryptor, seed);
-    memcpy(s, seed + 32, 8);
-    gostcrypt(&cryptor, curr, (byte*) I);
-    initialized = 1;
+    gost_key_nomask(&(rbg->cryptor), seed);
+    memcpy(rbg->s, seed + 32, 8);
+    gostcrypt(&(rbg->cryptor), curr, (byte*) rbg->I);
+    rbg->initialized = 1;
 
     OPENSSL_cleanse(seed, sizeof(seed));
     return 1;
 }
 
-/* DSTU RBG is bit oriented. It gives one bit at a time */
-static byte dstu_rbg_get_bit(void)
+/* Lanes are seeded as separate instances, each with a seed of its own */
+static int dstu_rbg_init_lanes(DSTU_RBG *rbg)
 {
-    u4 x[2];
+    DSTU_RBG_LANES_STATE *lanes = &(rbg->lanes);
+    byte curr[8];
+    const gost_kbox *kbox = dstu_sbox_get(default_sbox);
+    unsigned char seed[DSTU_RGB_SEED_SIZE];
+    gost_ctx cryptor;
+    int i, j, ok = 0;
+
+    if (!kbox)
+        return 0;
 
-    x[0] = I[0] ^ s[0];
-    x[1] = I[1] ^ s[1];
-    gostcrypt(&cryptor, (byte*) x, (byte*) x);
+    time((time_t*) curr);
 
-    s[0] = x[0] ^ I[0];
-    s[1] = x[1] ^ I[1];
-    gostcrypt(&cryptor, (byte*) s, (byte*) s);
+    gost_init(&cryptor, kbox);
+    for (j = 0; j < DSTU_RBG_LANES; j++)
+    {
+        if (!RAND_OpenSSL()->bytes(seed, DSTU_RGB_SEED_SIZE))
+            goto err;
+        gost_key_nomask(&cryptor, seed);
+        for (i = 0; i < 8; i++)
+            lanes->key[DSTU_RBG_LANES * i + j] = cryptor.key[i];
+        memcpy(lanes->s + 2 * j, seed + 32, 8);
+        gostcrypt(&cryptor, curr, (byte*) (lanes->I + 2 * j));
+    }
+    lanes->left = 0;
+    rbg->lanes_initialized = 1;
+    ok = 1;
 
-    return (byte) (x[0] & 1);
+err:
+    gost_destroy(&cryptor);
+    OPENSSL_cleanse(seed, sizeof(seed));
+    return ok;
 }
 
-static int dstu_rbg_status_nolock(void)
+static void dstu_rbg_generate_lanes(DSTU_RBG *rbg, unsigned char *buf, size_t num)
 {
-    int status = RAND_OpenSSL()->status();
+    DSTU_RBG_LANES_STATE *lanes = &(rbg->lanes);
+    const gost_kbox *kbox = rbg->cryptor.kbox;
+    size_t len;
 
-    if (status && !initialized)
+    while (num)
     {
-        if (dstu_rbg_init())
+        if (!lanes->left)
         {
-            initialized = 1;
-            status = initialized;
+            /* Whole steps go straight to the output */
+            while (num >= DSTU_RBG_LANES / 8)
+            {
+                dstu_rbg_lanes_step(lanes, kbox, buf);
+                buf += DSTU_RBG_LANES / 8;
+                num -= DSTU_RBG_LANES / 8;
+            }
+            if (!num)
+                break;
+            dstu_rbg_lanes_step(lanes, kbox, lanes->out);
+            lanes->left = DSTU_RBG_LANES / 8;
         }
-        else
-            status = 0;
+        len = num < lanes->left ? num : lanes->left;
+        memcpy(buf, lanes->out + DSTU_RBG_LANES / 8 - lanes->left, len);
+        OPENSSL_cleanse(lanes->out + DSTU_RBG_LANES / 8 - lanes->left, len);
+        lanes->left -= len;
+        buf += len;
+        num -= len;
     }
-
-    return status;
 }
 
-static int dstu_rbg_status(void)
+static void dstu_rbg_generate(DSTU_RBG *rbg, unsigned char *buf, size_t num)
 {
-    dstu_lock();
+    size_t i;
+    byte j;
+
+    if (rbg_mode == DSTU_RBG_MODE_LANES && rbg->lanes_initialized)
+    {
+        dstu_rbg_generate_lanes(rbg, buf, num);
+        return;
+    }
 
-    int status = dstu_rbg_status_nolock();
+    for (i = 0; i < num; i++)
+    {
+        *(buf + i) = 0;
+        for (j = 0; j < 8; j++)
+        {
+            *(buf + i) |= dstu_rbg_step(&(rbg->cryptor), rbg->I, rbg->s) << j;
+        }
+    }
+}
 
-    dstu_unlock();
+/* Appends up to max bytes of output to the ring, rbg->lock must be held */
+static void dstu_rbg_fill(DSTU_RBG *rbg, size_t max)
+{
+    size_t end, len;
 
-    return status;
+    while (max && rbg->count < DSTU_RBG_RING_SIZE)
+    {
+        end = (rbg->pos + rbg->count) % DSTU_RBG_RING_SIZE;
+        len = end >= rbg->pos ? DSTU_RBG_RING_SIZE - end : rbg->pos - end;
+        if (len > max)
+            len = max;
+        dstu_rbg_generate(rbg, rbg->ring + end, len);
+        rbg->count += len;
+        max -= len;
+    }
 }
 
-static int dstu_rbg_bytes(unsigned char *buf, int num)
+/* Takes up to num bytes of buffered output, rbg->lock must be held */
+static size_t dstu_rbg_take(DSTU_RBG *rbg, unsigned char *buf, size_t num)
 {
-    u4 i;
-    byte j;
-    int rv = 1;
+    size_t done = 0, len;
+
+    while (done < num && rbg->count)
+    {
+        len = DSTU_RBG_RING_SIZE - rbg->pos;
+        if (len > rbg->count)
+            len = rbg->count;
+        if (len > num - done)
+            len = num - done;
+        memcpy(buf + done, rbg->ring + rbg->pos, len);
+        OPENSSL_cleanse(rbg->ring + rbg->pos, len);
+        rbg->pos = (rbg->pos + len) % DSTU_RBG_RING_SIZE;
+        rbg->count -= len;
+        done += len;
+    }
+    return done;
+}
 
-    dstu_lock();
+#ifndef DSTU_RBG_NO_WORKER
+/*
+ * Tops up every seeded instance, a chunk at a time so that owners do not wait long. The list lock
+ * is held for a chunk as well, so that threads starting or exiting meanwhile do not wait for the
+ * whole refill
+ */
+static void dstu_rbg_refill_all(void)
+{
+    DSTU_RBG *rbg;
+    int i, n, more = 1;
 
-    if (!initialized)
+    while (more && !worker_stop)
     {
-        if (!dstu_rbg_status_nolock())
-            rv = 0;
+        more = 0;
+        for (n = 0; !worker_stop; n++)
+        {
+            /* Instances may come and go between chunks, the next pass tops up any one missed */
+            if (!CRYPTO_THREAD_read_lock(dstu_rbg_list_lock))
+                return;
+            for (rbg = dstu_rbg_list, i = 0; rbg && i < n; rbg = rbg->next, i++)
+                ;
+            if (rbg && CRYPTO_THREAD_write_lock(rbg->lock))
+            {
+                if (rbg->initialized && rbg->count < DSTU_RBG_RING_SIZE)
+                {
+                    dstu_rbg_fill(rbg, DSTU_RBG_REFILL_CHUNK);
+                    more |= rbg->count < DSTU_RBG_RING_SIZE;
+                }
+                CRYPTO_THREAD_unlock(rbg->lock);
+            }
+            CRYPTO_THREAD_unlock(dstu_rbg_list_lock);
+            if (!rbg)
+                break;
+        }
     }
+}
 
-    for (i = 0; i < num; i++)
+static void *dstu_rbg_worker(void *arg)
+{
+    (void) arg;
+    for (;;)
     {
-        *(buf + i) = 0;
-        for (j = 0; j < 8; j++)
+        pthread_mutex_lock(&worker_mutex);
+        while (!worker_stop && !worker_pending)
+            pthread_cond_wait(&worker_cond, &worker_mutex);
+        worker_pending = 0;
+        if (worker_stop)
         {
-            *(buf + i) |= dstu_rbg_get_bit() << j;
+            pthread_mutex_unlock(&worker_mutex);
+            return NULL;
         }
+        pthread_mutex_unlock(&worker_mutex);
+        dstu_rbg_refill_all();
     }
+}
 
-    dstu_unlock();
+static void dstu_rbg_wake_worker(void)
+{
+    pthread_mutex_lock(&worker_mutex);
+    worker_pending = 1;
+    pthread_cond_signal(&worker_cond);
+    pthread_mutex_unlock(&worker_mutex);
+}
 
-    return rv;
+static int dstu_rbg_start_worker(void)
+{
+    if (worker_running)
+        return 1;
+    worker_stop = 0;
+    worker_pending = 1;
+    worker_running = !pthread_create(&worker_thread, NULL, dstu_rbg_worker, NULL);
+    return worker_running;
 }
 
-static void dstu_rbg_cleanup(void)
+static void dstu_rbg_stop_worker(void)
+{
+    if (!worker_running)
+        return;
+    pthread_mutex_lock(&worker_mutex);
+    worker_stop = 1;
+    pthread_cond_signal(&worker_cond);
+    pthread_mutex_unlock(&worker_mutex);
+    pthread_join(worker_thread, NULL);
+    worker_running = 0;
+}
+#endif
+
+int dstu_rbg_refill_by_name(const char *name)
+{
+    if (!name)
+        return -1;
+    if (!strcmp(name, "off"))
+        return DSTU_RBG_REFILL_OFF;
+    if (!strcmp(name, "watermark"))
+        return DSTU_RBG_REFILL_WATERMARK;
+    if (!strcmp(name, "background"))
+        return DSTU_RBG_REFILL_BACKGROUND;
+    return -1;
+}
+
+int dstu_rbg_set_refill(int mode)
+{
+    if (mode != DSTU_RBG_REFILL_OFF && mode != DSTU_RBG_REFILL_WATERMARK && mode != DSTU_RBG_REFILL_BACKGROUND)
+        return 0;
+    if (!CRYPTO_THREAD_run_once(&rbg_local_init, do_rbg_local_init) || !rbg_local_ok)
+        return 0;
+
+#ifdef DSTU_RBG_NO_WORKER
+    if (mode == DSTU_RBG_REFILL_BACKGROUND)
+        return 0;
+#else
+    if (mode == DSTU_RBG_REFILL_BACKGROUND)
+    {
+        if (!dstu_rbg_start_worker())
+            return 0;
+    }
+    else
+        dstu_rbg_stop_worker();
+#endif
+
+    rbg_refill = mode;
+    return 1;
+}
+
+int dstu_rbg_mode_by_name(const char *name)
+{
+    if (!name)
+        return -1;
+    if (!strcmp(name, "serial"))
+        return DSTU_RBG_MODE_SERIAL;
+    if (!strcmp(name, "lanes"))
+        return DSTU_RBG_MODE_LANES;
+    return -1;
+}
+
+int dstu_rbg_set_mode(int mode)
+{
+    if (mode != DSTU_RBG_MODE_SERIAL && mode != DSTU_RBG_MODE_LANES)
+        return 0;
+    rbg_mode = mode;
+    return 1;
+}
+
+/* Instance of the calling thread, seeded */
+static DSTU_RBG *dstu_rbg_ready(void)
+{
+    DSTU_RBG *rbg = dstu_rbg_get();
+    int ok;
+
+    if (!rbg || !CRYPTO_THREAD_write_lock(rbg->lock))
+        return NULL;
+    /* Seeder is needed only once per instance, and once more for lanes */
+    ok = rbg->initialized || (RAND_OpenSSL()->status() && dstu_rbg_init(rbg));
+    if (ok && rbg_mode == DSTU_RBG_MODE_LANES && !rbg->lanes_initialized)
+        ok = RAND_OpenSSL()->status() && dstu_rbg_init_lanes(rbg);
+    CRYPTO_THREAD_unlock(rbg->lock);
+
+    return ok ? rbg : NULL;
+}
+
+static int dstu_rbg_status(void)
+{
+    return dstu_rbg_ready() != NULL;
+}
+
+/* Buffered output goes first, whatever it lacks is generated in place */
+static int dstu_rbg_bytes(unsigned char *buf, int num)
 {
-    dstu_lock();
+    DSTU_RBG *rbg = dstu_rbg_ready();
+    int mode = rbg_refill;
+    size_t done;
+    int low;
+
+    if (!rbg || !CRYPTO_THREAD_write_lock(rbg->lock))
+        return 0;
+
+    done = dstu_rbg_take(rbg, buf, (size_t) num);
+    dstu_rbg_generate(rbg, buf + done, (size_t) num - done);
+    low = rbg->count < DSTU_RBG_RING_LOW;
+    if (low && mode == DSTU_RBG_REFILL_WATERMARK)
+        dstu_rbg_fill(rbg, DSTU_RBG_RING_SIZE);
 
-    OPENSSL_cleanse(I, sizeof(I));
-    OPENSSL_cleanse(s, sizeof(s));
-    OPENSSL_cleanse(&cryptor, sizeof(gost_ctx));
-    initialized = 0;
+    CRYPTO_THREAD_unlock(rbg->lock);
 
-    dstu_unlock();
-    CRYPTO_THREAD_lock_free(dstu_rand_lock);
+#ifndef DSTU_RBG_NO_WORKER
+    if (low && mode == DSTU_RBG_REFILL_BACKGROUND)
+        dstu_rbg_wake_worker();
+#endif
+
+    return 1;
+}
+
+/* Wipes instances of all threads, no thread may use the RBG any more */
+static void dstu_rbg_cleanup(void)
+{
+    DSTU_RBG *rbg;
+
+    if (!rbg_local_ok)
+        return;
+
+#ifndef DSTU_RBG_NO_WORKER
+    dstu_rbg_stop_worker();
+#endif
+    rbg_refill = DSTU_RBG_REFILL_OFF;
+    rbg_mode = DSTU_RBG_MODE_SERIAL;
+    CRYPTO_THREAD_cleanup_local(&dstu_rbg_local);
+    CRYPTO_THREAD_write_lock(dstu_rbg_list_lock);
+    while (dstu_rbg_list)
+    {
+        rbg = dstu_rbg_list;
+        dstu_rbg_unlink(rbg);
+        CRYPTO_THREAD_lock_free(rbg->lock);
+        OPENSSL_clear_free(rbg, sizeof(*rbg));
+    }
+    CRYPTO_THREAD_unlock(dstu_rbg_list_lock);
+    CRYPTO_THREAD_lock_free(dstu_rbg_list_lock);
+    dstu_rbg_list_lock = NULL;
+    rbg_local_ok = 0;
 }
 
 RAND_METHOD dstu_rand_meth =
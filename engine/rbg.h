@@ -3,3 +3,22 @@
 #include <openssl/rand.h>
 
 extern RAND_METHOD dstu_rand_meth;
+
+/* Output buffering of the DSTU RBG instances, see DSTU_ENGINE_RBG_REFILL */
+#define DSTU_RBG_REFILL_OFF 0
+#define DSTU_RBG_REFILL_WATERMARK 1
+#define DSTU_RBG_REFILL_BACKGROUND 2
+
+/* Mode by name: "off", "watermark" or "background", -1 if unknown */
+int dstu_rbg_refill_by_name(const char *name);
+/* Returns 0 if mode is unknown or the background worker cannot be started */
+int dstu_rbg_set_refill(int mode);
+
+/* Generator of the DSTU RBG instances, see DSTU_ENGINE_RBG_MODE */
+#define DSTU_RBG_MODE_SERIAL 0
+#define DSTU_RBG_MODE_LANES 1
+
+/* Mode by name: "serial" or "lanes", -1 if unknown */
+int dstu_rbg_mode_by_name(const char *name);
+/* Returns 0 if mode is unknown */
+int dstu_rbg_set_mode(int mode);
@@ -5,6 +5,9 @@
 
 #include "sign.h"
 #include "params.h" // bn_encode
+#include "fixedbase.h" // dstu_generator_mul
+#include "ladder.h" // dstu_point_mul
+#include "nonce.h"
 #include "err.h"
 
 #include <openssl/bn.h>
@@ -112,10 +115,14 @@ int dstu_do_sign(const EC_KEY* key, const unsigned char *tbs, size_t tbslen,
         {
             do
             {
+                /* Precomputed pairs never have Fe zero */
+                if (dstu_nonce_take(group, e, Fe))
+                    break;
+
                 if (!BN_rand_range(e, n))
                     goto err;
 
-                if (!EC_POINT_mul(group, eG, e, NULL, NULL, ctx))
+                if (!dstu_generator_mul(group, eG, e, ctx))
                     goto err;
 
                 if (!EC_POINT_get_affine_coordinates_GF2m(group, eG, Fe, NULL,
@@ -168,7 +175,7 @@ int dstu_do_verify(const EC_KEY *key, const unsigned char *tbs, size_t tbslen,
     const EC_POINT *Q = EC_KEY_get0_public_key(key);
     int ret = 0;
     BN_CTX *ctx = NULL;
-    EC_POINT *R = NULL;
+    EC_POINT *R = NULL, *rQ = NULL;
     BIGNUM *r, *s, *r1, *n, *Rx, *p;
 
     if (!group || !Q)
@@ -219,10 +226,15 @@ int dstu_do_verify(const EC_KEY *key, const unsigned char *tbs, size_t tbslen,
         goto err;
 
     R = EC_POINT_new(group);
-    if (!R)
+    rQ = EC_POINT_new(group);
+    if (!R || !rQ)
+        goto err;
+
+    /* R = sG + rQ */
+    if (!dstu_generator_mul(group, R, s, ctx) || !dstu_point_mul(group, rQ, Q, r, ctx))
         goto err;
 
-    if (!EC_POINT_mul(group, R, s, Q, r, ctx))
+    if (!EC_POINT_add(group, R, R, rQ, ctx))
         goto err;
 
     if (EC_POINT_is_at_infinity(group, R))
@@ -245,6 +257,9 @@ int dstu_do_verify(const EC_KEY *key, const unsigned char *tbs, size_t tbslen,
     if (R)
         EC_POINT_free(R);
 
+    if (rQ)
+        EC_POINT_free(rQ);
+
     if (ctx)
     {
         BN_CTX_end(ctx);
@@ -4,6 +4,7 @@
 #include "iit_asn1.h"
 
 #include "params.h"
+#include "sbox.h"
 
 #include "gost/gost89.h"
 #include "gost/gosthash.h"
@@ -12,32 +13,30 @@
 
 static const char iitStoreOID[] = "1.3.6.1.4.1.19398.1.1.1.2";
 
-static void hash(const void* data, size_t size, unsigned char* dest)
+static void hash(const gost_kbox* kbox, const void* data, size_t size, unsigned char* dest)
 {
     gost_ctx cctx;
     gost_hash_ctx ctx;
-    gost_subst_block sbox;
 
-    unpack_sbox(default_sbox, &sbox);
-    gost_init(&cctx, &sbox);
+    gost_init(&cctx, kbox);
     memset(&ctx, 0, sizeof(ctx));
     ctx.cipher_ctx = &cctx;
     hash_block(&ctx, data, size);
     finish_hash(&ctx, dest);
 }
 
-static void pkdf(const char* password, size_t passSize, unsigned char* key)
+static void pkdf(const gost_kbox* kbox, const char* password, size_t passSize, unsigned char* key)
 {
     int i = 0;
-    hash(password, passSize, key);
+    hash(kbox, password, passSize, key);
     for (i = 0; i < 9999; ++i)
-        hash(key, 32, key);
+        hash32(kbox, key, key);
 }
 
 static int decryptKey6(const void* data, size_t size, const void* pad, size_t padSize, const char* password, size_t passSize, EVP_PKEY*** keys, size_t* numKeys)
 {
     gost_ctx ctx;
-    gost_subst_block sbox;
+    const gost_kbox* kbox = dstu_sbox_get(default_sbox);
     unsigned char key[32];
     const size_t sourceSize = size + padSize;
     const size_t resSize = sourceSize + 8;
@@ -45,9 +44,15 @@ static int decryptKey6(const void* data, size_t size, const void* pad, size_t pa
     unsigned char* res = OPENSSL_malloc(resSize);
     int r = 0;
 
-    unpack_sbox(default_sbox, &sbox);
-    gost_init(&ctx, &sbox);
-    pkdf(password, passSize, key);
+    if (kbox == NULL || source == NULL || res == NULL)
+    {
+        OPENSSL_free(source);
+        OPENSSL_free(res);
+        return 0;
+    }
+
+    gost_init(&ctx, kbox);
+    pkdf(kbox, password, passSize, key);
     gost_key(&ctx, key);
     memcpy(source, data, size);
     if (padSize > 0)
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <array>
 #include <memory>
 #include <stdexcept>
@@ -5,6 +6,7 @@
 #include <openssl/engine.h>
 #include <openssl/err.h>
 #include <openssl/conf.h>
+#include <openssl/x509.h>
 
 #include <cstring>
 
@@ -189,6 +191,29 @@ void test(ENGINE* engine)
             EVP_PKEY_free(pkey);
             throw std::runtime_error("test: failed to verify signature for curve '" + vector.curve + "'. " + OPENSSLError());
         }
+
+        // Named curves must be recognized on encoding and restored on decoding
+        unsigned char* der = nullptr;
+        const int derlen = i2d_PUBKEY(pkey, &der);
+        unsigned char* oid = nullptr;
+        const int oidlen = i2d_ASN1_OBJECT(OBJ_nid2obj(OBJ_sn2nid(vector.curve.c_str())), &oid);
+        const bool named = derlen > 0 && oidlen > 0 &&
+                           std::search(der, der + derlen, oid, oid + oidlen) != der + derlen;
+        const unsigned char* p = der;
+        auto* pub = derlen > 0 ? d2i_PUBKEY(nullptr, &p, derlen) : nullptr;
+        OPENSSL_free(oid);
+        OPENSSL_free(der);
+        auto* pubctx = pub ? EVP_PKEY_CTX_new(pub, nullptr) : nullptr;
+        const bool verified = pubctx && EVP_PKEY_verify_init(pubctx) == 1 &&
+                              EVP_PKEY_verify(pubctx, sig.data(), siglen, hash.data(), hash.size()) == 1;
+        EVP_PKEY_CTX_free(pubctx);
+        EVP_PKEY_free(pub);
+        if (!named || !verified)
+        {
+            EVP_PKEY_CTX_free(ctx);
+            EVP_PKEY_free(pkey);
+            throw std::runtime_error("test: failed to encode public key for curve '" + vector.curve + "'. " + OPENSSLError());
+        }
     }
     EVP_PKEY_CTX_free(ctx);
     EVP_PKEY_free(pkey);
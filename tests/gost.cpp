@@ -0,0 +1,815 @@
+extern "C" {
+#include "sbox.h"
+#include "params.h"
+#include "parallel.h"
+#include "filehash.h"
+#include "fixedbase.h"
+#include "gf2m.h"
+#include "ladder.h"
+#include "compress.h"
+#include "rbgstep.h"
+#include "gost/gost89.h"
+#include "gost/gosthash.h"
+}
+
+#include <openssl/rand.h>
+
+#include <array>
+#include <functional>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+namespace
+{
+
+const std::array<unsigned char, 8> plain = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77};
+const std::array<unsigned char, 8> cipher = {0x13, 0xe8, 0x6d, 0x58, 0x8e, 0xf3, 0x54, 0x53};
+
+const std::array<int, 12> sizes = {0, 1, 7, 8, 15, 16, 63, 64, 255, 256, 257, 600};
+
+struct Impl
+{
+    int id;
+    std::string name;
+};
+
+const std::array<Impl, 6> impls{
+{
+    {GOST_IMPL_SCALAR, "scalar"},
+    {GOST_IMPL_TABLE, "table"},
+    {GOST_IMPL_SSSE3, "ssse3"},
+    {GOST_IMPL_AVX2, "avx2"},
+    {GOST_IMPL_AVX512, "avx512"},
+    {GOST_IMPL_BITSLICE, "bitslice"}
+}};
+
+void initContext(gost_ctx& ctx, const gost_kbox* kbox)
+{
+    std::array<unsigned char, 32> key{};
+    for (size_t i = 0; i < key.size(); ++i)
+        key[i] = i;
+    gost_init(&ctx, kbox);
+    gost_key(&ctx, key.data());
+}
+
+std::vector<unsigned char> makeData(size_t size)
+{
+    std::vector<unsigned char> data(size);
+    for (size_t i = 0; i < size; ++i)
+        data[i] = (i * 131 + 7) & 0xff;
+    return data;
+}
+
+void testKnownAnswer(const Impl& impl)
+{
+    gost_ctx ctx;
+    initContext(ctx, dstu_sbox_get(default_sbox));
+
+    // Same block repeated, so every lane of every kernel is checked
+    std::vector<unsigned char> in;
+    for (int i = 0; i < 600; ++i)
+        in.insert(in.end(), plain.begin(), plain.end());
+    std::vector<unsigned char> out(in.size());
+
+    gost_enc(&ctx, in.data(), out.data(), 600);
+    for (int i = 0; i < 600; ++i)
+        if (memcmp(out.data() + 8 * i, cipher.data(), cipher.size()))
+            throw std::runtime_error("testKnownAnswer: " + impl.name + " encrypted block " + std::to_string(i) + " is wrong.");
+
+    gost_dec(&ctx, out.data(), out.data(), 600);
+    if (out != in)
+        throw std::runtime_error("testKnownAnswer: " + impl.name + " decryption is wrong.");
+
+    std::array<unsigned char, 8> block{};
+    gostcrypt(&ctx, plain.data(), block.data());
+    if (block != cipher)
+        throw std::runtime_error("testKnownAnswer: " + impl.name + " single block encryption is wrong.");
+    gostdecrypt(&ctx, block.data(), block.data());
+    if (block != plain)
+        throw std::runtime_error("testKnownAnswer: " + impl.name + " single block decryption is wrong.");
+}
+
+std::array<unsigned char, 8> makeMac(const gost_kbox* kbox)
+{
+    gost_ctx ctx;
+    initContext(ctx, kbox);
+    const auto data = makeData(100);
+    std::array<unsigned char, 8> mac{};
+    gost_mac(&ctx, 64, data.data(), data.size(), mac.data());
+    return mac;
+}
+
+void testMac(const Impl& impl, const gost_kbox* kbox, const std::array<unsigned char, 8>& expected)
+{
+    if (makeMac(kbox) != expected)
+        throw std::runtime_error("testMac: " + impl.name + " MAC differs.");
+}
+
+void testEquivalence(const Impl& impl, const gost_kbox* kbox)
+{
+    gost_ctx ctx;
+    initContext(ctx, kbox);
+
+    for (auto blocks : sizes)
+    {
+        const auto in = makeData(8 * blocks);
+        std::vector<unsigned char> expected(in.size());
+        std::vector<unsigned char> out(in.size());
+        const std::string suffix = " of " + std::to_string(blocks) + " blocks with " + impl.name;
+
+        for (int i = 0; i < blocks; ++i)
+            gostcrypt(&ctx, in.data() + 8 * i, expected.data() + 8 * i);
+        gost_enc(&ctx, in.data(), out.data(), blocks);
+        if (out != expected)
+            throw std::runtime_error("testEquivalence: ECB encryption" + suffix + " differs.");
+
+        for (int i = 0; i < blocks; ++i)
+            gostdecrypt(&ctx, in.data() + 8 * i, expected.data() + 8 * i);
+        out = in;
+        gost_dec(&ctx, out.data(), out.data(), blocks);
+        if (out != expected)
+            throw std::runtime_error("testEquivalence: in-place ECB decryption" + suffix + " differs.");
+
+        // Reference CFB decryption, one block at a time
+        std::array<unsigned char, 8> iv = {1, 2, 3, 4, 5, 6, 7, 8};
+        std::array<unsigned char, 8> gamma{};
+        for (int i = 0; i < blocks; ++i)
+        {
+            gostcrypt(&ctx, iv.data(), gamma.data());
+            for (int j = 0; j < 8; ++j)
+            {
+                expected[8 * i + j] = in[8 * i + j] ^ gamma[j];
+                iv[j] = in[8 * i + j];
+            }
+        }
+        const std::array<unsigned char, 8> startIv = {1, 2, 3, 4, 5, 6, 7, 8};
+        out = in;
+        gost_dec_cfb(&ctx, startIv.data(), out.data(), out.data(), blocks);
+        if (out != expected)
+            throw std::runtime_error("testEquivalence: in-place CFB decryption" + suffix + " differs.");
+    }
+}
+
+// Gamma mode block by block, as the standard describes it
+std::vector<unsigned char> counterReference(gost_ctx& ctx, const std::array<unsigned char, 8>& start, const std::vector<unsigned char>& in)
+{
+    uint32_t n3 = 0, n4 = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        n3 |= uint32_t(start[i]) << (8 * i);
+        n4 |= uint32_t(start[4 + i]) << (8 * i);
+    }
+    std::vector<unsigned char> out(in.size());
+    for (size_t i = 0; i < in.size(); i += 8)
+    {
+        n3 += 0x01010101;
+        n4 += 0x01010104;
+        if (n4 < 0x01010104)
+            ++n4; // Modulo 2^32 - 1
+        std::array<unsigned char, 8> counter{}, gamma{};
+        for (int j = 0; j < 4; ++j)
+        {
+            counter[j] = n3 >> (8 * j);
+            counter[4 + j] = n4 >> (8 * j);
+        }
+        gostcrypt(&ctx, counter.data(), gamma.data());
+        for (int j = 0; j < 8; ++j)
+            out[i + j] = in[i + j] ^ gamma[j];
+    }
+    return out;
+}
+
+void testCounter(const Impl& impl, const gost_kbox* kbox)
+{
+    gost_ctx ctx;
+    initContext(ctx, kbox);
+
+    // Encrypted IV, then starts making N4 wrap around soon or be 2^32 - 1 right away
+    std::array<std::array<unsigned char, 8>, 3> starts{};
+    const std::array<unsigned char, 8> iv = {1, 2, 3, 4, 5, 6, 7, 8};
+    gostcrypt(&ctx, iv.data(), starts[0].data());
+    starts[1] = {0xff, 0xff, 0xff, 0xff, 0x00, 0xf0, 0xff, 0xff};
+    starts[2] = {0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff};
+
+    for (const auto& start : starts)
+    {
+        for (auto blocks : sizes)
+        {
+            const auto in = makeData(8 * blocks);
+            const auto expected = counterReference(ctx, start, in);
+            const std::string suffix = " of " + std::to_string(blocks) + " blocks with " + impl.name;
+
+            auto out = in;
+            gost_cnt_crypt(&ctx, start.data(), 0, out.data(), out.data(), blocks);
+            if (out != expected)
+                throw std::runtime_error("testCounter: in-place encryption" + suffix + " differs.");
+
+            // Any block may be the first one
+            for (int first = 1; first < blocks; first += 1 + first / 3)
+            {
+                std::vector<unsigned char> tail(in.size() - 8 * first);
+                gost_cnt_crypt(&ctx, start.data(), first, in.data() + 8 * first, tail.data(), blocks - first);
+                if (!std::equal(tail.begin(), tail.end(), expected.begin() + 8 * first))
+                    throw std::runtime_error("testCounter: encryption from block " + std::to_string(first) + suffix + " differs.");
+            }
+        }
+    }
+}
+
+void testKeys4(const Impl& impl, const gost_kbox* kbox)
+{
+    std::array<unsigned char, 128> keys;
+    for (size_t i = 0; i < keys.size(); ++i)
+        keys[i] = (i * 29 + 3) & 0xff;
+    const auto in = makeData(32);
+
+    // Lane layout: word i of key j is key[4 * i + j]
+    std::array<u4, 32> key;
+    for (int j = 0; j < 4; ++j)
+        for (int i = 0; i < 8; ++i)
+        {
+            const unsigned char* k = keys.data() + 32 * j + 4 * i;
+            key[4 * i + j] = k[0] | (k[1] << 8) | (k[2] << 16) | (u4(k[3]) << 24);
+        }
+    std::array<unsigned char, 32> out;
+    gost_enc_with_keys4(kbox, key.data(), in.data(), out.data());
+
+    gost_ctx ctx;
+    gost_init(&ctx, kbox);
+    std::array<unsigned char, 8> block;
+    for (int j = 0; j < 4; ++j)
+    {
+        gost_enc_with_key(&ctx, keys.data() + 32 * j, const_cast<unsigned char*>(in.data()) + 8 * j, block.data());
+        if (memcmp(block.data(), out.data() + 8 * j, 8))
+            throw std::runtime_error("testKeys4: " + impl.name + " lane " + std::to_string(j) + " is wrong.");
+    }
+}
+
+void testRbgLanes(const Impl& impl, const gost_kbox* kbox)
+{
+    // Lanes and serial generators seeded the same way, as the RBG does: key, then s from the seed
+    DSTU_RBG_LANES_STATE lanes;
+    std::array<gost_ctx, DSTU_RBG_LANES> ctx;
+    std::array<std::array<u4, 2>, DSTU_RBG_LANES> I, s;
+    std::array<unsigned char, 40> seed;
+    for (int j = 0; j < DSTU_RBG_LANES; ++j)
+    {
+        RAND_bytes(seed.data(), static_cast<int>(seed.size()));
+        RAND_bytes(reinterpret_cast<unsigned char*>(I[j].data()), 8);
+        gost_init(&ctx[j], kbox);
+        gost_key_nomask(&ctx[j], seed.data());
+        memcpy(s[j].data(), seed.data() + 32, 8);
+        for (int i = 0; i < 8; ++i)
+            lanes.key[DSTU_RBG_LANES * i + j] = ctx[j].key[i];
+        for (int i = 0; i < 2; ++i)
+        {
+            lanes.I[2 * j + i] = I[j][i];
+            lanes.s[2 * j + i] = s[j][i];
+        }
+    }
+
+    std::array<unsigned char, DSTU_RBG_LANES / 8> out;
+    for (int step = 0; step < 64; ++step)
+    {
+        dstu_rbg_lanes_step(&lanes, kbox, out.data());
+        for (int j = 0; j < DSTU_RBG_LANES; ++j)
+            if (((out[j / 8] >> (j % 8)) & 1) != dstu_rbg_step(&ctx[j], I[j].data(), s[j].data()))
+                throw std::runtime_error("testRbgLanes: " + impl.name + " lane " + std::to_string(j) +
+                                         " differs at step " + std::to_string(step) + ".");
+    }
+    for (auto& c : ctx)
+        gost_destroy(&c);
+}
+
+void testHash32(const Impl& impl, const gost_kbox* kbox)
+{
+    // Chained as the Key-6 password KDF does
+    std::array<unsigned char, 32> fast;
+    std::array<unsigned char, 32> generic;
+    const auto in = makeData(32);
+    std::copy(in.begin(), in.end(), fast.begin());
+    std::copy(in.begin(), in.end(), generic.begin());
+    gost_ctx cctx;
+    gost_init(&cctx, kbox);
+    for (int i = 0; i < 100; ++i)
+    {
+        gost_hash_ctx ctx;
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.cipher_ctx = &cctx;
+        hash_block(&ctx, generic.data(), generic.size());
+        finish_hash(&ctx, generic.data());
+        hash32(kbox, fast.data(), fast.data());
+        if (fast != generic)
+            throw std::runtime_error("testHash32: " + impl.name + " differs from generic hash at step " + std::to_string(i) + ".");
+    }
+}
+
+void testMultiCfb(const Impl& impl, const gost_kbox* other)
+{
+    // More streams than the widest kernel has lanes, some of them with other s-boxes
+    const int count = 37;
+    std::vector<gost_ctx> ctx(count);
+    std::vector<std::vector<unsigned char>> ivs, in, expected, out;
+    std::vector<gost_ctx*> ctxPtr;
+    std::vector<const unsigned char*> ivPtr, inPtr;
+    std::vector<unsigned char*> outPtr;
+    std::vector<int> blocks;
+    for (int i = 0; i < count; ++i)
+    {
+        std::array<unsigned char, 32> key{};
+        for (size_t j = 0; j < key.size(); ++j)
+            key[j] = i * 3 + j;
+        gost_init(&ctx[i], i % 5 == 4 ? other : dstu_sbox_get(default_sbox));
+        gost_key(&ctx[i], key.data());
+
+        blocks.push_back(sizes[i % sizes.size()] + i);
+        ivs.push_back(makeData(8 + i));
+        ivs.back().erase(ivs.back().begin(), ivs.back().begin() + i);
+        in.push_back(makeData(8 * blocks.back() + i));
+        in.back().erase(in.back().begin(), in.back().begin() + i);
+        expected.emplace_back(in.back().size());
+        gost_enc_cfb(&ctx[i], ivs.back().data(), in.back().data(), expected.back().data(), blocks.back());
+        out.emplace_back(in.back().size());
+    }
+    // One of the streams is encrypted in place
+    out[count - 1] = in[count - 1];
+    for (int i = 0; i < count; ++i)
+    {
+        ctxPtr.push_back(&ctx[i]);
+        ivPtr.push_back(ivs[i].data());
+        inPtr.push_back(i == count - 1 ? out[i].data() : in[i].data());
+        outPtr.push_back(out[i].data());
+    }
+
+    gost_enc_cfb_multi(ctxPtr.data(), ivPtr.data(), inPtr.data(), outPtr.data(), blocks.data(), count);
+    for (int i = 0; i < count; ++i)
+        if (out[i] != expected[i])
+            throw std::runtime_error("testMultiCfb: " + impl.name + " stream " + std::to_string(i) + " differs.");
+}
+
+void testStreamingMac()
+{
+    gost_ctx ctx;
+    initContext(ctx, dstu_sbox_get(default_sbox));
+
+    for (auto size : {0, 1, 5, 8, 9, 16, 17, 63, 64, 1000})
+    {
+        const auto data = makeData(size);
+        for (int bits : {1, 13, 32, 64})
+        {
+            std::array<unsigned char, 8> expected{};
+            gost_mac(&ctx, bits, data.data(), data.size(), expected.data());
+
+            // Parts of growing length, crossing block boundaries anywhere
+            gost_mac_ctx m;
+            gost_mac_start(&m, &ctx);
+            for (size_t done = 0, step = 0; done < data.size(); done += step, step = step * 2 % 11 + 1)
+                gost_mac_update(&m, data.data() + done, std::min(step, data.size() - done));
+            std::array<unsigned char, 8> mac{};
+            gost_mac_finish(&m, bits, mac.data());
+            if (mac != expected)
+                throw std::runtime_error("testStreamingMac: " + std::to_string(bits) + " bit MAC of " + std::to_string(size) + " bytes differs.");
+        }
+    }
+}
+
+void testCfbMac()
+{
+    gost_ctx ctx, macCtx;
+    initContext(ctx, dstu_sbox_get(default_sbox));
+    std::array<unsigned char, 32> macKey{};
+    for (size_t i = 0; i < macKey.size(); ++i)
+        macKey[i] = 100 - i;
+    gost_init(&macCtx, dstu_sbox_get(default_sbox));
+    gost_key(&macCtx, macKey.data());
+
+    const std::array<unsigned char, 8> iv = {1, 2, 3, 4, 5, 6, 7, 8};
+    for (auto blocks : sizes)
+    {
+        const auto in = makeData(8 * blocks);
+        std::vector<unsigned char> expected(in.size());
+        gost_enc_cfb(&ctx, iv.data(), in.data(), expected.data(), blocks);
+        std::array<unsigned char, 8> expectedMac{};
+        gost_mac(&macCtx, 64, expected.data(), expected.size(), expectedMac.data());
+        const std::string suffix = " of " + std::to_string(blocks) + " blocks";
+
+        auto out = in;
+        gost_mac_ctx m;
+        gost_mac_start(&m, &macCtx);
+        gost_enc_cfb_mac(&ctx, iv.data(), out.data(), out.data(), blocks, &m);
+        std::array<unsigned char, 8> mac{};
+        gost_mac_finish(&m, 64, mac.data());
+        if (out != expected || mac != expectedMac)
+            throw std::runtime_error("testCfbMac: encryption" + suffix + " differs.");
+
+        gost_mac_start(&m, &macCtx);
+        gost_dec_cfb_mac(&ctx, iv.data(), out.data(), out.data(), blocks, &m);
+        gost_mac_finish(&m, 64, mac.data());
+        if (out != in || mac != expectedMac)
+            throw std::runtime_error("testCfbMac: decryption" + suffix + " differs.");
+    }
+}
+
+void testParallelCfb()
+{
+    gost_ctx ctx;
+    initContext(ctx, dstu_sbox_get(default_sbox));
+
+    // Big enough to be split between 4 threads
+    const int blocks = 4 * DSTU_PARALLEL_MIN_BYTES / 8 + 3;
+    const auto in = makeData(8 * blocks);
+    const std::array<unsigned char, 8> iv = {1, 2, 3, 4, 5, 6, 7, 8};
+
+    dstu_parallel_set_threads(1);
+    auto expected = in;
+    gost_dec_cfb(&ctx, iv.data(), expected.data(), expected.data(), blocks);
+
+    dstu_parallel_set_threads(4);
+    if (dstu_parallel_threads_for(in.size()) != 4)
+        throw std::runtime_error("testParallelCfb: input is not split between threads.");
+    auto out = in;
+    gost_dec_cfb(&ctx, iv.data(), out.data(), out.data(), blocks);
+    if (out != expected)
+        throw std::runtime_error("testParallelCfb: in-place threaded CFB decryption differs.");
+    gost_dec_cfb(&ctx, iv.data(), in.data(), out.data(), blocks);
+    if (out != expected)
+        throw std::runtime_error("testParallelCfb: threaded CFB decryption differs.");
+
+    dstu_parallel_set_threads(0);
+}
+
+void testParallelCounter()
+{
+    gost_ctx ctx;
+    initContext(ctx, dstu_sbox_get(default_sbox));
+
+    const int blocks = 4 * DSTU_PARALLEL_MIN_BYTES / 8 + 3;
+    const auto in = makeData(8 * blocks);
+    const std::array<unsigned char, 8> start = {1, 2, 3, 4, 5, 6, 7, 8};
+
+    dstu_parallel_set_threads(1);
+    auto expected = in;
+    gost_cnt_crypt(&ctx, start.data(), 5, expected.data(), expected.data(), blocks);
+
+    dstu_parallel_set_threads(4);
+    auto out = in;
+    gost_cnt_crypt(&ctx, start.data(), 5, out.data(), out.data(), blocks);
+    if (out != expected)
+        throw std::runtime_error("testParallelCounter: threaded gamma mode encryption differs.");
+
+    dstu_parallel_set_threads(0);
+}
+
+
+void testFileHash()
+{
+    // Around the read buffer and the readahead window sizes
+    const std::array<size_t, 5> fileSizes = {0, 100, 65537, 300000, 5000001};
+    std::vector<std::string> names;
+    std::vector<const char*> paths;
+    std::vector<std::array<unsigned char, 32>> expected;
+    for (size_t size : fileSizes)
+    {
+        const auto data = makeData(size);
+        names.push_back("filehash-" + std::to_string(size) + ".bin");
+        auto* fp = fopen(names.back().c_str(), "wb");
+        if (fp == nullptr || fwrite(data.data(), 1, data.size(), fp) != data.size())
+            throw std::runtime_error("testFileHash: failed to write " + names.back() + ".");
+        fclose(fp);
+
+        gost_ctx cctx;
+        gost_init(&cctx, dstu_sbox_get(default_sbox));
+        gost_hash_ctx ctx{};
+        ctx.cipher_ctx = &cctx;
+        std::array<unsigned char, 32> md;
+        hash_block(&ctx, data.data(), data.size());
+        finish_hash(&ctx, md.data());
+        expected.push_back(md);
+
+        if (dstu_hash_file(names.back().c_str(), nullptr, md.data()) == 0 || md != expected.back())
+            throw std::runtime_error("testFileHash: wrong hash of " + std::to_string(size) + " bytes.");
+    }
+    for (const auto& name : names)
+        paths.push_back(name.c_str());
+    paths.push_back("filehash-missing.bin");
+
+    std::vector<unsigned char> md(paths.size() * DSTU_FILE_HASH_SIZE);
+    std::vector<int> error(paths.size());
+    dstu_hash_files(paths.data(), paths.size(), nullptr, md.data(), error.data());
+    for (size_t i = 0; i < names.size(); ++i)
+        if (error[i] != 0 || memcmp(md.data() + i * DSTU_FILE_HASH_SIZE, expected[i].data(), 32))
+            throw std::runtime_error("testFileHash: wrong hash of " + names[i] + " in a batch.");
+    if (error.back() == 0)
+        throw std::runtime_error("testFileHash: missing file is hashed.");
+
+    for (const auto& name : names)
+        remove(name.c_str());
+}
+
+// kP by the multiplication under test is the same as by EC_POINT_mul, P being the generator if point is null
+bool sameMul(const EC_GROUP* group, const EC_POINT* point, const BIGNUM* k, BN_CTX* ctx,
+             const std::function<int(EC_POINT*)>& mul)
+{
+    EC_POINT* expected = EC_POINT_new(group);
+    EC_POINT* actual = EC_POINT_new(group);
+    const bool same = expected != nullptr && actual != nullptr &&
+                      EC_POINT_mul(group, expected, point ? nullptr : k, point, point ? k : nullptr, ctx) == 1 &&
+                      mul(actual) == 1 &&
+                      EC_POINT_cmp(group, expected, actual, ctx) == 0;
+    EC_POINT_free(actual);
+    EC_POINT_free(expected);
+    return same;
+}
+
+void testGeneratorMul()
+{
+    BN_CTX* ctx = BN_CTX_new();
+    BIGNUM* k = BN_new();
+    for (int i = 0; i < DSTU_CURVE_COUNT; ++i)
+    {
+        const EC_GROUP* group = named_curve_group(i);
+        const BIGNUM* order = EC_GROUP_get0_order(group);
+        // Edge scalars have long runs of zero and full windows
+        for (int j = 0; j < 8; ++j)
+        {
+            if (j == 0)
+                BN_one(k);
+            else if (j == 1)
+                BN_sub(k, order, BN_value_one());
+            else if (j == 2)
+                BN_set_word(k, 16);
+            else
+                BN_rand_range(k, order);
+            if (!sameMul(group, nullptr, k, ctx, [&](EC_POINT* r) { return dstu_generator_mul(group, r, k, ctx); }))
+                throw std::runtime_error("testGeneratorMul: wrong multiple on curve " + std::to_string(i) + ".");
+        }
+    }
+
+    // Not a named curve: other generator of uacurve6, gets a table after a few uses
+    const EC_GROUP* named = named_curve_group(DEFAULT_CURVE);
+    EC_GROUP* custom = EC_GROUP_dup(named);
+    EC_POINT* G = EC_POINT_new(custom);
+    BN_set_word(k, 3);
+    if (EC_POINT_mul(custom, G, k, nullptr, nullptr, ctx) == 0 ||
+        EC_GROUP_set_generator(custom, G, EC_GROUP_get0_order(named), BN_value_one()) == 0)
+        throw std::runtime_error("testGeneratorMul: failed to make custom curve.");
+    for (int j = 0; j < 8; ++j)
+    {
+        BN_rand_range(k, EC_GROUP_get0_order(custom));
+        if (!sameMul(custom, nullptr, k, ctx, [&](EC_POINT* r) { return dstu_generator_mul(custom, r, k, ctx); }))
+            throw std::runtime_error("testGeneratorMul: wrong multiple on custom curve.");
+    }
+
+    // Composite order, not worth a table
+    BIGNUM* composite = BN_dup(EC_GROUP_get0_order(named));
+    BN_lshift1(composite, composite);
+    if (EC_GROUP_set_generator(custom, G, composite, BN_value_one()) == 0)
+        throw std::runtime_error("testGeneratorMul: failed to make custom curve.");
+    for (int j = 0; j < 5; ++j)
+    {
+        BN_rand_range(k, EC_GROUP_get0_order(named));
+        if (!sameMul(custom, nullptr, k, ctx, [&](EC_POINT* r) { return dstu_generator_mul(custom, r, k, ctx); }))
+            throw std::runtime_error("testGeneratorMul: wrong multiple on custom curve of composite order.");
+    }
+    BN_free(composite);
+
+    // More custom curves than get a table
+    for (unsigned long g = 5; g < 25; g += 2)
+    {
+        BN_set_word(k, g);
+        if (EC_POINT_mul(custom, G, k, nullptr, nullptr, ctx) == 0 ||
+            EC_GROUP_set_generator(custom, G, EC_GROUP_get0_order(named), BN_value_one()) == 0)
+            throw std::runtime_error("testGeneratorMul: failed to make custom curve.");
+        for (int j = 0; j < 5; ++j)
+        {
+            BN_rand_range(k, EC_GROUP_get0_order(custom));
+            if (!sameMul(custom, nullptr, k, ctx, [&](EC_POINT* r) { return dstu_generator_mul(custom, r, k, ctx); }))
+                throw std::runtime_error("testGeneratorMul: wrong multiple on custom curve " + std::to_string(g) + ".");
+        }
+    }
+    EC_POINT_free(G);
+    EC_GROUP_free(custom);
+    BN_free(k);
+    BN_CTX_free(ctx);
+}
+
+void testPointMul()
+{
+    BN_CTX* ctx = BN_CTX_new();
+    BIGNUM* k = BN_new();
+    BIGNUM* cofactor = BN_new();
+    std::vector<unsigned char> x;
+    for (int i = 0; i < DSTU_CURVE_COUNT; ++i)
+    {
+        const EC_GROUP* group = named_curve_group(i);
+        const BIGNUM* order = EC_GROUP_get0_order(group);
+        EC_POINT* P = EC_POINT_new(group);
+        EC_GROUP_get_cofactor(group, cofactor, ctx);
+        x.resize((EC_GROUP_get_degree(group) + 7) / 8);
+        for (int j = 0; j < 8; ++j)
+        {
+            // Odd j: any curve point, most of them are not in the subgroup of the generator
+            if (j % 2 == 0)
+            {
+                BN_rand_range(k, order);
+                EC_POINT_mul(group, P, k, nullptr, nullptr, ctx);
+            }
+            else
+            {
+                do
+                    RAND_bytes(x.data(), static_cast<int>(x.size()));
+                while (dstu_point_expand(x.data(), static_cast<int>(x.size()), group, P) == 0);
+            }
+
+            if (j == 0)
+                BN_one(k);
+            else if (j == 1)
+                BN_sub(k, order, BN_value_one());
+            else if (j == 2)
+                BN_copy(k, order);
+            else if (j == 3)
+            {
+                // Largest scalar the ladder takes without falling back, (k + 1)P = -P
+                BN_mul(k, order, cofactor, ctx);
+                BN_sub_word(k, 2);
+            }
+            else
+                BN_rand_range(k, order);
+            if (!sameMul(group, P, k, ctx, [&](EC_POINT* r) { return dstu_point_mul(group, r, P, k, ctx); }))
+                throw std::runtime_error("testPointMul: wrong multiple on curve " + std::to_string(i) + ".");
+            // Scalars above make kP or (k + 1)P infinity for points of order n, these do not
+            if (j >= 3 && !sameMul(group, P, k, ctx, [&](EC_POINT* r) { return dstu_ladder_mul(group, r, P, k, ctx); }))
+                throw std::runtime_error("testPointMul: ladder fell back on curve " + std::to_string(i) + ".");
+        }
+        EC_POINT_free(P);
+    }
+    BN_free(cofactor);
+    BN_free(k);
+    BN_CTX_free(ctx);
+}
+
+bool sameElem(const DSTU_GF2M_FIELD* f, const gf2m_elem a, const BIGNUM* expected)
+{
+    BIGNUM* bn = BN_new();
+    const bool same = gf2m_to_bn(f, bn, a) != 0 && BN_cmp(bn, expected) == 0;
+    BN_free(bn);
+    return same;
+}
+
+void testGf2mField(const DSTU_GF2M_FIELD* f, const BIGNUM* p, BN_CTX* ctx)
+{
+    BIGNUM* a = BN_new();
+    BIGNUM* b = BN_new();
+    BIGNUM* r = BN_new();
+    gf2m_elem ea, eb, er;
+    const int m = gf2m_degree(f);
+    for (int j = 0; j < 32; ++j)
+    {
+        // All ones hits every reduction term at once
+        if (j == 0)
+        {
+            BN_zero(a);
+            BN_set_bit(a, m);
+            BN_sub_word(a, 1);
+        }
+        else
+            BN_rand(a, m, BN_RAND_TOP_ANY, BN_RAND_BOTTOM_ANY);
+        BN_rand(b, m, BN_RAND_TOP_ANY, BN_RAND_BOTTOM_ANY);
+        if (gf2m_from_bn(f, ea, a) == 0 || gf2m_from_bn(f, eb, b) == 0)
+            throw std::runtime_error("testGf2m: failed to convert.");
+
+        BN_GF2m_mod_mul(r, a, b, p, ctx);
+        gf2m_mul(f, er, ea, eb);
+        if (!sameElem(f, er, r))
+            throw std::runtime_error("testGf2m: wrong product for m = " + std::to_string(m) + ".");
+        BN_GF2m_mod_sqr(r, a, p, ctx);
+        gf2m_sqr(f, er, ea);
+        if (!sameElem(f, er, r))
+            throw std::runtime_error("testGf2m: wrong square for m = " + std::to_string(m) + ".");
+        BN_GF2m_mod_inv(r, a, p, ctx);
+        gf2m_inv(f, er, ea);
+        if (!sameElem(f, er, r))
+            throw std::runtime_error("testGf2m: wrong inverse for m = " + std::to_string(m) + ".");
+        BN_GF2m_mod_sqrt(r, a, p, ctx);
+        gf2m_sqrt(f, er, ea);
+        if (!sameElem(f, er, r))
+            throw std::runtime_error("testGf2m: wrong square root for m = " + std::to_string(m) + ".");
+
+        // Tr(a) = a + a^2 + ... + a^(2^(m - 1))
+        BN_copy(r, a);
+        for (int i = 1; i < m; ++i)
+        {
+            BN_GF2m_mod_sqr(r, r, p, ctx);
+            BN_GF2m_add(r, r, a);
+        }
+        if (gf2m_trace(f, ea) != (BN_is_one(r) ? 1 : 0))
+            throw std::runtime_error("testGf2m: wrong trace for m = " + std::to_string(m) + ".");
+
+        // Root z of z^2 + z = a, if there is one
+        const int solved = gf2m_solve_quad(f, er, ea);
+        if (solved != (BN_is_zero(r) ? 1 : 0))
+            throw std::runtime_error("testGf2m: wrong solvability for m = " + std::to_string(m) + ".");
+        if (solved)
+        {
+            gf2m_sqr(f, eb, er);
+            gf2m_add(f, eb, eb, er);
+            if (!sameElem(f, eb, a))
+                throw std::runtime_error("testGf2m: wrong root for m = " + std::to_string(m) + ".");
+        }
+    }
+    gf2m_zero(ea);
+    gf2m_inv(f, er, ea);
+    if (gf2m_is_zero(f, er) == 0)
+        throw std::runtime_error("testGf2m: wrong inverse of zero.");
+    BN_free(r);
+    BN_free(b);
+    BN_free(a);
+}
+
+void testGf2m()
+{
+    BN_CTX* ctx = BN_CTX_new();
+    BIGNUM* p = BN_new();
+    for (int clmul = 1; clmul >= 0; --clmul)
+    {
+        if (gf2m_use_clmul(clmul) == 0)
+            continue; // Not supported by this CPU
+        for (int i = 0; i < DSTU_CURVE_COUNT; ++i)
+        {
+            EC_GROUP_get_curve_GF2m(named_curve_group(i), p, nullptr, nullptr, ctx);
+            const DSTU_GF2M_FIELD* f = gf2m_field(p);
+            if (f == nullptr)
+                throw std::runtime_error("testGf2m: no field for curve " + std::to_string(i) + ".");
+            testGf2mField(f, p, ctx);
+        }
+    }
+    gf2m_use_clmul(1);
+
+    // Not DSTU fields: x^163 + x^7 + x^6 + x + 1, and x^163 + x^7 + x^6, which starts like x^163 + x^7 + x^6 + x^3 + 1
+    for (const auto& bits : {std::vector<int>{163, 7, 6, 1, 0}, std::vector<int>{163, 7, 6}})
+    {
+        BN_zero(p);
+        for (const int bit : bits)
+            BN_set_bit(p, bit);
+        if (gf2m_field(p) != nullptr)
+            throw std::runtime_error("testGf2m: field for unknown polynomial.");
+    }
+    BN_free(p);
+    BN_CTX_free(ctx);
+}
+}
+
+int main()
+{
+    if (gost_get_impl() == GOST_IMPL_AUTO)
+        throw std::runtime_error("main: no implementation selected.");
+
+    gost_kbox cryptoPro;
+    kboxinit(&cryptoPro, &Gost28147_CryptoProParamSetA);
+
+    if (gost_impl_by_name("avx2") != GOST_IMPL_AVX2 || gost_impl_by_name("none") != -1 ||
+        std::string(gost_impl_name(GOST_IMPL_TABLE)) != "table")
+        throw std::runtime_error("main: wrong implementation names.");
+    if (gost_set_impl(GOST_IMPL_SCALAR) == 0)
+        throw std::runtime_error("main: failed to select scalar implementation.");
+    const auto mac = makeMac(dstu_sbox_get(default_sbox));
+
+    for (const auto& impl : impls)
+    {
+        if (gost_set_impl(impl.id) == 0)
+            continue; // Not supported by this CPU
+        if (gost_get_impl() != impl.id)
+            throw std::runtime_error("main: failed to select " + impl.name + ".");
+        testKnownAnswer(impl);
+        testMac(impl, dstu_sbox_get(default_sbox), mac);
+        testEquivalence(impl, dstu_sbox_get(default_sbox));
+        testEquivalence(impl, &cryptoPro);
+        testKeys4(impl, &cryptoPro);
+        testRbgLanes(impl, dstu_sbox_get(default_sbox));
+        testHash32(impl, dstu_sbox_get(default_sbox));
+        testHash32(impl, &cryptoPro);
+        testMultiCfb(impl, &cryptoPro);
+        testCounter(impl, dstu_sbox_get(default_sbox));
+        testCounter(impl, &cryptoPro);
+    }
+
+    if (gost_set_impl(GOST_IMPL_AUTO) == 0)
+        throw std::runtime_error("main: failed to restore default implementation.");
+
+    testStreamingMac();
+    testCfbMac();
+    testParallelCfb();
+    testParallelCounter();
+    testFileHash();
+    testGeneratorMul();
+    testGf2m();
+    testPointMul();
+
+    return 0;
+}
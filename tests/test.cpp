@@ -5,6 +5,9 @@
 #include <openssl/engine.h>
 #include <openssl/err.h>
 #include <openssl/conf.h>
+#include <openssl/x509.h>
+
+#include "control.h"
 
 #include <string>
 #include <array>
@@ -12,9 +15,20 @@
 #include <stdexcept>
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
+#include <bitset>
+#include <thread>
+#include <chrono>
 
 #include <cstring>
 #include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 
 namespace
 {
@@ -406,6 +420,150 @@ void testHash(ENGINE* engine)
     std::cout << "\n";
 }
 
+void testDigestBatch(ENGINE* engine)
+{
+    std::cout << "*** Testing DSTU 34311 batch ***\n";
+
+    // Default s-boxes with the first two rows swapped
+    const std::array<unsigned char, 64> sbox = {
+        0x80, 0xc4, 0x96, 0x7b, 0x23, 0x1f, 0x5e, 0xad,
+        0xa9, 0xd6, 0xeb, 0x45, 0xf1, 0x3c, 0x70, 0x82,
+        0xf6, 0x58, 0xeb, 0xa4, 0xc0, 0x37, 0x29, 0x1d,
+        0x38, 0xd9, 0x6b, 0xf0, 0x25, 0xca, 0x4e, 0x17,
+        0xf8, 0xe9, 0x72, 0x0d, 0xc6, 0x15, 0xb4, 0x3a,
+        0x28, 0x97, 0x5f, 0x0b, 0xc1, 0xde, 0xa3, 0x64,
+        0x38, 0xb5, 0x64, 0xea, 0x2c, 0x17, 0x9f, 0xd0,
+        0x12, 0x3e, 0x6d, 0xb8, 0xfa, 0xc5, 0x79, 0x04
+    };
+    const auto* mdt = ENGINE_get_digest(engine, NID_dstu34311);
+    if (mdt == nullptr)
+        throw std::runtime_error("testDigestBatch: failed to get digest. " + OPENSSLError());
+
+    // Sizes are chosen to leave partial blocks before and after the batch
+    const std::vector<size_t> sizes = {0, 1, 31, 32, 33, 64, 100, 3000, 5, 29, 32, 96, 1000, 7};
+    const size_t prefix = 3;
+
+    std::vector<EVP_MD_CTX*> batchCtx;
+    std::vector<EVP_MD_CTX*> refCtx;
+    std::vector<std::vector<unsigned char>> data;
+    std::vector<std::array<unsigned char, 32>> expected(sizes.size());
+    std::vector<std::array<unsigned char, 32>> out(sizes.size());
+    for (size_t i = 0; i < sizes.size(); ++i)
+    {
+        batchCtx.push_back(EVP_MD_CTX_new());
+        refCtx.push_back(EVP_MD_CTX_new());
+        if (EVP_DigestInit_ex(batchCtx.back(), mdt, engine) == 0 || EVP_DigestInit_ex(refCtx.back(), mdt, engine) == 0)
+            throw std::runtime_error("testDigestBatch: failed to initialize digest. " + OPENSSLError());
+        // Every third context has its own s-boxes
+        if (i % 3 == 2 &&
+            (EVP_MD_CTX_ctrl(batchCtx.back(), DSTU_SET_CUSTOM_SBOX, sbox.size(), const_cast<unsigned char*>(sbox.data())) == 0 ||
+             EVP_MD_CTX_ctrl(refCtx.back(), DSTU_SET_CUSTOM_SBOX, sbox.size(), const_cast<unsigned char*>(sbox.data())) == 0))
+            throw std::runtime_error("testDigestBatch: failed to set s-boxes. " + OPENSSLError());
+        data.emplace_back(sizes[i]);
+        for (size_t j = 0; j < sizes[i]; ++j)
+            data.back()[j] = (i * 17 + j * 5) & 0xff;
+
+        // Odd contexts have a partial block already
+        if (i % 2)
+        {
+            EVP_DigestUpdate(batchCtx.back(), DSTU28417::key.data(), prefix);
+            EVP_DigestUpdate(refCtx.back(), DSTU28417::key.data(), prefix);
+        }
+
+        unsigned int size = 0;
+        if (EVP_DigestUpdate(refCtx.back(), data.back().data(), sizes[i]) == 0 ||
+            EVP_DigestFinal_ex(refCtx.back(), expected[i].data(), &size) == 0)
+            throw std::runtime_error("testDigestBatch: failed to hash data. " + OPENSSLError());
+    }
+
+    std::vector<unsigned char*> outPtr;
+    std::vector<const unsigned char*> inPtr;
+    for (size_t i = 0; i < sizes.size(); ++i)
+    {
+        outPtr.push_back(out[i].data());
+        inPtr.push_back(data[i].data());
+    }
+    DSTU_DIGEST_BATCH batch{batchCtx.data(), inPtr.data(), sizes.data(), outPtr.data(), sizes.size()};
+    if (ENGINE_ctrl(engine, DSTU_ENGINE_DIGEST_BATCH, 0, &batch, nullptr) == 0)
+        throw std::runtime_error("testDigestBatch: failed to process batch. " + OPENSSLError());
+
+    for (size_t i = 0; i < sizes.size(); ++i)
+    {
+        if (out[i] != expected[i])
+            throw std::runtime_error("testDigestBatch: digest " + std::to_string(i) + " differs.");
+
+        // Context is left as after update
+        std::array<unsigned char, 32> md{};
+        unsigned int size = 0;
+        if (EVP_DigestFinal_ex(batchCtx[i], md.data(), &size) == 0 || md != expected[i])
+            throw std::runtime_error("testDigestBatch: context " + std::to_string(i) + " is out of sync after batch.");
+        EVP_MD_CTX_free(batchCtx[i]);
+        EVP_MD_CTX_free(refCtx[i]);
+    }
+    std::cout << " * batch of " << sizes.size() << " messages - success.\n";
+    std::cout << "\n";
+}
+
+void testHashState(ENGINE* engine)
+{
+    std::cout << "*** Testing DSTU 34311 state ***\n";
+
+    const auto* mdt = ENGINE_get_digest(engine, NID_dstu34311);
+    if (mdt == nullptr)
+        throw std::runtime_error("testHashState: failed to get digest. " + OPENSSLError());
+
+    std::vector<unsigned char> data(1000);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = (i * 13 + 1) & 0xff;
+    const auto expected = makeHash(engine, data.data(), data.size());
+
+    // Prefix ends in the middle of a block
+    const size_t prefix = 333;
+    std::array<unsigned char, DSTU_HASH_STATE_SIZE> state{};
+    auto* ctx = EVP_MD_CTX_new();
+    if (EVP_DigestInit_ex(ctx, mdt, engine) == 0 ||
+        EVP_DigestUpdate(ctx, data.data(), prefix) == 0 ||
+        EVP_MD_CTX_ctrl(ctx, DSTU_GET_HASH_STATE, state.size(), state.data()) == 0)
+        throw std::runtime_error("testHashState: failed to save state. " + OPENSSLError());
+    EVP_MD_CTX_free(ctx);
+    if (state[0] != 1)
+        throw std::runtime_error("testHashState: unexpected state version " + std::to_string(state[0]) + ".");
+
+    // The state may be restored any number of times
+    for (int i = 0; i < 2; ++i)
+    {
+        ctx = EVP_MD_CTX_new();
+        std::array<unsigned char, 32> md{};
+        unsigned int size = 0;
+        if (EVP_DigestInit_ex(ctx, mdt, engine) == 0 ||
+            EVP_MD_CTX_ctrl(ctx, DSTU_SET_HASH_STATE, state.size(), state.data()) == 0 ||
+            EVP_DigestUpdate(ctx, data.data() + prefix, data.size() - prefix) == 0 ||
+            EVP_DigestFinal_ex(ctx, md.data(), &size) == 0)
+            throw std::runtime_error("testHashState: failed to resume hashing. " + OPENSSLError());
+        EVP_MD_CTX_free(ctx);
+        if (md != expected)
+            throw std::runtime_error("testHashState: resumed hash differs.");
+    }
+
+    // Unknown versions and broken states are rejected
+    ctx = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(ctx, mdt, engine);
+    auto broken = state;
+    broken[0] = 2;
+    if (EVP_MD_CTX_ctrl(ctx, DSTU_SET_HASH_STATE, broken.size(), broken.data()) != 0)
+        throw std::runtime_error("testHashState: state of unknown version accepted.");
+    broken = state;
+    broken[1] = 32;
+    if (EVP_MD_CTX_ctrl(ctx, DSTU_SET_HASH_STATE, broken.size(), broken.data()) != 0)
+        throw std::runtime_error("testHashState: broken state accepted.");
+    if (EVP_MD_CTX_ctrl(ctx, DSTU_SET_HASH_STATE, state.size() - 1, state.data()) != 0)
+        throw std::runtime_error("testHashState: short state accepted.");
+    EVP_MD_CTX_free(ctx);
+
+    std::cout << " * save and restore - success.\n";
+    std::cout << "\n";
+}
+
 void testCipher(ENGINE* engine)
 {
     std::cout << "*** Testing DSTU 28147 cipher in CFB mode ***\n";
@@ -418,6 +576,639 @@ void testCipher(ENGINE* engine)
     std::cout << "\n";
 }
 
+EVP_CIPHER_CTX* makeCipherContext(ENGINE* engine, size_t n, bool enc)
+{
+    const auto* cipher = ENGINE_get_cipher(engine, NID_dstu28147_cfb);
+    if (cipher == nullptr)
+        throw std::runtime_error("makeCipherContext: failed to get cipher. " + OPENSSLError());
+
+    auto* ctx = EVP_CIPHER_CTX_new();
+    if (ctx == nullptr)
+        throw std::runtime_error("makeCipherContext: failed to create cipher context. " + OPENSSLError());
+
+    // Every stream gets its own key
+    auto key = DSTU28417::key;
+    key[0] ^= n;
+    if (EVP_CipherInit_ex(ctx, cipher, engine, key.data(), DSTU28417::iv.data(), enc ? 1 : 0) == 0)
+    {
+        EVP_CIPHER_CTX_free(ctx);
+        throw std::runtime_error("makeCipherContext: failed to initialize cipher. " + OPENSSLError());
+    }
+    return ctx;
+}
+
+void testCipherBatch(ENGINE* engine)
+{
+    std::cout << "*** Testing DSTU 28147 CFB batch ***\n";
+
+    // Sizes are chosen to leave partial blocks before and after the batch
+    const std::vector<size_t> sizes = {6, 8, 0, 22, 100, 3000, 1, 64, 257, 8, 16, 24, 32, 40, 48, 56, 800, 31};
+    const size_t prefix = 3;
+
+    std::vector<EVP_CIPHER_CTX*> batchCtx;
+    std::vector<EVP_CIPHER_CTX*> refCtx;
+    std::vector<std::vector<unsigned char>> data;
+    std::vector<std::vector<unsigned char>> expected;
+    std::vector<std::vector<unsigned char>> out;
+    for (size_t i = 0; i < sizes.size(); ++i)
+    {
+        // Last stream decrypts
+        const bool enc = i + 1 < sizes.size();
+        batchCtx.push_back(makeCipherContext(engine, i, enc));
+        refCtx.push_back(makeCipherContext(engine, i, enc));
+        data.emplace_back(sizes[i]);
+        for (size_t j = 0; j < sizes[i]; ++j)
+            data.back()[j] = (i * 31 + j * 7) & 0xff;
+
+        // Odd streams start in the middle of a block
+        if (i % 2)
+        {
+            std::array<unsigned char, prefix> tmp{};
+            int size = 0;
+            EVP_CipherUpdate(batchCtx.back(), tmp.data(), &size, data.back().data(), prefix);
+            EVP_CipherUpdate(refCtx.back(), tmp.data(), &size, data.back().data(), prefix);
+        }
+
+        expected.emplace_back(sizes[i]);
+        int size = 0;
+        if (sizes[i] && EVP_CipherUpdate(refCtx.back(), expected.back().data(), &size, data.back().data(), sizes[i]) == 0)
+            throw std::runtime_error("testCipherBatch: failed to process data. " + OPENSSLError());
+        out.emplace_back(sizes[i]);
+    }
+
+    std::vector<unsigned char*> outPtr;
+    std::vector<const unsigned char*> inPtr;
+    for (size_t i = 0; i < sizes.size(); ++i)
+    {
+        outPtr.push_back(out[i].data());
+        inPtr.push_back(data[i].data());
+    }
+    DSTU_CIPHER_BATCH batch{batchCtx.data(), outPtr.data(), inPtr.data(), sizes.data(), sizes.size()};
+    if (ENGINE_ctrl(engine, DSTU_ENGINE_CIPHER_BATCH, 0, &batch, nullptr) == 0)
+        throw std::runtime_error("testCipherBatch: failed to process batch. " + OPENSSLError());
+
+    for (size_t i = 0; i < sizes.size(); ++i)
+        if (out[i] != expected[i])
+            throw std::runtime_error("testCipherBatch: stream " + std::to_string(i) + " differs.");
+
+    // Contexts must stay usable after the batch
+    std::array<unsigned char, 5> tail{1, 2, 3, 4, 5};
+    for (size_t i = 0; i < sizes.size(); ++i)
+    {
+        std::array<unsigned char, 5> a{};
+        std::array<unsigned char, 5> b{};
+        int size = 0;
+        EVP_CipherUpdate(batchCtx[i], a.data(), &size, tail.data(), tail.size());
+        EVP_CipherUpdate(refCtx[i], b.data(), &size, tail.data(), tail.size());
+        if (a != b)
+            throw std::runtime_error("testCipherBatch: stream " + std::to_string(i) + " is out of sync after batch.");
+        EVP_CIPHER_CTX_free(batchCtx[i]);
+        EVP_CIPHER_CTX_free(refCtx[i]);
+    }
+    std::cout << " * batch of " << sizes.size() << " streams - success.\n";
+    std::cout << "\n";
+}
+
+EVP_CIPHER_CTX* makeCounterContext(ENGINE* engine, bool enc)
+{
+    const auto* cipher = ENGINE_get_cipher(engine, NID_dstu28147_ofb);
+    if (cipher == nullptr)
+        throw std::runtime_error("makeCounterContext: failed to get cipher. " + OPENSSLError());
+
+    auto* ctx = EVP_CIPHER_CTX_new();
+    if (ctx == nullptr)
+        throw std::runtime_error("makeCounterContext: failed to create cipher context. " + OPENSSLError());
+
+    if (EVP_CipherInit_ex(ctx, cipher, engine, DSTU28417::key.data(), DSTU28417::iv.data(), enc ? 1 : 0) == 0)
+    {
+        EVP_CIPHER_CTX_free(ctx);
+        throw std::runtime_error("makeCounterContext: failed to initialize cipher. " + OPENSSLError());
+    }
+    return ctx;
+}
+
+void testCounterMode(ENGINE* engine)
+{
+    std::cout << "*** Testing DSTU 28147 cipher in gamma mode ***\n";
+
+    std::vector<unsigned char> plain(1000);
+    for (size_t i = 0; i < plain.size(); ++i)
+        plain[i] = (i * 13 + 5) & 0xff;
+
+    std::vector<unsigned char> cipher(plain.size());
+    auto* ctx = makeCounterContext(engine, true);
+    int size = 0;
+    if (EVP_EncryptUpdate(ctx, cipher.data(), &size, plain.data(), plain.size()) == 0 || size != static_cast<int>(plain.size()))
+        throw std::runtime_error("testCounterMode: failed to encrypt data. " + OPENSSLError());
+    uint64_t pos = 0;
+    if (EVP_CIPHER_CTX_ctrl(ctx, DSTU_GET_CIPHER_POSITION, 0, &pos) <= 0 || pos != plain.size())
+        throw std::runtime_error("testCounterMode: wrong position after encryption.");
+    EVP_CIPHER_CTX_free(ctx);
+    if (cipher == plain)
+        throw std::runtime_error("testCounterMode: data is not encrypted.");
+
+    // Same keystream no matter how the input is split
+    std::vector<unsigned char> pieces(plain.size());
+    ctx = makeCounterContext(engine, true);
+    for (size_t done = 0, step = 1; done < plain.size(); done += step, step = step * 3 % 37 + 1)
+    {
+        const size_t len = std::min(step, plain.size() - done);
+        EVP_EncryptUpdate(ctx, pieces.data() + done, &size, plain.data() + done, len);
+    }
+    EVP_CIPHER_CTX_free(ctx);
+    if (pieces != cipher)
+        throw std::runtime_error("testCounterMode: encryption in pieces differs.");
+    std::cout << " * encryption - success.\n";
+
+    // Decryption is the same operation, and may start anywhere
+    for (uint64_t offset : {0, 5, 8, 517, 999})
+    {
+        ctx = makeCounterContext(engine, false);
+        if (EVP_CIPHER_CTX_ctrl(ctx, DSTU_SET_CIPHER_POSITION, 0, &offset) <= 0)
+            throw std::runtime_error("testCounterMode: failed to seek. " + OPENSSLError());
+        std::vector<unsigned char> out(cipher.size() - offset);
+        EVP_DecryptUpdate(ctx, out.data(), &size, cipher.data() + offset, out.size());
+        EVP_CIPHER_CTX_free(ctx);
+        if (!std::equal(out.begin(), out.end(), plain.begin() + offset))
+            throw std::runtime_error("testCounterMode: decryption from offset " + std::to_string(offset) + " differs.");
+    }
+    std::cout << " * decryption with seek - success.\n";
+    std::cout << "\n";
+}
+
+std::array<unsigned char, 8> makeMac(EVP_MD_CTX* keyed, const std::vector<unsigned char>& data, size_t step)
+{
+    auto* ctx = EVP_MD_CTX_new();
+    if (ctx == nullptr || EVP_MD_CTX_copy_ex(ctx, keyed) == 0)
+        throw std::runtime_error("makeMac: failed to copy context. " + OPENSSLError());
+    for (size_t done = 0; done < data.size(); done += step)
+        if (EVP_DigestUpdate(ctx, data.data() + done, std::min(step, data.size() - done)) == 0)
+            throw std::runtime_error("makeMac: failed to update MAC. " + OPENSSLError());
+    std::array<unsigned char, 8> res{};
+    unsigned int s = 0;
+    if (EVP_DigestFinal_ex(ctx, res.data(), &s) == 0 || s != res.size())
+        throw std::runtime_error("makeMac: failed to finalize MAC. " + OPENSSLError());
+    EVP_MD_CTX_free(ctx);
+    return res;
+}
+
+void testMac(ENGINE* engine)
+{
+    std::cout << "*** Testing DSTU 28147 MAC ***\n";
+
+    const auto* md = ENGINE_get_digest(engine, OBJ_sn2nid("dstu28147-mac"));
+    if (md == nullptr || EVP_get_digestbyname("dstu28147-mac") != md)
+        throw std::runtime_error("testMac: failed to get MAC. " + OPENSSLError());
+
+    auto* keyed = EVP_MD_CTX_new();
+    if (keyed == nullptr || EVP_DigestInit_ex(keyed, md, engine) == 0)
+        throw std::runtime_error("testMac: failed to initialize MAC. " + OPENSSLError());
+    if (EVP_DigestUpdate(keyed, "1", 1) != 0)
+        throw std::runtime_error("testMac: MAC accepted data without key.");
+    if (EVP_MD_CTX_ctrl(keyed, DSTU_SET_MAC_KEY, DSTU28417::key.size(), const_cast<unsigned char*>(DSTU28417::key.data())) <= 0)
+        throw std::runtime_error("testMac: failed to set key. " + OPENSSLError());
+
+    std::vector<unsigned char> data(1000);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = (i * 7 + 3) & 0xff;
+
+    const auto mac = makeMac(keyed, data, data.size());
+    if (mac[4] != 0 || mac[5] != 0 || mac[6] != 0 || mac[7] != 0)
+        throw std::runtime_error("testMac: default MAC is longer than 32 bits.");
+    for (size_t step : {1, 3, 8, 13, 333})
+        if (makeMac(keyed, data, step) != mac)
+            throw std::runtime_error("testMac: MAC in parts of " + std::to_string(step) + " bytes differs.");
+    std::cout << " * streaming - success.\n";
+
+    // Other message, then the first one again from the same keyed context
+    std::vector<unsigned char> other(data.begin(), data.begin() + 5);
+    if (makeMac(keyed, other, other.size()) == mac || makeMac(keyed, data, 64) != mac)
+        throw std::runtime_error("testMac: keyed context reuse failed.");
+
+    if (EVP_MD_CTX_ctrl(keyed, DSTU_SET_MAC_LENGTH, 64, nullptr) <= 0)
+        throw std::runtime_error("testMac: failed to set MAC length. " + OPENSSLError());
+    const auto mac64 = makeMac(keyed, data, data.size());
+    if (!std::equal(mac.begin(), mac.begin() + 4, mac64.begin()))
+        throw std::runtime_error("testMac: 64 bit MAC does not extend 32 bit one.");
+    if (EVP_MD_CTX_ctrl(keyed, DSTU_SET_MAC_LENGTH, 65, nullptr) > 0)
+        throw std::runtime_error("testMac: accepted MAC longer than 64 bits.");
+    EVP_MD_CTX_free(keyed);
+    std::cout << " * keyed context reuse - success.\n";
+    std::cout << "\n";
+}
+
+std::vector<unsigned char> cryptWithMac(ENGINE* engine, bool encrypt, const std::vector<unsigned char>& key, const std::vector<unsigned char>& data, std::array<unsigned char, 4>& tag)
+{
+    const auto* cipher = ENGINE_get_cipher(engine, OBJ_sn2nid("dstu28147-cfb-mac"));
+    if (cipher == nullptr || EVP_CIPHER_key_length(cipher) != 64)
+        throw std::runtime_error("cryptWithMac: failed to get cipher. " + OPENSSLError());
+
+    auto* ctx = EVP_CIPHER_CTX_new();
+    if (ctx == nullptr || EVP_CipherInit_ex(ctx, cipher, engine, key.data(), DSTU28417::iv.data(), encrypt) == 0)
+        throw std::runtime_error("cryptWithMac: failed to initialize cipher. " + OPENSSLError());
+    if (!encrypt && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, tag.size(), tag.data()) <= 0)
+        throw std::runtime_error("cryptWithMac: failed to set tag. " + OPENSSLError());
+
+    std::vector<unsigned char> res(data.size());
+    int size = 0;
+    for (size_t done = 0, step = 5; done < data.size(); done += step, step = step * 3 % 101 + 1)
+    {
+        const size_t len = std::min(step, data.size() - done);
+        if (EVP_CipherUpdate(ctx, res.data() + done, &size, data.data() + done, len) == 0)
+            throw std::runtime_error("cryptWithMac: failed to process data. " + OPENSSLError());
+    }
+    const bool ok = EVP_CipherFinal_ex(ctx, nullptr, &size) != 0;
+    if (ok && encrypt && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, tag.size(), tag.data()) <= 0)
+        throw std::runtime_error("cryptWithMac: failed to get tag. " + OPENSSLError());
+    EVP_CIPHER_CTX_free(ctx);
+    if (!ok)
+        res.clear();
+    return res;
+}
+
+void testCipherWithMac(ENGINE* engine)
+{
+    std::cout << "*** Testing DSTU 28147 CFB with MAC ***\n";
+
+    std::vector<unsigned char> key(DSTU28417::key.begin(), DSTU28417::key.end());
+    for (size_t i = 0; i < 32; ++i)
+        key.push_back(0xa0 ^ i);
+
+    std::vector<unsigned char> plain(1000);
+    for (size_t i = 0; i < plain.size(); ++i)
+        plain[i] = (i * 17 + 1) & 0xff;
+
+    std::array<unsigned char, 4> tag{};
+    const auto cipher = cryptWithMac(engine, true, key, plain, tag);
+    if (cipher != encrypt(engine, plain.data(), plain.size()))
+        throw std::runtime_error("testCipherWithMac: ciphertext differs from CFB.");
+
+    // Tag is the MAC of ciphertext with the second half of the key
+    const auto* md = ENGINE_get_digest(engine, OBJ_sn2nid("dstu28147-mac"));
+    auto* keyed = EVP_MD_CTX_new();
+    if (keyed == nullptr || EVP_DigestInit_ex(keyed, md, engine) == 0 ||
+        EVP_MD_CTX_ctrl(keyed, DSTU_SET_MAC_KEY, 32, key.data() + 32) <= 0)
+        throw std::runtime_error("testCipherWithMac: failed to initialize MAC. " + OPENSSLError());
+    const auto mac = makeMac(keyed, cipher, cipher.size());
+    EVP_MD_CTX_free(keyed);
+    if (!std::equal(tag.begin(), tag.end(), mac.begin()))
+        throw std::runtime_error("testCipherWithMac: tag differs from MAC of ciphertext.");
+    std::cout << " * encryption - success.\n";
+
+    if (cryptWithMac(engine, false, key, cipher, tag) != plain)
+        throw std::runtime_error("testCipherWithMac: decryption failed.");
+    auto tampered = cipher;
+    tampered[500] ^= 1;
+    if (!cryptWithMac(engine, false, key, tampered, tag).empty())
+        throw std::runtime_error("testCipherWithMac: modified ciphertext is accepted.");
+    tag[0] ^= 1;
+    if (!cryptWithMac(engine, false, key, cipher, tag).empty())
+        throw std::runtime_error("testCipherWithMac: wrong tag is accepted.");
+    std::cout << " * decryption and verification - success.\n";
+    std::cout << "\n";
+}
+
+std::vector<unsigned char> pbeCrypt(const EVP_CIPHER* cipher, const unsigned char* key, const unsigned char* iv, const std::vector<unsigned char>& data, bool enc)
+{
+    auto* ctx = EVP_CIPHER_CTX_new();
+    std::vector<unsigned char> res(data.size() + EVP_MAX_BLOCK_LENGTH);
+    int size = 0;
+    int last = 0;
+    if (ctx == nullptr || EVP_CipherInit_ex(ctx, cipher, nullptr, key, iv, enc ? 1 : 0) == 0 ||
+        EVP_CipherUpdate(ctx, res.data(), &size, data.data(), data.size()) == 0 ||
+        EVP_CipherFinal_ex(ctx, res.data() + size, &last) == 0)
+    {
+        EVP_CIPHER_CTX_free(ctx);
+        throw std::runtime_error("pbeCrypt: failed. " + OPENSSLError());
+    }
+    EVP_CIPHER_CTX_free(ctx);
+    res.resize(size + last);
+    return res;
+}
+
+// Decrypts with the key derived by PBES2 from the password, as PKCS#8 and PKCS#12 do
+std::vector<unsigned char> pbeDecrypt(const EVP_CIPHER* cipher, int prf, const std::string& pass, const std::vector<unsigned char>& salt, int iter, const unsigned char* iv, const std::vector<unsigned char>& data)
+{
+    auto* algor = PKCS5_pbe2_set_iv(cipher, iter, const_cast<unsigned char*>(salt.data()), salt.size(), const_cast<unsigned char*>(iv), prf);
+    if (algor == nullptr)
+        throw std::runtime_error("pbeDecrypt: failed to make PBES2 parameters. " + OPENSSLError());
+    auto* ctx = EVP_CIPHER_CTX_new();
+    std::vector<unsigned char> res(data.size() + EVP_MAX_BLOCK_LENGTH);
+    int size = 0;
+    int last = 0;
+    const bool ok = ctx != nullptr && EVP_PBE_CipherInit(algor->algorithm, pass.c_str(), pass.size(), algor->parameter, ctx, 0) != 0 &&
+                    EVP_CipherUpdate(ctx, res.data(), &size, data.data(), data.size()) != 0 &&
+                    EVP_CipherFinal_ex(ctx, res.data() + size, &last) != 0;
+    EVP_CIPHER_CTX_free(ctx);
+    X509_ALGOR_free(algor);
+    if (!ok)
+        throw std::runtime_error("pbeDecrypt: failed. " + OPENSSLError());
+    res.resize(size + last);
+    return res;
+}
+
+void testPbkdf2(ENGINE* engine)
+{
+    std::cout << "*** Testing PBKDF2 with HMAC-DSTU34311 ***\n";
+
+    const auto* md = ENGINE_get_digest(engine, NID_dstu34311);
+    const auto* dstu = ENGINE_get_cipher(engine, NID_dstu28147_cfb);
+    if (md == nullptr || dstu == nullptr)
+        throw std::runtime_error("testPbkdf2: failed to get algorithms. " + OPENSSLError());
+
+    std::vector<unsigned char> plain(100);
+    for (size_t i = 0; i < plain.size(); ++i)
+        plain[i] = (i * 13 + 5) & 0xff;
+    const std::vector<unsigned char> salt{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+    std::array<unsigned char, EVP_MAX_IV_LENGTH> iv{};
+    std::copy(DSTU28417::iv.begin(), DSTU28417::iv.end(), iv.begin());
+
+    // Builtin PBES2 with the engine digest first, then the engine one
+    for (const char* pbes2 : {"0", "1"})
+    {
+        if (ENGINE_ctrl_cmd_string(engine, "PBES2", pbes2, 0) == 0)
+            throw std::runtime_error(std::string("testPbkdf2: failed to set PBES2 to ") + pbes2 + ". " + OPENSSLError());
+        // Passwords are shorter, as long as and longer than the HMAC block
+        for (const std::string pass : {"", "123456", "abcdefghijklmnopqrstuvwxyz012345", "abcdefghijklmnopqrstuvwxyz0123456789"})
+        {
+            for (const int iter : {1, 2, 1000})
+            {
+                for (const auto* cipher : {dstu, EVP_aes_128_cbc(), EVP_aes_256_cbc()})
+                {
+                    std::array<unsigned char, EVP_MAX_KEY_LENGTH> key{};
+                    if (PKCS5_PBKDF2_HMAC(pass.c_str(), pass.size(), salt.data(), salt.size(), iter, md, EVP_CIPHER_key_length(cipher), key.data()) == 0)
+                        throw std::runtime_error("testPbkdf2: failed to derive reference key. " + OPENSSLError());
+                    const auto encrypted = pbeCrypt(cipher, key.data(), iv.data(), plain, true);
+                    if (pbeDecrypt(cipher, NID_hmacWithDstu34311, pass, salt, iter, iv.data(), encrypted) != plain)
+                        throw std::runtime_error(std::string("testPbkdf2: derived key differs with PBES2 ") + pbes2 + ", password length " + std::to_string(pass.size()) + ", " + std::to_string(iter) + " iterations.");
+                }
+            }
+        }
+    }
+    if (ENGINE_ctrl_cmd_string(engine, "PBES2", "0", 0) != 0)
+        throw std::runtime_error("testPbkdf2: builtin PBES2 is restored.");
+    ERR_clear_error();
+    std::cout << " * key derivation - success.\n";
+
+    // Other PRFs are left to OpenSSL
+    std::array<unsigned char, 16> key{};
+    if (PKCS5_PBKDF2_HMAC("123456", 6, salt.data(), salt.size(), 100, EVP_sha256(), key.size(), key.data()) == 0)
+        throw std::runtime_error("testPbkdf2: failed to derive reference key. " + OPENSSLError());
+    const auto encrypted = pbeCrypt(EVP_aes_128_cbc(), key.data(), iv.data(), plain, true);
+    if (pbeDecrypt(EVP_aes_128_cbc(), NID_hmacWithSHA256, "123456", salt, 100, iv.data(), encrypted) != plain)
+        throw std::runtime_error("testPbkdf2: derived key differs with HMAC-SHA256.");
+    std::cout << " * other PRF - success.\n";
+    std::cout << "\n";
+}
+
+void testGostImpl(ENGINE* engine)
+{
+    std::cout << "*** Testing GOST implementation selection ***\n";
+
+    std::vector<unsigned char> plain(1000);
+    for (size_t i = 0; i < plain.size(); ++i)
+        plain[i] = (i * 29 + 11) & 0xff;
+    const auto expected = encrypt(engine, plain.data(), plain.size());
+    const auto hash = makeHash(engine, plain.data(), plain.size());
+
+    for (const char* name : {"scalar", "table", "bitslice", "auto"})
+    {
+        if (ENGINE_ctrl_cmd_string(engine, "GOST_IMPL", name, 0) == 0)
+            throw std::runtime_error(std::string("testGostImpl: failed to select ") + name + ". " + OPENSSLError());
+        if (encrypt(engine, plain.data(), plain.size()) != expected || makeHash(engine, plain.data(), plain.size()) != hash)
+            throw std::runtime_error(std::string("testGostImpl: results differ with ") + name + ".");
+    }
+    if (ENGINE_ctrl_cmd_string(engine, "GOST_IMPL", "none", 0) != 0)
+        throw std::runtime_error("testGostImpl: unknown implementation is accepted.");
+    ERR_clear_error();
+    std::cout << " * selection - success.\n";
+    std::cout << "\n";
+}
+
+void testKeyMask(ENGINE* engine)
+{
+    std::cout << "*** Testing key mask sources ***\n";
+
+    std::vector<unsigned char> plain(100);
+    for (size_t i = 0; i < plain.size(); ++i)
+        plain[i] = (i * 13 + 5) & 0xff;
+    const auto expected = encrypt(engine, plain.data(), plain.size());
+
+    // Masks only hide the key, so ciphertext must not depend on where they come from
+    if (!ENGINE_set_default_RAND(engine))
+        throw std::runtime_error("testKeyMask: failed to set default RAND. " + OPENSSLError());
+    for (const char* name : {"rand", "drbg"})
+    {
+        if (ENGINE_ctrl_cmd_string(engine, "KEY_MASK", name, 0) == 0)
+            throw std::runtime_error(std::string("testKeyMask: failed to select ") + name + ". " + OPENSSLError());
+        if (encrypt(engine, plain.data(), plain.size()) != expected)
+            throw std::runtime_error(std::string("testKeyMask: results differ with ") + name + ".");
+    }
+    RAND_set_rand_method(NULL);
+    if (ENGINE_ctrl_cmd_string(engine, "KEY_MASK", "none", 0) != 0)
+        throw std::runtime_error("testKeyMask: unknown source is accepted.");
+    ERR_clear_error();
+    std::cout << " * selection - success.\n";
+    std::cout << "\n";
+}
+
+void testRbg(ENGINE* engine)
+{
+    std::cout << "*** Testing DSTU RBG ***\n";
+
+    const auto* rand = ENGINE_get_RAND(engine);
+    if (rand == nullptr || rand->status() != 1)
+        throw std::runtime_error("testRbg: RBG is not ready. " + OPENSSLError());
+
+    // Every thread has its own generator, seeded on its own
+    const size_t count = 4;
+    std::vector<std::vector<unsigned char>> out(count, std::vector<unsigned char>(64));
+    std::vector<int> res(count, 0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < count; ++i)
+        threads.emplace_back([&, i]() { res[i] = rand->bytes(out[i].data(), out[i].size() / 2) &&
+                                                 rand->bytes(out[i].data() + out[i].size() / 2, out[i].size() / 2); });
+    for (auto& thread : threads)
+        thread.join();
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (res[i] != 1)
+            throw std::runtime_error("testRbg: failed to get random bytes in thread " + std::to_string(i) + ".");
+        if (std::equal(out[i].begin(), out[i].begin() + 32, out[i].begin() + 32))
+            throw std::runtime_error("testRbg: output repeats in thread " + std::to_string(i) + ".");
+        for (size_t j = 0; j < i; ++j)
+            if (out[i] == out[j])
+                throw std::runtime_error("testRbg: threads " + std::to_string(j) + " and " + std::to_string(i) + " got the same output.");
+    }
+    std::cout << " * thread local generators - success.\n";
+
+    for (const char* mode : {"watermark", "background", "off"})
+    {
+        if (ENGINE_ctrl_cmd_string(engine, "RBG_REFILL", mode, 0) == 0)
+            throw std::runtime_error(std::string("testRbg: failed to select ") + mode + " refill. " + OPENSSLError());
+        // Requests smaller and larger than the buffer, so that both buffered and fresh output is used
+        std::vector<unsigned char> prev;
+        for (const size_t size : {32, 32, 3000, 32, 1000, 32})
+        {
+            std::vector<unsigned char> buf(size);
+            if (rand->bytes(buf.data(), buf.size()) != 1)
+                throw std::runtime_error(std::string("testRbg: failed to get random bytes with ") + mode + " refill.");
+            if (std::all_of(buf.begin(), buf.end(), [](unsigned char c) { return c == 0; }) ||
+                (prev.size() >= 32 && std::equal(buf.begin(), buf.begin() + 32, prev.begin())))
+                throw std::runtime_error(std::string("testRbg: bad output with ") + mode + " refill.");
+            prev = buf;
+        }
+    }
+    if (ENGINE_ctrl_cmd_string(engine, "RBG_REFILL", "none", 0) != 0)
+        throw std::runtime_error("testRbg: unknown refill mode is accepted.");
+    ERR_clear_error();
+    std::cout << " * refill modes - success.\n";
+
+#ifndef _WIN32
+    // A forked child does not repeat buffered output of its parent, and exits though the parent has a worker
+    if (ENGINE_ctrl_cmd_string(engine, "RBG_REFILL", "background", 0) == 0)
+        throw std::runtime_error("testRbg: failed to select background refill. " + OPENSSLError());
+    std::vector<unsigned char> parent(32), child(32);
+    if (rand->bytes(parent.data(), parent.size()) != 1)
+        throw std::runtime_error("testRbg: failed to get random bytes before fork.");
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    int fds[2];
+    if (pipe(fds) != 0)
+        throw std::runtime_error("testRbg: failed to create pipe.");
+    // The child flushes what it inherited when it exits
+    std::cout.flush();
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        const bool ok = rand->bytes(child.data(), child.size()) == 1 &&
+                        write(fds[1], child.data(), child.size()) == static_cast<ssize_t>(child.size());
+        std::exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    const bool read_ok = pid > 0 && read(fds[0], child.data(), child.size()) == static_cast<ssize_t>(child.size());
+    close(fds[0]);
+    int status = 1;
+    if (pid > 0)
+        waitpid(pid, &status, 0);
+    if (!read_ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        throw std::runtime_error("testRbg: forked child failed.");
+    if (rand->bytes(parent.data(), parent.size()) != 1 || parent == child)
+        throw std::runtime_error("testRbg: forked child got the output of its parent.");
+    if (ENGINE_ctrl_cmd_string(engine, "RBG_REFILL", "off", 0) == 0)
+        throw std::runtime_error("testRbg: failed to select off refill. " + OPENSSLError());
+    std::cout << " * fork - success.\n";
+#endif
+
+    for (const char* mode : {"lanes", "serial"})
+    {
+        if (ENGINE_ctrl_cmd_string(engine, "RBG_MODE", mode, 0) == 0)
+            throw std::runtime_error(std::string("testRbg: failed to select ") + mode + " mode. " + OPENSSLError());
+        // Odd sizes, so that lanes give out their steps in parts
+        std::vector<unsigned char> buf;
+        for (const size_t size : {1, 3, 32, 3000, 5})
+        {
+            std::vector<unsigned char> part(size);
+            if (rand->bytes(part.data(), part.size()) != 1)
+                throw std::runtime_error(std::string("testRbg: failed to get random bytes in ") + mode + " mode.");
+            buf.insert(buf.end(), part.begin(), part.end());
+        }
+        // Lanes sharing a state would give only all-zero and all-one bytes
+        size_t ones = 0, uniform = 0;
+        for (unsigned char c : buf)
+        {
+            ones += std::bitset<8>(c).count();
+            uniform += c == 0 || c == 0xff;
+        }
+        if (ones < buf.size() * 4 - 600 || ones > buf.size() * 4 + 600 || uniform > buf.size() / 20)
+            throw std::runtime_error(std::string("testRbg: bad output in ") + mode + " mode.");
+    }
+    if (ENGINE_ctrl_cmd_string(engine, "RBG_MODE", "none", 0) != 0)
+        throw std::runtime_error("testRbg: unknown mode is accepted.");
+    ERR_clear_error();
+    std::cout << " * generator modes - success.\n";
+    std::cout << "\n";
+}
+
+void testNoncePool(ENGINE* engine)
+{
+    std::cout << "*** Testing DSTU 4145 nonce pool ***\n";
+    auto pub = readPubKey("public1.pem");
+    auto pk = readPrivateKey("private1.pem", "123456");
+    auto* md = ENGINE_get_digest(engine, NID_dstu34311);
+    if (md == nullptr)
+        throw std::runtime_error("testNoncePool: failed to get digest. " + OPENSSLError());
+
+    if (ENGINE_ctrl_cmd_string(engine, "NONCE_POOL", "8", 0) == 0)
+        throw std::runtime_error("testNoncePool: failed to turn the pool on. " + OPENSSLError());
+    // More signatures than the pool holds, so that pooled and inline nonces are both used
+    std::vector<std::vector<unsigned char>> signatures;
+    for (size_t i = 0; i < 32; ++i)
+    {
+        signatures.push_back(sign(engine, md, pk, "123456", 6));
+        verify(engine, md, pub, signatures.back(), "123456", 6);
+        if (std::count(signatures.begin(), signatures.end(), signatures.back()) != 1)
+            throw std::runtime_error("testNoncePool: nonce is used twice.");
+        // First signature asks for the curve to be filled
+        if (i == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    std::cout << " * pooled nonces - success.\n";
+
+#ifndef _WIN32
+    // A forked child turning the pool on again does not sign with the nonces of its parent, and exits
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::vector<unsigned char> child;
+    int fds[2];
+    if (pipe(fds) != 0)
+        throw std::runtime_error("testNoncePool: failed to create pipe.");
+    // The child flushes what it inherited when it exits
+    std::cout.flush();
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        bool ok = ENGINE_ctrl_cmd_string(engine, "NONCE_POOL", "8", 0) != 0;
+        if (ok)
+            child = sign(engine, md, pk, "123456", 6);
+        const size_t size = child.size();
+        ok = ok && write(fds[1], &size, sizeof(size)) == static_cast<ssize_t>(sizeof(size)) &&
+             write(fds[1], child.data(), size) == static_cast<ssize_t>(size);
+        std::exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    size_t size = 0;
+    bool read_ok = pid > 0 && read(fds[0], &size, sizeof(size)) == static_cast<ssize_t>(sizeof(size)) && size < 4096;
+    if (read_ok)
+    {
+        child.resize(size);
+        read_ok = read(fds[0], child.data(), size) == static_cast<ssize_t>(size);
+    }
+    close(fds[0]);
+    int status = 1;
+    if (pid > 0)
+        waitpid(pid, &status, 0);
+    if (!read_ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        throw std::runtime_error("testNoncePool: forked child failed.");
+    if (sign(engine, md, pk, "123456", 6) == child)
+        throw std::runtime_error("testNoncePool: forked child used a nonce of its parent.");
+    std::cout << " * fork - success.\n";
+#endif
+
+    if (ENGINE_ctrl_cmd_string(engine, "NONCE_POOL", "-1", 0) != 0 ||
+        ENGINE_ctrl_cmd_string(engine, "NONCE_POOL", "100000", 0) != 0)
+        throw std::runtime_error("testNoncePool: bad pool size is accepted.");
+    ERR_clear_error();
+    if (ENGINE_ctrl_cmd_string(engine, "NONCE_POOL", "0", 0) == 0)
+        throw std::runtime_error("testNoncePool: failed to turn the pool off. " + OPENSSLError());
+    testSignVerify(engine, pub, pk, "123456", 6);
+    std::cout << " * pool off - success.\n";
+    std::cout << "\n";
+    EVP_PKEY_free(pub);
+    EVP_PKEY_free(pk);
+}
+
 void testPKey(ENGINE* engine)
 {
     auto pub1 = readPubKey("public1.pem");
@@ -455,8 +1246,19 @@ int main()
         throw std::runtime_error("main: failed to initialize engine. " + OPENSSLError());
 
     testHash(engine);
+    testDigestBatch(engine);
+    testHashState(engine);
     testCipher(engine);
+    testCipherBatch(engine);
+    testCounterMode(engine);
+    testMac(engine);
+    testCipherWithMac(engine);
+    testPbkdf2(engine);
+    testGostImpl(engine);
+    testRbg(engine);
+    testKeyMask(engine);
     testPKey(engine);
+    testNoncePool(engine);
 
     ENGINE_finish(engine);
     ENGINE_free(engine);
@@ -0,0 +1,311 @@
+/* =====================================================================
+ * This file is distributed under the same license as OpenSSL
+ ==================================================================== */
+
+/* Prints or checks DSTU 34311 checksums of files, the same way as sha256sum does */
+
+#include "filehash.h" // dstu_hash_*
+#include "parallel.h" // dstu_parallel_set_threads
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Files hashed at a time, bounds memory used for long file lists */
+#define SUM_BATCH 4096
+
+typedef struct
+{
+    char *path;
+    unsigned char expected[DSTU_FILE_HASH_SIZE];
+    unsigned char md[DSTU_FILE_HASH_SIZE];
+    int error;
+} SUM_ENTRY;
+
+typedef struct
+{
+    int check;
+    SUM_ENTRY entries[SUM_BATCH];
+    size_t count;
+    /* Failures, for the summary of check mode */
+    unsigned long unreadable;
+    unsigned long mismatched;
+    unsigned long malformed;
+} SUM_STATE;
+
+static const char *progname = "dstu-sum";
+
+static void usage(FILE *out)
+{
+    fprintf(out,
+            "Usage: %s [-c] [-j THREADS] [-f LIST] [FILE]...\n"
+            "Print or check DSTU 34311 checksums.\n"
+            "With no FILE, or when FILE is -, read standard input.\n"
+            "\n"
+            "  -c          read checksums from the FILEs and check them\n"
+            "  -j THREADS  number of files to hash at once, all CPUs by default\n"
+            "  -f LIST     also take FILEs from LIST, one per line, - for standard input\n"
+            "  -h          print this help\n",
+            progname);
+}
+
+static void print_hex(const unsigned char *md)
+{
+    size_t i;
+
+    for (i = 0; i < DSTU_FILE_HASH_SIZE; i++)
+        printf("%02x", md[i]);
+}
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static int parse_hex(const char *s, unsigned char *md)
+{
+    int hi, lo;
+    size_t i;
+
+    for (i = 0; i < DSTU_FILE_HASH_SIZE; i++)
+    {
+        hi = hex_digit(s[2 * i]);
+        lo = hi < 0 ? -1 : hex_digit(s[2 * i + 1]);
+        if (lo < 0)
+            return 0;
+        md[i] = (unsigned char) (hi << 4 | lo);
+    }
+    return 1;
+}
+
+/* Hashes every entry of the batch, reports results and empties it */
+static void flush_batch(SUM_STATE *state)
+{
+    const char *paths[SUM_BATCH];
+    unsigned char md[SUM_BATCH * DSTU_FILE_HASH_SIZE];
+    int error[SUM_BATCH];
+    size_t index[SUM_BATCH];
+    size_t i, n = 0;
+    SUM_ENTRY *e;
+
+    for (i = 0; i < state->count; i++)
+    {
+        e = &(state->entries[i]);
+        if (strcmp(e->path, "-"))
+        {
+            paths[n] = e->path;
+            index[n++] = i;
+        }
+        else
+            e->error = dstu_hash_fd(0, NULL, e->md) ? 0 : errno;
+    }
+
+    dstu_hash_files(paths, n, NULL, md, error);
+    for (i = 0; i < n; i++)
+    {
+        e = &(state->entries[index[i]]);
+        e->error = error[i];
+        memcpy(e->md, md + i * DSTU_FILE_HASH_SIZE, DSTU_FILE_HASH_SIZE);
+    }
+
+    for (i = 0; i < state->count; i++)
+    {
+        e = &(state->entries[i]);
+        if (e->error)
+        {
+            fflush(stdout);
+            fprintf(stderr, "%s: %s: %s\n", progname, e->path, strerror(e->error));
+            if (state->check)
+                printf("%s: FAILED open or read\n", e->path);
+            state->unreadable++;
+        }
+        else if (!state->check)
+        {
+            print_hex(e->md);
+            printf("  %s\n", e->path);
+        }
+        else if (memcmp(e->md, e->expected, DSTU_FILE_HASH_SIZE))
+        {
+            printf("%s: FAILED\n", e->path);
+            state->mismatched++;
+        }
+        else
+            printf("%s: OK\n", e->path);
+        free(e->path);
+    }
+    fflush(stdout);
+    state->count = 0;
+}
+
+static int add_entry(SUM_STATE *state, const char *path, const unsigned char *expected)
+{
+    SUM_ENTRY *e = &(state->entries[state->count]);
+
+    e->path = strdup(path);
+    if (!e->path)
+    {
+        fprintf(stderr, "%s: %s\n", progname, strerror(ENOMEM));
+        return 0;
+    }
+    if (expected)
+        memcpy(e->expected, expected, DSTU_FILE_HASH_SIZE);
+    if (++state->count == SUM_BATCH)
+        flush_batch(state);
+    return 1;
+}
+
+/* Opens name for reading, - is standard input */
+static FILE *open_list(const char *name)
+{
+    FILE *fp = strcmp(name, "-") ? fopen(name, "r") : stdin;
+
+    if (!fp)
+        fprintf(stderr, "%s: %s: %s\n", progname, name, strerror(errno));
+    return fp;
+}
+
+static void close_list(FILE *fp)
+{
+    if (fp != stdin)
+        fclose(fp);
+}
+
+static void chomp(char *line)
+{
+    size_t len = strlen(line);
+
+    while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        line[--len] = 0;
+}
+
+static int add_checks(SUM_STATE *state, const char *name);
+
+/* Adds a file to hash, or in check mode the files listed in it */
+static int add_file(SUM_STATE *state, const char *name)
+{
+    return state->check ? add_checks(state, name) : add_entry(state, name, NULL);
+}
+
+/* Adds files named by lines of a list */
+static int add_list(SUM_STATE *state, const char *name)
+{
+    char *line = NULL;
+    size_t size = 0;
+    int ret = 1;
+    FILE *fp = open_list(name);
+
+    if (!fp)
+        return 0;
+
+    while (ret && getline(&line, &size, fp) >= 0)
+    {
+        chomp(line);
+        if (*line)
+            ret = add_file(state, line);
+    }
+
+    free(line);
+    close_list(fp);
+    return ret;
+}
+
+/* Adds files listed with their checksums: "<hex>  <name>" or "<hex> *<name>" */
+static int add_checks(SUM_STATE *state, const char *name)
+{
+    unsigned char expected[DSTU_FILE_HASH_SIZE];
+    char *line = NULL;
+    size_t size = 0;
+    int ret = 1;
+    FILE *fp = open_list(name);
+
+    if (!fp)
+        return 0;
+
+    while (ret && getline(&line, &size, fp) >= 0)
+    {
+        chomp(line);
+        if (!*line)
+            continue;
+        if (strlen(line) < 2 * DSTU_FILE_HASH_SIZE + 3 || !parse_hex(line, expected) ||
+            line[2 * DSTU_FILE_HASH_SIZE] != ' ' ||
+            (line[2 * DSTU_FILE_HASH_SIZE + 1] != ' ' && line[2 * DSTU_FILE_HASH_SIZE + 1] != '*'))
+        {
+            state->malformed++;
+            continue;
+        }
+        ret = add_entry(state, line + 2 * DSTU_FILE_HASH_SIZE + 2, expected);
+    }
+
+    free(line);
+    close_list(fp);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    static SUM_STATE state;
+    int i, files = 0, ok = 1;
+    const char *list = NULL;
+    char *end;
+    long threads;
+
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++)
+    {
+        if (!strcmp(argv[i], "--"))
+        {
+            i++;
+            break;
+        }
+        if (!strcmp(argv[i], "-c"))
+            state.check = 1;
+        else if (!strcmp(argv[i], "-h"))
+        {
+            usage(stdout);
+            return 0;
+        }
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+        {
+            threads = strtol(argv[++i], &end, 10);
+            if (*end || threads < 1 || threads > 1024)
+            {
+                fprintf(stderr, "%s: invalid number of threads: %s\n", progname, argv[i]);
+                return 2;
+            }
+            dstu_parallel_set_threads((int) threads);
+        }
+        else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+            list = argv[++i];
+        else
+        {
+            usage(stderr);
+            return 2;
+        }
+    }
+
+    if (list)
+    {
+        ok = add_list(&state, list);
+        files = 1;
+    }
+    for (; ok && i < argc; i++, files++)
+        ok = add_file(&state, argv[i]);
+    if (ok && !files)
+        ok = add_file(&state, "-");
+    flush_batch(&state);
+
+    if (state.malformed)
+        fprintf(stderr, "%s: WARNING: %lu line(s) are improperly formatted\n", progname, state.malformed);
+    if (state.check && state.unreadable)
+        fprintf(stderr, "%s: WARNING: %lu listed file(s) could not be read\n", progname, state.unreadable);
+    if (state.mismatched)
+        fprintf(stderr, "%s: WARNING: %lu computed checksum(s) did NOT match\n", progname, state.mismatched);
+
+    return ok && !state.unreadable && !state.mismatched && !state.malformed ? 0 : 1;
+}